@@ -128,6 +128,9 @@ namespace Vanubi.UI {
 	class SimpleCompletionBar<G> : CompletionBar<G> {
 		protected Annotated[] choices;
 		bool sort;
+		// choices added while matching in a thread, merged later
+		GenericArray<Annotated<G>> pending = new GenericArray<Annotated<G>> ();
+		int matching = 0;
 
 		public SimpleCompletionBar (owned Annotated[] choices, string default = "", bool sort = true) {
 			base (default);
@@ -135,21 +138,56 @@ namespace Vanubi.UI {
 			this.sort = sort;
 		}
 
+		/* For choices that are produced progressively */
+		public void add_choices (Annotated<G>[] more) {
+			foreach (var choice in more) {
+				pending.add (choice);
+			}
+			if (matching == 0) {
+				refresh ();
+			}
+		}
+
+		void merge_pending () {
+			if (pending.length == 0) {
+				return;
+			}
+			var merged = new Annotated[choices.length+pending.length];
+			for (var i=0; i < choices.length; i++) {
+				merged[i] = choices[i];
+			}
+			for (var i=0; i < pending.length; i++) {
+				merged[choices.length+i] = pending[i];
+			}
+			choices = (owned) merged;
+			pending = new GenericArray<Annotated<G>> ();
+		}
+
 		protected override async Annotated[]? complete (string pattern, out string common_choice, Cancellable cancellable) {
 			common_choice = pattern;
+			// the choices can't change while a thread is matching them
+			if (matching == 0) {
+				merge_pending ();
+			}
 			if (pattern[0] == '\0') {
 				// needed for keeping the order of original choices
 				return choices;
 			}
 			
 			GenericArray<Annotated<G>> matches;
+			matching++;
 			try {
-				matches = yield run_in_thread (() => { return pattern_match_many<G> (pattern, choices, sort, cancellable); });
+				matches = yield run_in_thread (() => { return pattern_match_many_parallel<G> (pattern, choices, sort, cancellable); });
 			} catch (IOError.CANCELLED e) {
 				return null;
 			} catch (Error e) {
 				message (e.message);
 				return null;
+			} finally {
+				matching--;
+				if (matching == 0 && pending.length > 0) {
+					Idle.add (() => { refresh (); return false; });
+				}
 			}
 
 			if (matches.length > 0) {
@@ -59,6 +59,21 @@ namespace Vanubi.UI {
 			}
 		}
 
+		public override BracketCache? bracket_cache {
+			get {
+				var ebuf = view.buffer as EditorBuffer;
+				return ebuf != null ? ebuf.bracket_cache : base.bracket_cache;
+			}
+			set {
+				var ebuf = view.buffer as EditorBuffer;
+				if (ebuf != null) {
+					ebuf.bracket_cache = value;
+				} else {
+					base.bracket_cache = value;
+				}
+			}
+		}
+
 		public override string line_text (int line) {
 			Gtk.TextIter start;
 			buf.get_iter_at_line (out start, line);
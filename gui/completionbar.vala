@@ -83,6 +83,19 @@ namespace Vanubi.UI {
 			original_pattern = entry.get_text ();
 			common_choice = null;
 			navigated = false;
+			start_completion ();
+		}
+		
+		/* Completes the current pattern again, when the choices have changed */
+		protected void refresh () {
+			if (navigated) {
+				// don't move the selection under the user
+				return;
+			}
+			start_completion ();
+		}
+		
+		void start_completion () {
 			if (current_completion != null) {
 				current_completion.cancel ();
 			}
@@ -22,43 +22,145 @@ using Gtk;
 namespace Vanubi.UI {
 	public class EditorBuffer : SourceBuffer {
 		public AbbrevCompletion abbrevs { get; private set; default = new AbbrevCompletion (); }
-		uint abbrev_timeout = 0;
+		public TextTag search_tag;
 		public TextTag selection_tag;
+		// kept across indentations, see UI.Buffer
+		public BracketCache? bracket_cache {
+			get {
+				flush_brackets ();
+				return _bracket_cache;
+			}
+			set {
+				_bracket_cache = value;
+				dirty_bracket_line = -1;
+			}
+		}
+		BracketCache? _bracket_cache;
+		// the per-line indexing is suspended during bulk edits
+		int bulk_edits = 0;
+		int dirty_bracket_line = -1;
+		bool abbrevs_dirty = false;
+		bool indexing_abbrevs = false;
 
 		public EditorBuffer () {
+			// created first, the selection has priority over it
+			search_tag = create_tag (null, background: "yellow", foreground: "black");
 			selection_tag = create_tag (null, background: "blue", foreground: "white");
+			// code and comments depend on the language
+			notify["language"].connect (() => { bracket_cache = null; });
+			// comments and strings are known once the highlighting reaches them
+			highlight_updated.connect ((start, end) => { invalidate_brackets (start.get_line ()); });
 		}
 
-		~EditorBuffer () {
-			if (abbrev_timeout > 0) {
-				Source.remove (abbrev_timeout);
+		/* Emitted when the outermost bulk edit begins and ends, the listeners
+		 * suspend their per-edit work in between and catch up once at the end */
+		public signal void bulk_edit_started ();
+		public signal void bulk_edit_finished ();
+
+		/* Keep the abbreviations index up-to-date by reindexing only the edited lines */
+		string[] get_lines_text (int start_line, int end_line) {
+			var res = new string[end_line-start_line+1];
+			for (var line=start_line; line <= end_line; line++) {
+				TextIter start, end;
+				get_iter_at_line (out start, line);
+				end = start;
+				if (!end.ends_line ()) {
+					end.forward_to_line_end ();
+				}
+				res[line-start_line] = get_slice (start, end, true);
 			}
+			return res;
 		}
 
-		public override void changed () {
-			base.changed ();
+		/* Suspends the per-line indexing of the abbreviations, e.g. while loading a file.
+		 * The whole text is indexed once in a thread at the end. */
+		public void begin_bulk_edit () {
+			if (bulk_edits++ == 0) {
+				bulk_edit_started ();
+			}
+		}
 
-			/* queue_update_abbrevs (); */
+		public void end_bulk_edit () {
+			if (--bulk_edits > 0) {
+				return;
+			}
+			flush_brackets ();
+			bulk_edit_finished ();
+			if (abbrevs_dirty) {
+				reindex_abbrevs.begin ();
+			}
 		}
 
-		public void queue_update_abbrevs () {
-			if (abbrev_timeout > 0) {
+		// during bulk edits only the first edited line is remembered
+		void invalidate_brackets (int line) {
+			if (_bracket_cache == null) {
 				return;
 			}
+			if (bulk_edits > 0) {
+				if (dirty_bracket_line < 0 || line < dirty_bracket_line) {
+					dirty_bracket_line = line;
+				}
+			} else {
+				_bracket_cache.invalidate (line);
+			}
+		}
 
-			Timeout.add_seconds (1, () => {
-					abbrev_timeout = 0;
-					update_abbrevs ();
-					return false;
-			});
+		void flush_brackets () {
+			if (dirty_bracket_line >= 0) {
+				if (_bracket_cache != null) {
+					_bracket_cache.invalidate (dirty_bracket_line);
+				}
+				dirty_bracket_line = -1;
+			}
 		}
 
-		void update_abbrevs () {
-			TextIter start, end;
-			get_start_iter (out start);
-			get_end_iter (out end);
-			var text = get_text (start, end, false);
-			run_in_thread.begin<void*> (() => { abbrevs.index_text (text); return null; });
+		async void reindex_abbrevs () {
+			if (indexing_abbrevs) {
+				// the running indexing will notice the new edits
+				return;
+			}
+			indexing_abbrevs = true;
+			while (abbrevs_dirty && bulk_edits == 0) {
+				abbrevs_dirty = false;
+				TextIter start, end;
+				get_bounds (out start, out end);
+				var text = get_slice (start, end, true);
+				try {
+					yield run_in_thread<void*> (() => { abbrevs.index_text (text); return null; }, Priority.LOW);
+				} catch (Error e) {
+					abbrevs_dirty = true;
+					break;
+				}
+			}
+			indexing_abbrevs = false;
+		}
+
+		// whether the edits must be indexed later as a whole
+		bool defer_abbrevs () {
+			if (bulk_edits > 0 || indexing_abbrevs) {
+				abbrevs_dirty = true;
+			}
+			return abbrevs_dirty;
+		}
+
+		public override void insert_text (ref TextIter pos, string new_text, int new_text_length) {
+			var start_line = pos.get_line ();
+			invalidate_brackets (start_line);
+			base.insert_text (ref pos, new_text, new_text_length);
+			// pos is now at the end of the inserted text
+			if (!defer_abbrevs ()) {
+				abbrevs.replace_lines (start_line, 1, get_lines_text (start_line, pos.get_line ()));
+			}
+		}
+
+		public override void delete_range (TextIter start, TextIter end) {
+			var start_line = start.get_line ();
+			var n_removed = end.get_line ()-start_line+1;
+			invalidate_brackets (start_line);
+			base.delete_range (start, end);
+			if (!defer_abbrevs ()) {
+				abbrevs.replace_lines (start_line, n_removed, get_lines_text (start_line, start_line));
+			}
 		}
 	}
 
@@ -351,7 +453,7 @@ namespace Vanubi.UI {
 	}
 
 	public class EditorContainer : EventBox {
-		public LRU<DataSource> lru = new LRU<DataSource> (DataSource.compare);
+		public LRU<DataSource> lru = new LRU<DataSource> (DataSource.hash, DataSource.equal);
 
 		public Editor editor {
 			get {
@@ -410,8 +512,22 @@ namespace Vanubi.UI {
 		uint diff_timer = 0;
 		uint save_session_timer = 0;
 		ulong content_changed_signal = 0;
+		ulong insert_text_signal = 0;
 		Git git;
 		TrailingSpaces? trailsp = null;
+		// viewer mode for big files, only a window of lines is loaded in the view
+		public MappedFileBuffer? mapped { get; private set; }
+		// kept in the buffer, shared by the editors of the file
+		public int mapped_first_line {
+			get {
+				return view.buffer.get_data<int> ("vanubi_mapped_first_line");
+			}
+			private set {
+				view.buffer.set_data<int> ("vanubi_mapped_first_line", value);
+			}
+		}
+		string? mapped_charset = null;
+		public const int VIEWER_WINDOW = 5000;
 
 		public Editor (Manager manager, DataSource source) {
 			this.manager = manager;
@@ -495,7 +611,7 @@ namespace Vanubi.UI {
 
 			((SourceBuffer)view.buffer).undo.connect_after (on_trailing_spaces);
 			((SourceBuffer)view.buffer).redo.connect_after (on_trailing_spaces);
-			view.buffer.insert_text.connect_after (on_insert_text);
+			insert_text_signal = view.buffer.insert_text.connect_after (on_insert_text);
 			view.notify["buffer"].connect_after (on_buffer_changed);
 			on_buffer_changed ();
 
@@ -614,7 +730,7 @@ namespace Vanubi.UI {
 			TextIter iter;
 			view.buffer.get_iter_at_mark (out iter, view.buffer.get_insert ());
 			var loc = new Location (source,
-									iter.get_line (),
+									mapped_first_line+iter.get_line (),
 									iter.get_line_offset ());
 			return loc;
 		}
@@ -623,6 +739,19 @@ namespace Vanubi.UI {
 		public bool set_location (Location location) {
 			// set specific location
 			var buf = view.buffer;
+			if (mapped != null) {
+				// marks are not valid across windows
+				if (location.start_line < 0) {
+					return false;
+				}
+				TextIter iter;
+				buf.get_iter_at_line (out iter, buffer_line (location.start_line));
+				if (location.start_column > 0) {
+					iter.forward_chars (location.start_column);
+				}
+				view.selection = new EditorSelection.with_iters (iter, iter);
+				return true;
+			}
 
 			TextIter start_iter;
 			if (location.start_line >= 0) {
@@ -640,6 +769,77 @@ namespace Vanubi.UI {
 			return true;
 		}
 
+		/* Shows a read-only window of a memory mapped file, for files too big to be loaded */
+		public async void view_mapped (MappedFileBuffer mapped, int io_priority = GLib.Priority.LOW) {
+			if (loading_cancellable != null) {
+				loading_cancellable.cancel ();
+			}
+			var cancellable = loading_cancellable = new Cancellable ();
+			this.mapped = mapped;
+			mapped_charset = null;
+			view.editable = false;
+			file_loaded = false;
+			reset_language ();
+
+			file_loading.set_markup ("<i>indexing...</i>");
+			load_mapped_window (0);
+			try {
+				yield mapped.index_lines (io_priority, cancellable);
+			} catch (IOError.CANCELLED e) {
+				return;
+			} catch (Error e) {
+				manager.state.status.set (e.message, "load", Status.Type.ERROR);
+			}
+
+			if (cancellable == loading_cancellable) {
+				file_loading.set_markup ("<i>viewer</i>");
+				file_loaded = true;
+				update_file_count ();
+				loading_cancellable = null;
+			}
+		}
+
+		/* Shows the same viewer of another editor of the file, whose buffer is shared */
+		public void share_viewer (Editor other) {
+			mapped = other.mapped;
+			mapped_charset = other.mapped_charset;
+			view.editable = false;
+			file_loaded = other.file_loaded;
+			file_loading.set_markup ("<i>viewer</i>");
+			update_file_count ();
+		}
+
+		void load_mapped_window (int first_line) {
+			var buf = (SourceBuffer) view.buffer;
+			string text;
+			try {
+				text = mapped.window_text (first_line, VIEWER_WINDOW, ref mapped_charset);
+			} catch (Error e) {
+				manager.state.status.set (e.message, "load", Status.Type.ERROR);
+				return;
+			}
+			mapped_first_line = first_line;
+			var ebuf = (EditorBuffer) buf;
+			ebuf.begin_bulk_edit ();
+			buf.begin_not_undoable_action ();
+			buf.set_text (text, -1);
+			buf.end_not_undoable_action ();
+			ebuf.end_bulk_edit ();
+			buf.set_modified (false);
+		}
+
+		/* Translates a line of the file to a line of the view buffer, in viewer mode
+		 * the window is moved around the line if needed */
+		public int buffer_line (int line) {
+			if (mapped == null) {
+				return line;
+			}
+			if (line < mapped_first_line || line >= mapped_first_line+VIEWER_WINDOW) {
+				load_mapped_window (int.max (line-VIEWER_WINDOW/2, 0));
+			}
+			return line-mapped_first_line;
+		}
+
 		Cancellable? loading_cancellable = null;
 
 		public async void replace_contents (InputStream is, bool undoable = false, int io_priority = GLib.Priority.LOW, owned Cancellable? cancellable = null) throws Error {
@@ -652,6 +852,12 @@ namespace Vanubi.UI {
 			loading_cancellable = cancellable;
 
 			file_loaded = false;
+			if (mapped != null) {
+				// leave viewer mode
+				mapped = null;
+				mapped_first_line = 0;
+				view.editable = true;
+			}
 
 			var buf = (SourceBuffer) view.buffer;
 			reset_language ();
@@ -669,53 +875,111 @@ namespace Vanubi.UI {
 			var cursor_offset = cursor.get_offset ();
 			var first_data = true;
 
+			// total size, to show the progress
+			int64 total = -1;
+			if (is is FileInputStream) {
+				try {
+					var info = yield ((FileInputStream) is).query_info_async (FileAttribute.STANDARD_SIZE, io_priority, cancellable);
+					total = info.get_size ();
+				} catch (IOError.CANCELLED e) {
+					return;
+				} catch (Error e) {
+				}
+			}
+
+			// start small to show the beginning of the file quickly, then grow the chunks
+			var max_chunk_size = int.max (conf.get_editor_int ("load_chunk_size", 8*1024*1024), 4096);
+			var chunk_size = int.min (64*1024, max_chunk_size);
+			if (total >= 0) {
+				// one more byte to detect the end of the stream
+				chunk_size = (int) int64.min (chunk_size, total+1);
+			}
+			int64 loaded = 0;
+			var old_modified = buf.get_modified ();
+			if (!undoable) {
+				buf.begin_not_undoable_action ();
+			}
+			// the chunks are indexed as a whole at the end
+			((EditorBuffer) buf).begin_bulk_edit ();
+			
 			try {
-				var data = new uint8[4096];
-				string? default_charset = null;
+				// grown together with the chunks
+				var data = new uint8[chunk_size];
+				var decoder = new CharsetDecoder ();
 				while (true) {
-					// keep the cursor at the beginning, or honor any user movement
-					int old_offset = cursor_offset;
-					buf.get_iter_at_mark (out cursor, buf.get_insert ());
-					cursor_offset = cursor.get_offset ();
-					TextIter iter;
-					view.buffer.get_end_iter (out iter);
-
-					if (iter.equal (cursor)) {
-						// reset cursor
-						buf.get_iter_at_offset (out cursor, old_offset);
-						view.buffer.place_cursor (cursor);
+					// fill the chunk
+					var r = 0;
+					while (r < chunk_size) {
+						unowned uint8[] dest = data[r:chunk_size];
+						var n = yield is.read_async (dest, io_priority, cancellable);
+						if (n == 0) {
+							break;
+						}
+						r += (int) n;
 					}
-
-					data.length = 4096;
-					var r = yield is.read_async (data, io_priority, cancellable);
-					if (r == 0) {
+					loaded += r;
+
+					// decode in a thread, the text is valid until the next decode
+					unowned uint8[] text = null;
+					unowned uint8[] chunk = data[0:r];
+					yield run_in_thread<void*> (() => {
+							// on end of stream, flush any incomplete sequence
+							text = decoder.decode (chunk, r < chunk_size);
+							return null;
+					}, io_priority);
+					if (cancellable.is_cancelled ()) {
 						break;
 					}
-					data.length = (int)r;
-					data = convert_to_utf8 (data, ref default_charset, null, null);
+					
+					if (text.length > 0) {
+						// keep the cursor at the beginning, or honor any user movement
+						int old_offset = cursor_offset;
+						buf.get_iter_at_mark (out cursor, buf.get_insert ());
+						cursor_offset = cursor.get_offset ();
+						TextIter iter;
+						buf.get_end_iter (out iter);
+
+						if (iter.equal (cursor)) {
+							// reset cursor
+							buf.get_iter_at_offset (out cursor, old_offset);
+							buf.place_cursor (cursor);
+						}
 
-					// write
-					if (!undoable) {
-						buf.begin_not_undoable_action ();
-					}
-					var old_modified = buf.get_modified ();
+						buf.get_end_iter (out iter);
+						buf.insert (ref iter, (string) text, text.length);
 
-					view.buffer.get_end_iter (out iter);
-					buf.insert (ref iter, (string) data, (int) r);
+						if (first_data) {
+							// try to guess from first data
+							first_data = false;
+							reset_language ();
+						}
+					}
 
-					if (!undoable) {
-						buf.set_modified (old_modified);
-						buf.end_not_undoable_action ();
+					if (r < chunk_size) {
+						// end of stream
+						break;
 					}
 
-					if (first_data) {
-						// try to guess from first data
-						first_data = false;
-						reset_language ();
+					if (total > 0) {
+						file_loading.set_markup ("<i>loading %d%%...</i>".printf ((int) (loaded*100/total)));
 					}
+					chunk_size = int.min (chunk_size*2, max_chunk_size);
+					if (data.length < chunk_size) {
+						data = new uint8[chunk_size];
+					}
+				}
+
+				if (decoder.fallbacks > 0) {
+					manager.state.status.set ("%d invalid %s sequences have been replaced".printf (decoder.fallbacks, decoder.charset), "load");
 				}
 			} catch (IOError.CANCELLED e) {
 			} finally {
+				((EditorBuffer) buf).end_bulk_edit ();
+				if (!undoable) {
+					buf.set_modified (old_modified);
+					buf.end_not_undoable_action ();
+				}
+				
 				// check cancellable to avoid race with other replace_contents
 				if (cancellable == loading_cancellable) {
 					file_loading.set_markup ("");
@@ -813,6 +1077,18 @@ namespace Vanubi.UI {
 			}
 		}
 
+		/* Groups many edits in a single user action, the change handlers of all the editors
+		 * of the buffer run once at the end */
+		public void begin_batch_edit () {
+			view.buffer.begin_user_action ();
+			((EditorBuffer) view.buffer).begin_bulk_edit ();
+		}
+
+		public void end_batch_edit () {
+			((EditorBuffer) view.buffer).end_bulk_edit ();
+			view.buffer.end_user_action ();
+		}
+
 		public void clean_trailing_spaces (TextIter start, TextIter end) {
 			if (trailsp == null) {
 				/* Not enabled */
@@ -845,11 +1121,34 @@ namespace Vanubi.UI {
 			var buf = (SourceBuffer) view.buffer;
 			buf.mark_set.connect (on_mark_set);
 			content_changed_signal = buf.changed.connect (on_content_changed);
+			if (buf is EditorBuffer) {
+				((EditorBuffer) buf).bulk_edit_started.connect (on_bulk_edit_started);
+				((EditorBuffer) buf).bulk_edit_finished.connect (on_bulk_edit_finished);
+			}
 			new UI.Buffer (view).indent_mode = conf.get_file_enum (source, "indent_mode", IndentMode.TABS);
 			buf.modified_changed.connect (on_modified_changed);
 			on_content_changed ();
 		}
 
+		void on_bulk_edit_started () {
+			SignalHandler.block (view.buffer, content_changed_signal);
+			// connected only to the buffer the editor was created with
+			if (SignalHandler.is_connected (view.buffer, insert_text_signal)) {
+				SignalHandler.block (view.buffer, insert_text_signal);
+			}
+		}
+
+		void on_bulk_edit_finished () {
+			SignalHandler.unblock (view.buffer, content_changed_signal);
+			if (SignalHandler.is_connected (view.buffer, insert_text_signal)) {
+				SignalHandler.unblock (view.buffer, insert_text_signal);
+			}
+			on_content_changed ();
+			if (trailsp != null && file_loaded) {
+				trailsp.check_buffer ();
+			}
+		}
+
 		void on_content_changed () {
 			on_add_endline ();
 			update_file_count ();
@@ -929,9 +1228,9 @@ namespace Vanubi.UI {
 
 						var cancellable = diff_cancellable = new Cancellable ();
 						git.diff_buffer.begin ((FileSource) source, view.buffer.text.data, Priority.DEFAULT, cancellable, (obj, res) => {
-								HashTable<int, DiffType> table;
+								DiffRanges ranges;
 								try {
-									table = git.diff_buffer.end (res);
+									ranges = git.diff_buffer.end (res);
 								} catch (IOError.CANCELLED e) {
 									return;
 								} catch (Error e) {
@@ -940,7 +1239,7 @@ namespace Vanubi.UI {
 								}
 
 								diff_cancellable = null;
-								gutter_renderer.table = table;
+								gutter_renderer.ranges = ranges;
 								gutter.queue_draw ();
 						});
 
@@ -977,7 +1276,7 @@ namespace Vanubi.UI {
 				iter.forward_char ();
 			}
 
-			file_count.set_label ("(%d, %d)".printf (line+1, column+1));
+			file_count.set_label ("(%d, %d)".printf (mapped_first_line+line+1, column+1));
 
 			// update current location, use a timer to reduce the number of disk writes
 			if (save_session_timer > 0) {
@@ -21,7 +21,7 @@ using Gtk;
 
 namespace Vanubi {
 	public class GitGutterRenderer : SourceGutterRenderer {
-		public HashTable<int, DiffType>? table = null;
+		public DiffRanges? ranges = null;
 		
 		public GitGutterRenderer () {
 			Gdk.RGBA bg = Gdk.RGBA ();
@@ -44,8 +44,8 @@ namespace Vanubi {
 								   SourceGutterRendererState state) {
 			base.draw (cr, background_area, cell_area, start, end, state);
 			
-			if (table != null && table.contains (start.get_line () + 1)) {
-				DiffType t = table.lookup (start.get_line () + 1);
+			DiffType t;
+			if (ranges != null && ranges.lookup (start.get_line () + 1, out t)) {
 				if (t == DiffType.ADD) {
 					colorize_gutter (cr, background_area, 0x73, 0xd2, 0x16); /* chamaeleon */
 				} else if (t == DiffType.DEL) {
@@ -129,6 +129,46 @@ namespace Vanubi.UI {
 				}
 			}
 		}
+
+		/* Appends the match with the same colors of git grep */
+		public void insert_match (GrepMatch match) {
+			TextIter end;
+			get_end_iter (out end);
+			insert_with_tags (ref end, match.path, -1, attrs[35], null);
+			insert_with_tags (ref end, ":", -1, attrs[36], null);
+			insert_with_tags (ref end, (match.line+1).to_string (), -1, attrs[32], null);
+			insert_with_tags (ref end, ":", -1, attrs[36], null);
+
+			string? charset = null;
+			var last = 0;
+			for (var i=0; i+1 < match.ranges.length; i += 2) {
+				insert_converted (ref end, match.text[last:match.ranges[i]], null, ref charset);
+				insert_converted (ref end, match.text[match.ranges[i]:match.ranges[i+1]], attrs[31], ref charset);
+				last = match.ranges[i+1];
+			}
+			insert_converted (ref end, match.text[last:match.text.length], null, ref charset);
+			insert (ref end, "\n", -1);
+		}
+
+		void insert_converted (ref TextIter iter, uint8[] text, TextTag? tag, ref string? charset) {
+			if (text.length == 0) {
+				return;
+			}
+			uint8[] converted;
+			try {
+				converted = convert_to_utf8 (text, ref charset, null, null);
+			} catch (Error e) {
+				return;
+			}
+			if (converted == null) {
+				return;
+			}
+			if (tag != null) {
+				insert_with_tags (ref iter, (string) converted, converted.length, tag, null);
+			} else {
+				insert (ref iter, (string) converted, converted.length);
+			}
+		}
 	}
 	
 	public class GrepBar : EntryBar {
@@ -192,6 +232,38 @@ namespace Vanubi.UI {
 			return new Location (base_source.child (filename), lineno);
 		}
 		
+		/* Clears the results for a new search, the returned cancellable stops when another search starts */
+		public Cancellable reset_results () {
+			if (cancellable != null) {
+				cancellable.cancel ();
+			}
+			cancellable = new Cancellable ();
+			view.buffer.set_text ("");
+			state.status.set ("Searching...", "grep");
+			return cancellable;
+		}
+
+		public void add_matches (GrepMatch[] matches) {
+			var buf = (GrepBuffer) view.buffer;
+			// keep the cursor at the beginning, or honor any user movement
+			TextIter cursor;
+			buf.get_iter_at_mark (out cursor, buf.get_insert ());
+			var at_start = cursor.is_start ();
+			foreach (var match in matches) {
+				buf.insert_match (match);
+			}
+			if (at_start) {
+				buf.get_start_iter (out cursor);
+				buf.place_cursor (cursor);
+			}
+		}
+
+		public void end_results (Cancellable cancellable) {
+			if (this.cancellable == cancellable) {
+				state.status.clear ("grep");
+			}
+		}
+		
 		protected override void on_activate () {
 			TextIter insert;
 			view.buffer.get_iter_at_mark (out insert, view.buffer.get_insert ());
@@ -49,11 +49,14 @@ namespace Vanubi.UI {
 		public Manager () {
 			var conf = new Configuration ();
 			state = new State (conf);
+			pattern_match_threads = conf.get_global_int ("match_threads", 0);
 			state.status.changed.connect (on_status_changed);
 			
 			orientation = Orientation.VERTICAL;
 			
 			state.global_keys.execute_command.connect (on_command);
+			// runs before any command handler
+			execute_command.connect (check_viewer_command);
 			keyhandler = new KeyHandler (state.global_keys);
 			
 			base_scope = Vade.create_base_scope ();
@@ -172,6 +175,14 @@ namespace Vanubi.UI {
 			index_command ("indent", "Indent the current line");
 			execute_command["indent"].connect (on_indent);
 
+			bind_command (null, "reindent-region");
+			index_command ("reindent-region", "Reindent the selected lines");
+			execute_command["reindent-region"].connect (on_reindent);
+
+			bind_command (null, "reindent-buffer");
+			index_command ("reindent-buffer", "Reindent the whole buffer");
+			execute_command["reindent-buffer"].connect (on_reindent);
+
 			bind_command ({
 					Key (Gdk.Key.c, Gdk.ModifierType.CONTROL_MASK),
 						Key (Gdk.Key.c, Gdk.ModifierType.CONTROL_MASK) },
@@ -559,6 +570,10 @@ namespace Vanubi.UI {
 			index_command ("toggle-show-branch", "Show the repository branch in the file info bar");
 			execute_command["toggle-show-branch"].connect (on_toggle_show_branch);
 
+			bind_command (null, "toggle-search-highlight");
+			index_command ("toggle-search-highlight", "Highlight all the search matches on screen");
+			execute_command["toggle-search-highlight"].connect (on_toggle_search_highlight);
+
 			bind_command (null, "toggle-right-margin");
 			index_command ("toggle-right-margin", "Show the columns limit delimiter");
 			execute_command["toggle-right-margin"].connect (on_toggle_right_margin);
@@ -583,6 +598,10 @@ namespace Vanubi.UI {
 			index_command ("toggle-remote-file-server", "Service for opening files remotely with vsh and van");
 			execute_command["toggle-remote-file-server"].connect (on_toggle_remote_file_server);
 
+			bind_command (null, "remote-traffic");
+			index_command ("remote-traffic", "Show the traffic of the remote connections and the compression gain");
+			execute_command["remote-traffic"].connect (on_remote_traffic);
+
 			bind_command (null, "toggle-show-tabs");
 			index_command ("toggle-show-tabs", "Toggle show tab in the editor");
 			execute_command["toggle-show-tabs"].connect (on_toggle_show_tabs);
@@ -697,6 +716,14 @@ namespace Vanubi.UI {
 			execute_command[command] (ed, command);
 		}
 
+		/* The viewer of a big file only holds a window of the file, it must not be edited nor saved */
+		void check_viewer_command (Editor editor, string command) {
+			if (editor.mapped != null && !MappedFileBuffer.allows_command (command)) {
+				state.status.set ("Cannot %s in the read-only viewer".printf (command), "viewer", Status.Type.ERROR);
+				Signal.stop_emission_by_name (this, "execute_command::"+command);
+			}
+		}
+
 		public enum OverlayMode {
 			FIXED,
 			PANE_BOTTOM,
@@ -898,6 +925,33 @@ namespace Vanubi.UI {
 				return;
 			}
 
+			// big local files are memory mapped and shown read-only
+			var viewer_threshold = (int64) state.config.get_editor_int ("viewer_threshold", 256)*1024*1024;
+			if (source is LocalFileSource && viewer_threshold > 0) {
+				try {
+					var info = yield ((LocalFileSource) source).file.query_info_async (FileAttribute.STANDARD_SIZE, FileQueryInfoFlags.NONE);
+					if (info.get_size () > viewer_threshold) {
+						var mapped = new MappedFileBuffer ((LocalFileSource) source);
+						var ed = get_available_editor (source);
+						if (focus) {
+							replace_widget (editor, ed);
+							ed.grab_focus ();
+						}
+						state.status.set ("File too big, opened read-only in viewer mode", "load");
+						ed.view_mapped.begin (mapped);
+						if (location.start_line > 0 && ed.set_location (location)) {
+							var prio = focus ? Priority.HIGH : Priority.DEFAULT;
+							Idle.add_full (prio, () => { ed.view.scroll_to_mark (ed.view.buffer.get_insert (), 0, true, 0.5, 0.5); return false; });
+						}
+						return;
+					}
+				} catch (IOError.CANCELLED e) {
+					return;
+				} catch (Error e) {
+					// fallback to reading the whole file
+				}
+			}
+
 			// existing source, read it
 			try {
 				var is = yield source.read ();
@@ -1062,6 +1116,10 @@ namespace Vanubi.UI {
 				// share TextBuffer with an existing editor for this file,
 				// so that they display the same content
 				ed.view.buffer = editors[0].view.buffer;
+				if (editors[0].mapped != null) {
+					// the buffer only holds a window of the file
+					ed.share_viewer (editors[0]);
+				}
 			} else {
 				ed.reset_language ();
 			}
@@ -1396,6 +1454,10 @@ namespace Vanubi.UI {
 		}
 
 		async void save_file (Editor editor, DataSource? as_source = null, bool open_as_source = false) {
+			if (editor.mapped != null) {
+				state.status.set ("Cannot save the read-only viewer", "viewer", Status.Type.ERROR);
+				return;
+			}
 			var buf = editor.view.buffer;
 			if (as_source == null) {
 				as_source = editor.source;
@@ -1480,7 +1542,8 @@ namespace Vanubi.UI {
 				((Container) old_ed.get_parent ()).remove (old_ed);
 			}
 
-			unowned List<DataSource> lru_head = container.lru.list();
+			var lru_list = container.lru.list ();
+			unowned List<DataSource> lru_head = lru_list;
 			if (lru_head != null && lru_head.data != null && lru_head.next != null) {
 				if (lru_head.data == next_source || (next_source != null && lru_head.data.equal (next_source))) {
 					// the next source in the lru is next_source, give precedence to the second file in the lru
@@ -1543,7 +1606,7 @@ namespace Vanubi.UI {
 					if (text != "") {
 						var buf = editor.view.buffer;
 						TextIter iter;
-						buf.get_iter_at_line (out iter, int.parse (text)-1);
+						buf.get_iter_at_line (out iter, editor.buffer_line (int.parse (text)-1));
 						buf.place_cursor (iter);
 						editor.view.scroll_to_mark (buf.get_insert (), 0, true, 0.5, 0.5);
 					}
@@ -2197,37 +2260,13 @@ namespace Vanubi.UI {
 			var vbuf = new UI.Buffer ((SourceView) ed.view);
 			var buf = (SourceBuffer) ed.view.buffer;
 			var lang_id = buf.language != null ? buf.language.id : null;
-
-			if (lang_id == null) {
-				return null;
-			} else {
-				switch (lang_id) {
-				case "assembly (intel)":
-				case "i386 assembly":
-					return new Indent_Asm (vbuf);
-				case "html":
-				case "xml":
-					return new Indent_Markup (vbuf);
-				case "lua":
-					return new Indent_Lua (vbuf);
-				case "haskell":
-					return new Indent_Haskell (vbuf);
-				case "python":
-					return new Indent_Python (vbuf);
-				case "makefile":
-					return null;
-				default:
-					return new Indent_C (vbuf);
-				}
-			}
+			return Indent.for_language (lang_id, vbuf);
 		}
 
 		void on_indent (Editor ed) {
 			var indent_engine = get_indent_engine (ed);
 			var buf = (SourceBuffer) ed.view.buffer;
 
-			buf.begin_user_action ();
-
 			// indent every selected line
 			TextIter start, end;
 			selection.get_iters (out start, out end);
@@ -2236,6 +2275,13 @@ namespace Vanubi.UI {
 			var max_line = int.max (start.get_line(), end.get_line());
 			
 			var is_python = indent_engine is Indent_Python;
+			if (indent_engine != null && !is_python && min_line < max_line) {
+				on_reindent (ed, "reindent-region");
+				return;
+			}
+
+			buf.begin_user_action ();
+
 			/* Auto indent of each line in python simply does not work.
 			 * We therefore indent the first line, remember the indent variation, and adjust the following
 			 * lines by this variation. */
@@ -2266,6 +2312,46 @@ namespace Vanubi.UI {
 			buf.end_user_action ();
 		}
 
+		void on_reindent (Editor ed, string command) {
+			var indent_engine = get_indent_engine (ed);
+			if (indent_engine == null) {
+				state.status.set ("No indentation for this language", "indent", Status.Type.ERROR);
+				return;
+			}
+
+			var buf = ed.view.buffer;
+			int min_line, max_line;
+			if (command == "reindent-buffer") {
+				min_line = 0;
+				max_line = buf.get_line_count ()-1;
+			} else {
+				TextIter start, end;
+				selection.get_iters (out start, out end);
+				min_line = int.min (start.get_line(), end.get_line());
+				max_line = int.max (start.get_line(), end.get_line());
+			}
+
+			// compute the indents against the unchanged buffer, then apply the changed lines at once
+			ed.begin_batch_edit ();
+			var changed = 0;
+			if (indent_engine is Indent_Python) {
+				// only the first line can be indented, shift the following lines like the indent command
+				var vbuf = indent_engine.buffer;
+				var indent_diff = indent_engine.compute_indents (min_line, min_line)[0] - vbuf.get_indent (min_line);
+				if (indent_diff != 0) {
+					for (var line=min_line; line <= max_line; line++) {
+						vbuf.set_indent (line, vbuf.get_indent (line) + indent_diff);
+						changed++;
+					}
+				}
+			} else {
+				changed = indent_engine.reindent_lines (min_line, max_line);
+			}
+			ed.end_batch_edit ();
+
+			state.status.set ("%d lines reindented".printf (changed), "indent");
+		}
+
 		void on_comment_lines (Editor ed) {
 			Comment comment_engine;
 			var vbuf = new UI.Buffer ((SourceView) ed.view);
@@ -2452,7 +2538,10 @@ namespace Vanubi.UI {
 			} catch (Error e) {
 			}
 
-			if (repo_dir == null) {
+			// local directories are searched natively, even outside of a repository
+			var search_dir = repo_dir ?? (FileSource) editor.source.parent;
+			var native = search_dir is LocalFileSource;
+			if (repo_dir == null && !native) {
 				state.status.set ("Not in git repository");
 				return;
 			}
@@ -2460,7 +2549,7 @@ namespace Vanubi.UI {
 			InputStream? stream = null;
 
 			var grep_hist = get_entry_history ("grep");
-			var bar = new GrepBar (state, repo_dir, grep_hist.get(0) ?? "");
+			var bar = new GrepBar (state, search_dir, grep_hist.get(0) ?? "");
 			attach_entry_history (bar.entry, grep_hist);
 			bar.activate.connect (() => {
 					grep_hist.add (bar.text);
@@ -2484,6 +2573,11 @@ namespace Vanubi.UI {
 						return;
 					}
 
+					if (native) {
+						native_grep.begin (bar, search_dir, repo_dir != null ? git : null, pat);
+						return;
+					}
+
 					git.grep.begin (repo_dir, pat, (errors) => {
 							state.status.set (errors, "repo-grep", Status.Type.ERROR);
 					}, Priority.DEFAULT, null, (s,r) => {
@@ -2504,6 +2598,38 @@ namespace Vanubi.UI {
 			bar.grab_focus ();
 		}
 
+		/* Searches the tracked files of the repository, or all the files of the directory if git is null */
+		async void native_grep (GrepBar bar, FileSource dir, Git? git, string pat) {
+			var cancellable = bar.reset_results ();
+			try {
+				// smart case like git grep
+				var engine = new GrepEngine (pat, pat.down () == pat);
+				// search what's in the unsaved buffers
+				each_editor ((ed) => {
+						var source = ed.source as LocalFileSource;
+						if (source != null && ed.view.buffer.get_modified ()) {
+							engine.set_contents (source.local_path, new Bytes (ed.view.buffer.text.data));
+						}
+						return true;
+				}, false);
+
+				string[] files;
+				if (git != null) {
+					var repo = yield git.get_repo_service (dir, Priority.DEFAULT, cancellable);
+					files = yield repo.tracked_files (Priority.DEFAULT, cancellable);
+				} else {
+					files = yield GrepEngine.list_files_async (dir.local_path, Priority.DEFAULT, cancellable);
+				}
+				yield engine.search (dir.local_path, files, (matches) => {
+						bar.add_matches (matches);
+				}, Priority.LOW, cancellable);
+			} catch (IOError.CANCELLED e) {
+			} catch (Error e) {
+				state.status.set (e.message, "repo-grep", Status.Type.ERROR);
+			}
+			bar.end_results (cancellable);
+		}
+
 		void on_repo_open_file (Editor editor) {
 			repo_open_file.begin (editor);
 		}
@@ -2528,22 +2654,19 @@ namespace Vanubi.UI {
 
 			var git_command = state.config.get_global_string ("git_command", "git");
 
-			string res;
+			ShellProcess proc;
 			try {
-				res = (string) yield repo_dir.execute_shell (@"$(git_command) ls-files");
+				proc = yield repo_dir.spawn_shell (@"$(git_command) ls-files", null, io_priority, cancellable);
 			} catch (Error e) {
 				state.status.set (e.message, "repo-open-file", Status.Type.ERROR);
 				return;
 			}
 
-			var file_names = res.split ("\n");
-			var annotated = new Annotated<DataSource>[file_names.length];
-			for (var i=0; i < file_names.length; i++) {
-				annotated[i] = new Annotated<DataSource> (file_names[i], repo_dir.child (file_names[i]));
-			}
-
-			var bar = new SimpleCompletionBar<DataSource> ((owned) annotated);
+			// the files are added to the bar as git lists them
+			var bar = new SimpleCompletionBar<DataSource> (new Annotated<DataSource>[0]);
+			var reading = new Cancellable ();
 			bar.activate.connect (() => {
+					reading.cancel ();
 					abort (editor);
 					var file = bar.get_choice();
 					if (file == editor.source) {
@@ -2552,10 +2675,47 @@ namespace Vanubi.UI {
 					}
 					open_source.begin (editor, file);
 			});
-			bar.aborted.connect (() => { abort (editor); });
+			bar.aborted.connect (() => {
+					reading.cancel ();
+					abort (editor);
+			});
 			add_overlay (bar);
 			bar.show ();
 			bar.grab_focus ();
+
+			read_all_async.begin (proc.stderr, io_priority, reading);
+			var buffer = new uint8[65536];
+			var partial = "";
+			try {
+				while (true) {
+					var read = yield proc.stdout.read_async (buffer, io_priority, reading);
+					if (read == 0) {
+						break;
+					}
+
+					var text = partial + ((string) buffer).substring (0, (long) read);
+					var file_names = text.split ("\n");
+					// the last name may be incomplete
+					partial = file_names[file_names.length-1];
+					var annotated = new Annotated<DataSource>[file_names.length-1];
+					for (var i=0; i < file_names.length-1; i++) {
+						annotated[i] = new Annotated<DataSource> (file_names[i], repo_dir.child (file_names[i]));
+					}
+					bar.add_choices (annotated);
+				}
+				if (partial != "") {
+					Annotated<DataSource>[] last = { new Annotated<DataSource> (partial, repo_dir.child (partial)) };
+					bar.add_choices (last);
+				}
+			} catch (IOError.CANCELLED e) {
+			} catch (Error e) {
+				state.status.set (e.message, "repo-open-file", Status.Type.ERROR);
+			} finally {
+				try {
+					proc.stdout.close ();
+				} catch (Error e) {
+				}
+			}
 		}
 
 
@@ -2987,6 +3147,26 @@ namespace Vanubi.UI {
 			check_remote_file_server ();
 		}
 
+		void on_remote_traffic (Editor editor) {
+			var b = new StringBuilder ();
+			if (remote != null) {
+				foreach (unowned RemoteConnection conn in remote.connections) {
+					var mux = conn.mux;
+					if (mux == null) {
+						continue;
+					}
+					if (b.len > 0) {
+						b.append ("; ");
+					}
+					b.append_printf ("%s: sent %s as %s, received %s as %s%s", conn.ident,
+									 format_size (mux.data_sent), format_size (mux.wire_sent),
+									 format_size (mux.data_received), format_size (mux.wire_received),
+									 mux.compress ? "" : " (uncompressed)");
+				}
+			}
+			state.status.set (b.len > 0 ? b.str : "No remote connections", "remote");
+		}
+
 		void on_about (Editor editor) {
 			var bar = new AboutBar ();
 			bar.aborted.connect (() => {
@@ -3019,6 +3199,13 @@ namespace Vanubi.UI {
 			});
 		}
 
+		void on_toggle_search_highlight (Editor editor) {
+			// applies to the next search
+			var val = !state.config.get_editor_bool ("search_highlight_all", true);
+			state.config.set_editor_bool ("search_highlight_all", val);
+			state.status.set (val ? "Enabled" : "Disabled");
+		}
+
 		void on_toggle_right_margin (Editor editor) {
 			var val = !state.config.get_editor_bool ("right_margin", false);
 			state.config.set_editor_bool ("right_margin", val);
@@ -45,6 +45,23 @@ namespace Vanubi.UI {
 		Cancellable search_cancellable;
 		Cancellable replace_cancellable;
 		bool found_occurrence;
+		// matches of the last pattern, kept up-to-date with the buffer edits
+		MatchIndex matches;
+		bool matches_stale;
+		// bumped on every edit of the buffer
+		uint edit_generation;
+		bool replacing_all;
+		TextBuffer tracked_buffer;
+		ulong insert_text_handler;
+		ulong delete_range_handler;
+		ulong bulk_started_handler;
+		ulong bulk_finished_handler;
+		// highlight of the matches on screen
+		bool highlight_all;
+		TextMark tagged_start;
+		TextMark tagged_end;
+		ulong scroll_handler;
+		uint highlight_source;
 
 		public SearchBar (State state, Editor editor, Mode mode, bool is_regex, string search_initial = "", string replace_initial = "") {
 			base (search_initial);
@@ -75,6 +92,170 @@ namespace Vanubi.UI {
 			buf.get_iter_at_mark (out bound, buf.get_insert ());
 			original_insert = insert.get_offset ();
 			original_bound = bound.get_offset ();
+
+			tracked_buffer = buf;
+			insert_text_handler = buf.insert_text.connect (on_insert_text);
+			delete_range_handler = buf.delete_range.connect (on_delete_range);
+			bulk_started_handler = ((EditorBuffer) buf).bulk_edit_started.connect (on_bulk_edit_started);
+			bulk_finished_handler = ((EditorBuffer) buf).bulk_edit_finished.connect (on_bulk_edit_finished);
+
+			highlight_all = state.config.get_editor_bool ("search_highlight_all", true);
+			if (highlight_all) {
+				scroll_handler = editor.view.vadjustment.value_changed.connect (queue_highlight);
+			}
+		}
+
+		public override void dispose () {
+			if (tracked_buffer != null) {
+				tracked_buffer.disconnect (insert_text_handler);
+				tracked_buffer.disconnect (delete_range_handler);
+				tracked_buffer.disconnect (bulk_started_handler);
+				tracked_buffer.disconnect (bulk_finished_handler);
+				tracked_buffer = null;
+			}
+			if (scroll_handler > 0) {
+				editor.view.vadjustment.disconnect (scroll_handler);
+				scroll_handler = 0;
+			}
+			if (highlight_source > 0) {
+				Source.remove (highlight_source);
+				highlight_source = 0;
+			}
+			remove_highlight ();
+			if (search_cancellable != null) {
+				search_cancellable.cancel ();
+			}
+			base.dispose ();
+		}
+
+		void on_insert_text (ref TextIter pos, string new_text, int new_text_length) {
+			update_matches (pos, pos, new_text_length < 0 ? new_text : new_text.substring (0, new_text_length));
+		}
+
+		void on_delete_range (TextIter start, TextIter end) {
+			update_matches (start, end, "");
+		}
+
+		void on_bulk_edit_started () {
+			SignalHandler.block (tracked_buffer, insert_text_handler);
+			SignalHandler.block (tracked_buffer, delete_range_handler);
+		}
+
+		/* The edits of a bulk edit are not tracked one by one, scan again on the next search */
+		void on_bulk_edit_finished () {
+			SignalHandler.unblock (tracked_buffer, insert_text_handler);
+			SignalHandler.unblock (tracked_buffer, delete_range_handler);
+			edit_generation++;
+			if (replacing_all) {
+				return;
+			}
+			if (matches == null) {
+				// a scan may be running on an old snapshot
+				matches_stale = true;
+				return;
+			}
+			matches = null;
+			remove_highlight ();
+		}
+
+		/* Called before the text between start and end is replaced, searches again the touched lines */
+		void update_matches (TextIter start, TextIter end, string text) {
+			edit_generation++;
+			if (replacing_all) {
+				return;
+			}
+			if (matches == null) {
+				// a scan may be running on an old snapshot
+				matches_stale = true;
+				return;
+			}
+
+			var buf = editor.view.buffer;
+			var region_start = start;
+			region_start.set_line_offset (0);
+			var region_end = end;
+			if (!region_end.ends_line ()) {
+				region_end.forward_to_line_end ();
+			}
+			var region_text = buf.get_slice (region_start, start, true) + text + buf.get_slice (end, region_end, true);
+			matches.replace_region (region_start.get_offset (), region_end.get_offset (), region_text);
+			// the inserted text is not tagged
+			queue_highlight ();
+		}
+
+		void queue_highlight () {
+			if (!highlight_all || highlight_source > 0) {
+				return;
+			}
+			highlight_source = Idle.add (() => {
+					highlight_source = 0;
+					update_highlight ();
+					return false;
+			});
+		}
+
+		void remove_highlight () {
+			if (tagged_start == null) {
+				return;
+			}
+			var buf = (EditorBuffer) editor.view.buffer;
+			TextIter start, end;
+			buf.get_iter_at_mark (out start, tagged_start);
+			buf.get_iter_at_mark (out end, tagged_end);
+			buf.remove_tag (buf.search_tag, start, end);
+			buf.delete_mark (tagged_start);
+			buf.delete_mark (tagged_end);
+			tagged_start = tagged_end = null;
+		}
+
+		/* Tags only the matches in the visible lines plus a screen of margin on both sides,
+		 * so that the cost does not depend on the size of the buffer */
+		void update_highlight () {
+			if (!highlight_all) {
+				return;
+			}
+			remove_highlight ();
+			if (matches == null || matches.length == 0) {
+				return;
+			}
+
+			var view = editor.view;
+			var buf = (EditorBuffer) view.buffer;
+			Gdk.Rectangle rect;
+			view.get_visible_rect (out rect);
+			TextIter start, end;
+			int line_top;
+			view.get_line_at_y (out start, rect.y-rect.height, out line_top);
+			view.get_line_at_y (out end, rect.y+rect.height*2, out line_top);
+			start.set_line_offset (0);
+			if (!end.ends_line ()) {
+				end.forward_to_line_end ();
+			}
+			var end_offset = end.get_offset ();
+
+			int match_start, match_end;
+			for (var i=matches.index_after (start.get_offset ()); matches.get_match (i, out match_start, out match_end) && match_start < end_offset; i++) {
+				TextIter tag_start, tag_end;
+				buf.get_iter_at_offset (out tag_start, match_start);
+				buf.get_iter_at_offset (out tag_end, match_end);
+				buf.apply_tag (buf.search_tag, tag_start, tag_end);
+			}
+			tagged_start = buf.create_mark (null, start, true);
+			tagged_end = buf.create_mark (null, end, false);
+		}
+
+		/* Shows the position of the selected match among all the matches */
+		void show_match_count (int match_start) {
+			if (!highlight_all) {
+				state.status.clear ("search");
+				return;
+			}
+			var index = matches.index_of (match_start);
+			if (index < 0) {
+				state.status.set ("%d matches".printf (matches.length), "search");
+			} else {
+				state.status.set ("match %d/%d".printf (index+1, matches.length), "search");
+			}
 		}
 
 		public override void on_activate () {
@@ -91,7 +272,7 @@ namespace Vanubi.UI {
 				replace_box.set_above_child (true);
 				replace_box.can_focus = true;
 				replace_box.key_press_event.connect (on_key_press_event);
-				var label = new Label ("<b>r = replace     s = skip</b>");
+				var label = new Label ("<b>r = replace     s = skip     a = replace all</b>");
 				label.use_markup = true;
 				replace_box.add (label);
 				add (replace_box);
@@ -138,10 +319,11 @@ namespace Vanubi.UI {
 			var cur_cancellable = search_cancellable;
 			found_occurrence = false;
 			
-			// inefficient naive implementation
 			var buf = editor.view.buffer;
 			var p = entry.get_text ();
 			var insensitive = p.down () == p;
+			// the iter is not valid anymore after yielding
+			var mark = buf.create_mark (null, iter, false);
 			
 			// Eval pattern expression
 			try {
@@ -153,91 +335,64 @@ namespace Vanubi.UI {
 				// do not parse in case of any error during parsing or evaluating the expression
 			}
 			
-			Regex regex = null;
-			if (is_regex) {
-				try {
-					state.status.clear ("search");
-					regex = new Regex (p, RegexCompileFlags.OPTIMIZE, RegexMatchFlags.ANCHORED);
-				} catch (Error e) {
-					// user still writing regex, display an error
-					state.status.set (e.message, "search", Status.Type.ERROR);
+			if (matches == null || matches.pattern != p || matches.is_regex != is_regex || matches.insensitive != insensitive) {
+				var found = yield scan_matches (p, insensitive, cur_cancellable);
+				if (!found) {
+					buf.delete_mark (mark);
 					return;
 				}
 			}
+			buf.get_iter_at_mark (out iter, mark);
+			buf.delete_mark (mark);
 			
-			// yield to gui every 1000 iterations
-			int iterations = 0;
-			bool displayed_searching = false;
-			
-			while (((mode == Mode.SEARCH_FORWARD || mode == Mode.REPLACE_FORWARD) && !iter.is_end ()) ||
-				   ((mode == Mode.SEARCH_BACKWARD || mode == Mode.REPLACE_BACKWARD) && !iter.is_start ())) {
-				if (cur_cancellable.is_cancelled ()) {
-					return;
-				}
-				
-				if (iterations >= 10000 && !displayed_searching) {
-					state.status.set ("Searching...", "search");
-					displayed_searching = true;
-				}
-				
-				// use a mark when giving control back to the gui
-				TextMark? mark = null;
-				if (iterations++ % 1000 == 0) {
-					mark = buf.create_mark (null, iter, false);
-					Idle.add (search.callback);
-					yield;
-				}
-
-				if (cur_cancellable.is_cancelled ()) {
-					return;
-				}
-				
+			// navigate the sorted matches
+			int match_start, match_end;
+			bool found;
+			if (mode == Mode.SEARCH_FORWARD || mode == Mode.REPLACE_FORWARD) {
+				found = matches.next (iter.get_offset (), out match_start, out match_end);
+			} else {
+				found = matches.prev (iter.get_offset (), out match_start, out match_end);
+			}
+			if (found || p == "") {
 				TextIter subiter;
-				if (mark != null) {
-					buf.get_iter_at_mark (out iter, mark);
-					buf.delete_mark (mark);
+				if (found) {
+					buf.get_iter_at_offset (out iter, match_start);
+					buf.get_iter_at_offset (out subiter, match_end);
+				} else {
+					subiter = iter;
 				}
-				subiter = iter;
-				
-				bool found = true;
 				if (is_regex) {
+					// keep the groups for the back references
 					var end_line = iter;
 					end_line.forward_to_line_end ();
 					matching_string = buf.get_text (iter, end_line, false);
-					found = regex.match (matching_string, 0, out current_match);
-					if (found) {
-						var full = current_match.fetch (0);
-						subiter.forward_chars (full.length);
-					}
-				} else {
-					int i = 0;
-					unichar c;
-					while (p.get_next_char (ref i, out c)) {
-						var c2 = subiter.get_char ();
-						if (insensitive) {
-							c2 = c2.tolower ();
-						}
-						if (c != c2) {
-							found = false;
-							break;
-						}
-						subiter.forward_char ();
+					try {
+						matches.regex.match_full (matching_string, -1, 0, RegexMatchFlags.ANCHORED, out current_match);
+					} catch (RegexError e) {
 					}
 				}
+				found_occurrence = true;
+				editor.view.selection = new EditorSelection.with_iters (iter, subiter);
+				editor.view.set_buffer_selection ();
+				editor.view.scroll_to_mark (editor.view.buffer.get_insert (), 0, true, 0.5, 0.5);
+				show_match_count (iter.get_offset ());
+				update_highlight ();
+				return;
+			}
+			update_highlight ();
+
+			if (editor.mapped != null && (mode == Mode.SEARCH_FORWARD || mode == Mode.SEARCH_BACKWARD)) {
+				// viewer mode, search the rest of the file outside of the window
+				state.status.set ("Searching...", "search");
+				var found = yield search_mapped (p, insensitive, cur_cancellable);
+				if (cur_cancellable.is_cancelled ()) {
+					return;
+				}
 				if (found) {
-					// found
 					found_occurrence = true;
-					editor.view.selection = new EditorSelection.with_iters (iter, subiter);
-					editor.view.set_buffer_selection ();
-					editor.view.scroll_to_mark (editor.view.buffer.get_insert (), 0, true, 0.5, 0.5);
 					state.status.clear ("search");
 					return;
 				}
-				if (mode == Mode.SEARCH_FORWARD || mode == Mode.REPLACE_FORWARD) {
-					iter.forward_char ();
-				} else {
-					iter.backward_char ();
-				}
 			}
 			state.status.clear ("search");
 
@@ -262,6 +417,102 @@ namespace Vanubi.UI {
 			show_all ();
 		}
 
+		/* Indexes the matches of the pattern in a snapshot of the buffer, returns false on errors or if cancelled */
+		async bool scan_matches (string pattern, bool insensitive, Cancellable cancellable) {
+			MatchIndex index;
+			try {
+				state.status.clear ("search");
+				index = new MatchIndex (pattern, is_regex, insensitive);
+			} catch (Error e) {
+				// user still writing regex, display an error
+				state.status.set (e.message, "search", Status.Type.ERROR);
+				return false;
+			}
+
+			var buf = editor.view.buffer;
+			if (buf.get_char_count () > 1000000) {
+				state.status.set ("Searching...", "search");
+			}
+			matches = null;
+			remove_highlight ();
+			try {
+				do {
+					// edits during the scan are not tracked, scan again
+					matches_stale = false;
+					TextIter start, end;
+					buf.get_bounds (out start, out end);
+					yield index.scan (buf.get_slice (start, end, true), Priority.DEFAULT, cancellable);
+				} while (matches_stale);
+			} catch (Error e) {
+				return false;
+			}
+			matches = index;
+			return true;
+		}
+
+		async bool search_mapped (string pattern, bool insensitive, Cancellable cancellable) {
+			var mapped = editor.mapped;
+			var forward = mode == Mode.SEARCH_FORWARD;
+			Regex regex;
+			try {
+				regex = mapped.search_regex (pattern, is_regex, insensitive);
+			} catch (Error e) {
+				return false;
+			}
+
+			// the lines in the window have already been searched
+			int64 from;
+			if (forward) {
+				var from_line = editor.mapped_first_line+Editor.VIEWER_WINDOW;
+				// do not count all the lines of the file
+				if (!mapped.has_line (from_line)) {
+					return false;
+				}
+				from = mapped.line_offset (from_line);
+			} else {
+				if (editor.mapped_first_line == 0) {
+					return false;
+				}
+				from = mapped.line_offset (editor.mapped_first_line);
+			}
+
+			int64 match_start = -1;
+			int64 match_end = -1;
+			try {
+				yield run_in_thread<void*> (() => {
+						if (forward) {
+							mapped.search_forward (regex, from, out match_start, out match_end, cancellable);
+						} else {
+							mapped.search_backward (regex, from, out match_start, out match_end, cancellable);
+						}
+						return null;
+				});
+			} catch (Error e) {
+				return false;
+			}
+			if (match_start < 0 || cancellable.is_cancelled ()) {
+				return false;
+			}
+
+			// move the window and select the match
+			var line = mapped.line_at_offset (match_start);
+			var column = mapped.line_char_offset (match_start);
+			var buf = editor.view.buffer;
+			TextIter iter;
+			buf.get_iter_at_line (out iter, editor.buffer_line (line));
+			iter.forward_chars (column);
+			var subiter = iter;
+			if (mapped.line_at_offset (match_end) == line) {
+				subiter.forward_chars (mapped.line_char_offset (match_end)-column);
+			} else {
+				subiter.forward_to_line_end ();
+			}
+			editor.view.selection = new EditorSelection.with_iters (iter, subiter);
+			editor.view.set_buffer_selection ();
+			editor.view.scroll_to_mark (buf.get_insert (), 0, true, 0.5, 0.5);
+			return true;
+		}
+
 		async void replace () {
 			if (replace_cancellable != null) {
 				replace_cancellable.cancel ();
@@ -270,23 +521,7 @@ namespace Vanubi.UI {
 			var cur_cancellable = replace_cancellable;
 			
 			// replace occurrence
-			var r = replace_text;
-			if (is_regex) {
-				// parse back references
-				for (var i=1; i < current_match.get_match_count (); i++) {
-					r = r.replace (@"\\$i", current_match.fetch (i));
-				}
-			}
-
-			// evaluate replace expression, TODO: pass the current match
-			try {
-				var parser = new Vade.Parser.for_string (r);
-				var expr = parser.parse_embedded ();
-				var value = yield get_editor_scope(editor).eval (expr, cur_cancellable);
-				r = value.str;
-			} catch (Error e) {
-				// do not parse in case of any error during parsing or evaluating the expression
-			}
+			var r = yield expand_replacement (current_match, cur_cancellable);
 
 			if (cur_cancellable.is_cancelled ()) {
 				return;
@@ -307,6 +542,111 @@ namespace Vanubi.UI {
 			buf.get_iter_at_mark (out iter, buf.get_insert ());
 			search.begin (iter);
 		}
+
+		/* Expands the back references and the expression of the replace text */
+		async string expand_replacement (MatchInfo? match, Cancellable cancellable) {
+			var r = replace_text;
+			if (is_regex && match != null) {
+				// parse back references
+				for (var i=1; i < match.get_match_count (); i++) {
+					r = r.replace (@"\\$i", match.fetch (i));
+				}
+			}
+
+			// evaluate replace expression, TODO: pass the current match
+			try {
+				var parser = new Vade.Parser.for_string (r);
+				var expr = parser.parse_embedded ();
+				var value = yield get_editor_scope(editor).eval (expr, cancellable);
+				r = value.str;
+			} catch (Error e) {
+				// do not parse in case of any error during parsing or evaluating the expression
+			}
+			return r;
+		}
+
+		/* Replaces all the remaining occurrences as a single edit */
+		async void replace_all () {
+			if (replace_cancellable != null) {
+				replace_cancellable.cancel ();
+			}
+			replace_cancellable = new Cancellable ();
+			var cur_cancellable = replace_cancellable;
+			if (matches == null) {
+				return;
+			}
+
+			// collect the replacements before touching the buffer
+			var buf = editor.view.buffer;
+			// the current occurrence is included in both directions
+			var forward = mode == Mode.REPLACE_FORWARD;
+			var regex = matches.regex;
+			int[] starts = {};
+			int[] ends = {};
+			string[] replacements = {};
+			uint generation;
+			do {
+				// the matches are kept up-to-date, collect again if the buffer changed meanwhile
+				generation = edit_generation;
+				starts = {};
+				ends = {};
+				replacements = {};
+				TextIter sel_start, sel_end;
+				buf.get_selection_bounds (out sel_start, out sel_end);
+				var offset = sel_start.get_offset ();
+				var first = forward ? matches.index_after (offset) : 0;
+				var last = forward ? matches.length : matches.index_after (offset+1);
+				for (var i=first; i < last; i++) {
+					int start, end;
+					matches.get_match (i, out start, out end);
+					MatchInfo match = null;
+					if (is_regex) {
+						TextIter match_iter, end_line;
+						buf.get_iter_at_offset (out match_iter, start);
+						end_line = match_iter;
+						end_line.forward_to_line_end ();
+						try {
+							regex.match_full (buf.get_text (match_iter, end_line, false), -1, 0, RegexMatchFlags.ANCHORED, out match);
+						} catch (RegexError e) {
+						}
+					}
+					var r = yield expand_replacement (match, cur_cancellable);
+					if (cur_cancellable.is_cancelled () || matches == null) {
+						// replaced again or the matches are gone
+						return;
+					}
+					if (generation != edit_generation) {
+						break;
+					}
+					starts += start;
+					ends += end;
+					replacements += r;
+				}
+			} while (generation != edit_generation);
+
+			// from the last match so that the offsets stay valid
+			replacing_all = true;
+			editor.begin_batch_edit ();
+			for (var i=starts.length-1; i >= 0; i--) {
+				TextIter start, end;
+				buf.get_iter_at_offset (out start, starts[i]);
+				buf.get_iter_at_offset (out end, ends[i]);
+				buf.delete (ref start, ref end);
+				buf.insert (ref start, replacements[i], -1);
+			}
+			editor.end_batch_edit ();
+			replacing_all = false;
+			// scan again on the next search
+			matches = null;
+			remove_highlight ();
+
+			state.status.set ("Replaced %d occurrences".printf (starts.length), "search");
+			if (replace_box != null) {
+				var replace_label = (Label) replace_box.get_child ();
+				replace_label.set_markup ("<b>Replaced occurrences till end of file</b>");
+				replace_complete = true;
+			}
+		}
 		
 		protected override bool on_key_press_event (Gdk.EventKey e) {
 			if (e.keyval == Gdk.Key.Escape || (e.keyval == Gdk.Key.g && Gdk.ModifierType.CONTROL_MASK in e.state)) {
@@ -361,6 +701,9 @@ namespace Vanubi.UI {
 						if (e.keyval == Gdk.Key.r) {
 							replace.begin ();
 							return true;
+						} else if (e.keyval == Gdk.Key.a) {
+							replace_all.begin ();
+							return true;
 						} else if (e.keyval == Gdk.Key.s) {
 							// skip occurrence
 							var buf = editor.view.buffer;
@@ -31,6 +31,9 @@ namespace Vanubi {
 		public abstract void delete (BufferIter start, BufferIter end);
 		public abstract string line_text (int line);
 
+		/* Bracket state shared by the indentation engines, subclasses must invalidate it when a line changes */
+		public virtual BracketCache? bracket_cache { get; set; }
+
 		public virtual bool empty_line (int line) {
 			return line_text(line).strip()[0] == '\0';
 		}
@@ -58,6 +61,11 @@ namespace Vanubi {
 			}
 		}
 
+		/* The effective offset of the iter, counting tabs as tab_width */
+		public virtual int effective_line_offset (BufferIter iter) {
+			return iter.effective_line_offset;
+		}
+
 		public virtual int get_indent (int line) {
 			var tab_width = tab_width;
 			int indent = 0;
@@ -167,6 +175,22 @@ namespace Vanubi {
 		internal string[] lines;
 		internal int timestamp;
 		public bool force_in_comment;
+		// comments and strings are told apart from code only when the syntax is set
+		public CodeSyntax? syntax;
+
+		// lexer states, or a string opened by syntax.quotes[state-LEX_STRING]
+		const int LEX_CODE = 0;
+		const int LEX_BLOCK_COMMENT = 1;
+		const int LEX_LINE_COMMENT = 2;
+		const int LEX_STRING = 3;
+		// lexer state at the start of each line, computed on demand
+		int[] line_states = new int[0];
+		// the kind of each byte of the last lexed line
+		int lexed_line = -1;
+		uint8[] lexed_kinds;
+		const uint8 KIND_CODE = 0;
+		const uint8 KIND_COMMENT = 1;
+		const uint8 KIND_STRING = 2;
 
 		public StringBuffer (owned string[] lines) {
 			this.lines = (owned) lines;
@@ -216,10 +240,110 @@ namespace Vanubi {
 			return new StringBufferIter (this, line, line_offset);
 		}
 
+		static bool has_prefix_at (string l, int i, string? prefix) {
+			return prefix != null && l.offset (i).has_prefix (prefix);
+		}
+
+		// returns the state at the end of the line, optionally storing the kind of each byte
+		int lex_line (int line, int state, uint8[]? kinds) {
+			unowned string l = lines[line];
+			var i = 0;
+			while (i < l.length) {
+				var c = l[i];
+				var n = 1;
+				uint8 kind;
+				if (state == LEX_CODE) {
+					var quote = c != '\n' ? syntax.quotes.index_of_char (c) : -1;
+					if (has_prefix_at (l, i, syntax.block_start)) {
+						state = LEX_BLOCK_COMMENT;
+						kind = KIND_COMMENT;
+						n = syntax.block_start.length;
+					} else if (has_prefix_at (l, i, syntax.line_comment)) {
+						state = LEX_LINE_COMMENT;
+						kind = KIND_COMMENT;
+					} else if (quote >= 0) {
+						state = LEX_STRING+quote;
+						kind = KIND_STRING;
+					} else {
+						kind = KIND_CODE;
+					}
+				} else if (state == LEX_BLOCK_COMMENT) {
+					kind = KIND_COMMENT;
+					if (has_prefix_at (l, i, syntax.block_end)) {
+						state = LEX_CODE;
+						n = syntax.block_end.length;
+					}
+				} else if (state == LEX_LINE_COMMENT) {
+					kind = KIND_COMMENT;
+				} else {
+					kind = KIND_STRING;
+					if (c == syntax.escape) {
+						// also continues the string on the next line
+						n = 2;
+					} else if (c == syntax.quotes[state-LEX_STRING] || c == '\n') {
+						state = LEX_CODE;
+					}
+				}
+
+				n = int.min (n, l.length-i);
+				if (kinds != null) {
+					for (var j=i; j < i+n; j++) {
+						kinds[j] = kind;
+					}
+				}
+				i += n;
+			}
+			return state == LEX_LINE_COMMENT ? LEX_CODE : state;
+		}
+
+		int state_at_line (int line) {
+			while (line_states.length <= line) {
+				var prev = line_states.length-1;
+				line_states += prev < 0 ? LEX_CODE : lex_line (prev, line_states[prev], null);
+			}
+			return line_states[line];
+		}
+
+		uint8 kind_at (int line, int offset) {
+			if (lexed_line != line) {
+				lexed_kinds = new uint8[lines[line].length];
+				lex_line (line, state_at_line (line), lexed_kinds);
+				lexed_line = line;
+			}
+			return offset < lexed_kinds.length ? lexed_kinds[offset] : KIND_CODE;
+		}
+
+		internal bool is_in_code_at (int line, int offset) {
+			if (syntax == null) {
+				// assume no strings and no comments for the tests
+				return !force_in_comment;
+			}
+			return kind_at (line, offset) == KIND_CODE;
+		}
+
+		internal bool is_in_comment_at (int line, int offset) {
+			if (syntax == null) {
+				return force_in_comment;
+			}
+			return kind_at (line, offset) == KIND_COMMENT;
+		}
+
+		// the lines after an edited line must be lexed again
+		void invalidate_lexer (int line) {
+			if (line_states.length > line+1) {
+				line_states.resize (line+1);
+			}
+			lexed_line = -1;
+		}
+
 		// only on a single line
 		public override void insert (BufferIter iter, string text) requires (((StringBufferIter) iter).valid && text.index_of ("\n") < 0) {
 			unowned string l = lines[iter.line];
 			lines[iter.line] = l.substring(0, iter.line_offset) + text + l.substring (iter.line_offset);
+			invalidate_lexer (iter.line);
+			if (bracket_cache != null) {
+				bracket_cache.invalidate (iter.line);
+			}
 			// update the iter
 			var siter = (StringBufferIter) iter;
 			siter._line_offset += text.length;
@@ -230,6 +354,10 @@ namespace Vanubi {
 		public override void delete (BufferIter start, BufferIter end) requires (((StringBufferIter)start).valid && ((StringBufferIter)end).valid && start.line == end.line) {
 			unowned string l = lines[start.line];
 			lines[start.line] = l.substring(0, start.line_offset) + l.substring (end.line_offset);
+			invalidate_lexer (start.line);
+			if (bracket_cache != null) {
+				bracket_cache.invalidate (start.line);
+			}
 			// update the iter
 			var sstart = (StringBufferIter) start;
 			var send = (StringBufferIter) end;
@@ -298,15 +426,13 @@ namespace Vanubi {
 
 		public override bool is_in_code {
 			get {
-				// assume no strings and no comments for the tests
-				return !buf.force_in_comment;
+				return buf.is_in_code_at (_line, _line_offset);
 			}
 		}
 
 		public override bool is_in_comment {
 			get {
-				// assume no comments for the tests
-				return buf.force_in_comment;
+				return buf.is_in_comment_at (_line, _line_offset);
 			}
 		}
 
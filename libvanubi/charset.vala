@@ -87,8 +87,9 @@ namespace Vanubi {
 			// assume latin1 with fallbacks
 			conv = new CharsetConverter ("UTF-8", "ISO-8859-1");
 			conv.use_fallback = true;
+			bestbuf = buf;
 			conv.convert (text, bestbuf, ConverterFlags.NONE, out sread, out written);
-			read = (int) read;
+			read = (int) sread;
 			bestbuf.length = (int) written;
 			charset = "ISO-8859-1";
 			fallbacks = (int) conv.get_num_fallbacks ();
@@ -97,4 +98,129 @@ namespace Vanubi {
 		bestbuf[bestbuf.length] = '\0';
 		return bestbuf;
 	}
-}
\ No newline at end of file
+
+	/* Converts a stream of data to utf-8, one chunk at a time.
+	 * The charset is detected once on the first chunk, then the same converter is reused.
+	 * Incomplete sequences at the end of a chunk are kept for the next chunk. */
+	public class CharsetDecoder {
+		public string? charset { get; private set; }
+		// number of invalid sequences replaced so far
+		public int fallbacks { get; private set; default = 0; }
+
+		CharsetConverter converter;
+		// incomplete sequences replaced at the end of the stream
+		int truncated = 0;
+		uint8[] carry = null;
+		uint8[] outbuf = null;
+
+		public CharsetDecoder (string? default_charset = null) {
+			this.charset = default_charset;
+		}
+
+		// Length of data without a trailing incomplete utf-8 sequence
+		static int complete_utf8_length (uint8[] data) {
+			for (var i=1; i <= 3 && i <= data.length; i++) {
+				var c = data[data.length-i];
+				if (c < 0x80) {
+					break;
+				}
+				if (c >= 0xc0) {
+					// lead byte, check the sequence length
+					var needed = c >= 0xf0 ? 4 : (c >= 0xe0 ? 3 : 2);
+					if (needed > i) {
+						return data.length-i;
+					}
+					break;
+				}
+			}
+			return data.length;
+		}
+
+		void detect (uint8[] data) throws Error {
+			// do not mistake a sequence cut by the chunk for an invalid one
+			unowned uint8[] sample = data;
+			var length = complete_utf8_length (data);
+			if (length > 0) {
+				sample = data[0:length];
+			}
+			
+			string? cset = charset;
+			int fallbacks;
+			convert_to_utf8 (sample, ref cset, null, out fallbacks);
+			charset = cset ?? "UTF-8";
+			converter = new CharsetConverter ("UTF-8", charset);
+			// the latin1 guess has been done with fallbacks
+			converter.use_fallback = fallbacks > 0;
+		}
+
+		/* Returns the converted data, owned by the decoder and valid until the next call.
+		 * Pass at_end when there is no more data, to flush any incomplete sequence. */
+		public unowned uint8[] decode (uint8[] data, bool at_end = false) throws Error {
+			uint8[] joined = null;
+			unowned uint8[] input = data;
+			if (carry.length > 0) {
+				joined = new uint8[carry.length+data.length];
+				Memory.copy (joined, carry, carry.length);
+				Memory.copy ((uint8*) joined+carry.length, data, data.length);
+				input = joined;
+			}
+
+			if (input.length == 0) {
+				unowned uint8[] empty = outbuf;
+				empty.length = 0;
+				return empty;
+			}
+			
+			if (converter == null) {
+				detect (input);
+			}
+
+			// room for the worst case and the trailing zero
+			if (outbuf.length < input.length*4+1) {
+				outbuf = new uint8[input.length*4+1];
+			}
+
+			size_t total_read = 0;
+			size_t total_written = 0;
+			var flags = at_end ? ConverterFlags.INPUT_AT_END : ConverterFlags.NONE;
+			while (total_read < input.length) {
+				unowned uint8[] inbuf = input[(int) total_read:input.length];
+				unowned uint8[] buf = outbuf[(int) total_written:outbuf.length-1];
+				size_t sread, written;
+				try {
+					converter.convert (inbuf, buf, flags, out sread, out written);
+				} catch (IOError.PARTIAL_INPUT e) {
+					// keep the incomplete sequence for the next chunk
+					break;
+				} catch (IOError.INVALID_DATA e) {
+					if (converter.use_fallback) {
+						throw e;
+					}
+					// replace invalid sequences from now on
+					converter.use_fallback = true;
+					continue;
+				}
+				total_read += sread;
+				total_written += written;
+				if (sread == 0) {
+					break;
+				}
+			}
+			if (at_end && total_read < input.length) {
+				// the stream ends in the middle of a sequence, replace it with U+FFFD
+				unowned string replacement = "\xef\xbf\xbd";
+				Memory.copy ((uint8*) outbuf+total_written, replacement, replacement.length);
+				total_written += replacement.length;
+				total_read = input.length;
+				truncated++;
+			}
+			fallbacks = (int) converter.get_num_fallbacks ()+truncated;
+
+			carry = input[(int) total_read:input.length];
+			outbuf[(int) total_written] = '\0';
+			unowned uint8[] res = outbuf;
+			res.length = (int) total_written;
+			return res;
+		}
+	}
+}
@@ -19,8 +19,12 @@
 
 namespace Vanubi {
 	/* Protocol:
-	 * Receive: size:uint64 chunk
-	 * Send: continue\n or cancel\n
+	 * Receive: size:int32 chunk, a zero size chunk ends the stream
+	 * Send: credit N\n to allow N more bytes of chunk data, or cancel\n when closed before the end
+	 *
+	 * With a window, the reader grants window bytes up front and tops up the credit as the data is consumed,
+	 * so the sender never waits a round trip as long as the window covers the bandwidth-delay product.
+	 * Without a window no credit is sent and the sender does not wait at all.
 	 */
 	 
 	public class ChunkedInputStream : FilterInputStream {
@@ -29,13 +33,38 @@ namespace Vanubi {
 		OutputStream os;
 		unowned Object refobj = null;
 		Object cancel_ref = null;
-		bool can_ask_continue = false;
 		
-		public ChunkedInputStream (AsyncDataInputStream is, OutputStream os, Object? refobj) {
+		public int window { get; private set; }
+		// bytes consumed since the last credit
+		int consumed = 0;
+		bool granted = false;
+		bool at_end = false;
+		
+		public ChunkedInputStream (AsyncDataInputStream is, OutputStream os, Object? refobj, int window = 0) {
 			Object (base_stream: is, close_base_stream: false);
 			this.is = is;
 			this.os = os;
 			this.refobj = refobj;
+			this.window = window;
+		}
+		
+		/* Returns the credit line to send, if any */
+		string? next_credit (ssize_t read) {
+			if (window <= 0 || at_end || cancel_ref != null) {
+				return null;
+			}
+			if (!granted) {
+				granted = true;
+				return "credit %d\n".printf (window);
+			}
+			
+			consumed += (int) read;
+			if (consumed < window/2) {
+				return null;
+			}
+			var credit = "credit %d\n".printf (consumed);
+			consumed = 0;
+			return credit;
 		}
 
 		async void consume_and_cancel (int io_priority = Priority.DEFAULT) {
@@ -65,10 +94,6 @@ namespace Vanubi {
 			SourceFunc? resume = null;
 
 			if (chunk_size == 0) {
-				if (can_ask_continue) {
-					os.write_all ("continue\n".data, null);
-				}
-				
 				// wait new chunk
 				if (cancellable != null) {
 					mycancellable = new Cancellable ();
@@ -80,13 +105,18 @@ namespace Vanubi {
 					});
 				}
 				
+				var credit = next_credit (0);
+				if (credit != null) {
+					os.write_all (credit.data, null);
+				}
+				
 				chunk_size = is.read_int32 (mycancellable);
+				at_end = chunk_size == 0;
 				if (cancellable != null && cancel_id > 0) {
 					cancellable.disconnect (cancel_id);
 					mycancellable = null;
 				}
 			}
-			can_ask_continue = true;
 			
 			unowned uint8[] buf = buffer;
 			buf.length = int.min ((int) chunk_size, buffer.length);
@@ -109,6 +139,11 @@ namespace Vanubi {
 			}
 			chunk_size -= (int) res;
 			
+			var credit = next_credit (res);
+			if (credit != null) {
+				os.write_all (credit.data, null);
+			}
+			
 			return res;
 		}
 		
@@ -120,10 +155,6 @@ namespace Vanubi {
 			SourceFunc? resume = null;
 
 			if (chunk_size == 0) {
-				if (can_ask_continue) {
-					yield os.write_async ("continue\n".data, io_priority, null);
-				}
-				
 				// wait new chunk
 				if (cancellable != null) {
 					mycancellable = new Cancellable ();
@@ -135,13 +166,18 @@ namespace Vanubi {
 					});
 				}
 				
+				var credit = next_credit (0);
+				if (credit != null) {
+					yield os.write_async (credit.data, io_priority, null);
+				}
+				
 				chunk_size = yield is.read_int32_async (io_priority, mycancellable);
+				at_end = chunk_size == 0;
 				if (cancellable != null && cancel_id > 0) {
 					cancellable.disconnect (cancel_id);
 					mycancellable = null;
 				}
 			}
-			can_ask_continue = true;
 			
 			unowned uint8[] buf = buffer;
 			buf.length = int.min ((int) chunk_size, buffer.length);
@@ -164,6 +200,11 @@ namespace Vanubi {
 			}
 			chunk_size -= (int) res;
 			
+			var credit = next_credit (res);
+			if (credit != null) {
+				yield os.write_async (credit.data, io_priority, null);
+			}
+			
 			return res;
 		}
 
@@ -19,58 +19,202 @@
 
 namespace Vanubi {
 	public class AbbrevCompletion {
-		LRU<string> lru = new LRU<string> (strcmp);
+		LRU<string> lru = new LRU<string> (str_hash, str_equal);
+		// unique words, with the number of lines containing them
+		HashTable<string, int> words = new HashTable<string, int> (str_hash, str_equal);
+		// unique words of each line, in a gap buffer so that consecutive edits
+		// around the same place do not move all the following lines
+		LineWords[] lines;
+		int gap_start;
+		int gap_end;
+		// snapshot of the words for matching, rebuilt when needed
 		Annotated<string>[] tags = null;
+		bool tags_dirty = false;
 		Regex regex;
 
+		class LineWords {
+			public string[] words;
+
+			public LineWords (owned string[] words) {
+				this.words = (owned) words;
+			}
+		}
+
+		/* The number of indexed lines */
+		public int n_lines {
+			get {
+				return lines.length-(gap_end-gap_start);
+			}
+		}
+
 		public AbbrevCompletion () {
+			reset_lines ();
 			try {
-				regex = new Regex ("\\w+", RegexCompileFlags.MULTILINE | RegexCompileFlags.OPTIMIZE);
+				regex = new Regex ("\\w+", RegexCompileFlags.OPTIMIZE);
 			} catch (Error e) {
 				warning (e.message);
 			}
 		}
 
+		string[] line_words (string text) {
+			string[] res = null;
+			var seen = new HashTable<string, bool> (str_hash, str_equal);
+			MatchInfo info;
+			regex.match (text, 0, out info);
+			while (info.matches ()) {
+				var word = info.fetch (0);
+				if (!(word in seen)) {
+					seen[word] = true;
+					res += (owned) word;
+				}
+				try {
+					info.next ();
+				} catch (Error e) {
+					break;
+				}
+			}
+			return res;
+		}
+
+		void reset_lines () {
+			lines = new LineWords[16];
+			lines[0] = new LineWords (null);
+			gap_start = 1;
+			gap_end = lines.length;
+		}
+
+		// Moves the gap to start at the given line
+		void move_gap (int line) {
+			if (line < gap_start) {
+				var n = gap_start-line;
+				for (var i=n-1; i >= 0; i--) {
+					lines[gap_end-n+i] = (owned) lines[line+i];
+				}
+				gap_start -= n;
+				gap_end -= n;
+			} else if (line > gap_start) {
+				var n = line-gap_start;
+				for (var i=0; i < n; i++) {
+					lines[gap_start+i] = (owned) lines[gap_end+i];
+				}
+				gap_start += n;
+				gap_end += n;
+			}
+		}
+
+		void ensure_gap (int size) {
+			if (gap_end-gap_start >= size) {
+				return;
+			}
+			var res = new LineWords[int.max (lines.length*2, n_lines+size+16)];
+			for (var i=0; i < gap_start; i++) {
+				res[i] = (owned) lines[i];
+			}
+			var new_gap_end = res.length-(lines.length-gap_end);
+			for (var i=gap_end; i < lines.length; i++) {
+				res[new_gap_end+i-gap_end] = (owned) lines[i];
+			}
+			lines = (owned) res;
+			gap_end = new_gap_end;
+		}
+
+		void ref_words (LineWords line) {
+			foreach (unowned string word in line.words) {
+				var count = words[word];
+				if (count == 0) {
+					lru.append (word);
+					tags_dirty = true;
+				}
+				words[word] = count+1;
+			}
+		}
+
+		void unref_words (LineWords line) {
+			foreach (unowned string word in line.words) {
+				var count = words[word]-1;
+				if (count <= 0) {
+					words.remove (word);
+					lru.remove (word);
+					tags_dirty = true;
+				} else {
+					words[word] = count;
+				}
+			}
+		}
+
+		/* Replaces n_removed lines starting at the given line with the given new lines.
+		 * The work is proportional to the number of lines being replaced, plus the
+		 * distance from the previous edit. */
+		public void replace_lines (int line, int n_removed, string[] new_lines) {
+			var new_words = new LineWords[new_lines.length];
+			for (var i=0; i < new_lines.length; i++) {
+				new_words[i] = new LineWords (line_words (new_lines[i]));
+			}
+
+			lock (tags) {
+				line = int.min (line, n_lines);
+				n_removed = int.min (n_removed, n_lines-line);
+				// the removed lines end up right before the gap
+				move_gap (line+n_removed);
+				for (var i=line; i < gap_start; i++) {
+					unref_words (lines[i]);
+					lines[i] = null;
+				}
+				gap_start = line;
+
+				ensure_gap (new_words.length);
+				for (var i=0; i < new_words.length; i++) {
+					ref_words (new_words[i]);
+					lines[gap_start++] = (owned) new_words[i];
+				}
+			}
+		}
+
 		public void index_text (string text) {
 			lock (tags) {
 				lru.clear ();
+				words.remove_all ();
+				reset_lines ();
 				tags = null;
+				tags_dirty = false;
 			}
 
-			MatchInfo info;
-			regex.match (text, 0, out info);
+			replace_lines (0, 1, text.split ("\n"));
+		}
 
-			while (info.matches ()) {
-				var tag = info.fetch (0);
-				
-				lock (tags) {
-					lru.append (tag);
-					tags += new Annotated<string> (tag, tag);
-				}
-				
-				info.next ();
+		// Must be called with the lock held
+		void update_tags () {
+			if (!tags_dirty) {
+				return;
 			}
+			
+			Annotated<string>[] res = new Annotated<string>[words.size ()];
+			var i = 0;
+			foreach (unowned string word in lru.list ()) {
+				res[i++] = new Annotated<string> (word, word);
+			}
+			tags = (owned) res;
+			tags_dirty = false;
 		}
 
 		// First result is always the first string in the lru
 		public async string[]? complete (string pattern, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
-			if (tags.length == 0) {
-				return null;
-			}
-			
 			Annotated<string>[] tags = null;
 			string first = null;
 			
 			lock (this.tags) {
+				update_tags ();
 				tags = this.tags; // make a copy to avoid lock contention
-				if (lru.list() != null) {
-					first = lru.list().data;
-				}
+				first = lru.head;
+			}
+
+			if (tags.length == 0) {
+				return null;
 			}
 			
 			GenericArray<Annotated<string>> matches;
 			try {
-				matches = yield run_in_thread (() => { return pattern_match_many<string> (pattern, tags, true, cancellable); });
+				matches = yield run_in_thread (() => { return pattern_match_many_parallel<string> (pattern, tags, true, cancellable); });
 			} catch (IOError.CANCELLED e) {
 				return null;
 			}
@@ -91,6 +235,15 @@ namespace Vanubi {
 			return res;
 		}
 
+		/* Returns the number of lines containing the word */
+		public int count (string word) {
+			int res;
+			lock (tags) {
+				res = words[word];
+			}
+			return res;
+		}
+
 		public void used (string tag) {
 			lock (tags) {
 				lru.used (tag);
@@ -48,11 +48,14 @@ namespace Vanubi {
 		[CCode (cname = "DATADIR", cheader_filename = "config.h")]
 		public extern const string VANUBI_DATADIR;
 
-		public Configuration () {
+		// Loads ~/.vanubi unless a different filename is given
+		public Configuration (string? filename = null) {
 			cluster = new FileCluster (this);
 			
-			var home = Environment.get_home_dir ();
-			var filename = Path.build_filename (home, ".vanubi");
+			if (filename == null) {
+				var home = Environment.get_home_dir ();
+				filename = Path.build_filename (home, ".vanubi");
+			}
 			backend = new KeyFile ();
 			file = File.new_for_path (filename);
 			if (file.query_exists ()) {
@@ -260,6 +263,12 @@ namespace Vanubi {
 		public void remove_group (string group) {
 			try {
 				backend.remove_group (group);
+				if (group.has_prefix ("source:")) {
+					var source = DataSource.new_from_string (group.substring ("source:".length));
+					if (source is FileSource) {
+						cluster.remove_file ((FileSource) source);
+					}
+				}
 			} catch (Error e) {
 			}
 		}
@@ -385,6 +394,13 @@ namespace Vanubi {
 			return res;
 		}
 
+		// keep the cluster index up-to-date when a new source group is about to be created
+		void add_file_group (DataSource file, string group) {
+			if (file is FileSource && !backend.has_group (group)) {
+				cluster.add_file ((FileSource) file);
+			}
+		}
+
 		string get_file_group (DataSource file, string key, bool has_default) {
 			var group = "source:"+file.to_string ();
 			if (!has_group_key (group, key)) {
@@ -404,6 +420,7 @@ namespace Vanubi {
 		
 		public void set_file_string (DataSource file, string key, string value) {
 			var group = "source:"+file.to_string ();
+			add_file_group (file, group);
 			backend.set_string (group, key, value);
 		}
 
@@ -433,6 +450,7 @@ namespace Vanubi {
 		
 		public void set_file_int (DataSource file, string key, int value) {
 			var group = "source:"+file.to_string ();
+			add_file_group (file, group);
 			set_group_int (group, key, value);
 		}
 		
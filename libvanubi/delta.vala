@@ -0,0 +1,307 @@
+/*
+ *  Copyright © 2014 Luca Bruno
+ *
+ *  This file is part of Vanubi.
+ *
+ *  Vanubi is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Vanubi is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Vanubi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* rsync-like delta encoding, to send only the changed parts of a file.
+ *
+ * The receiver sends the signature of its old copy:
+ * block size (uint32) | block count (uint32) | for each block: adler32 (uint32) | md5 (16 bytes)
+ *
+ * The sender replies with the operations to rebuild the new copy, each with a 9 bytes header:
+ * 'C' | first block (uint32) | count (uint32): copy count blocks of the old copy
+ * 'L' | length (uint32) | 0 (uint32) | bytes: literal data
+ *
+ * Integers are big endian. */
+namespace Vanubi {
+	const uint32 ADLER_MOD = 65521;
+
+	public uint32 adler32 (uint8[] data) {
+		uint32 a = 1;
+		uint32 b = 0;
+		foreach (var c in data) {
+			a = (a+c) % ADLER_MOD;
+			b = (b+a) % ADLER_MOD;
+		}
+		return (b << 16) | a;
+	}
+
+	/* Slides the adler32 of a window of len bytes by one byte */
+	public uint32 adler32_roll (uint32 sum, uint len, uint8 out_byte, uint8 in_byte) {
+		int64 a = sum & 0xffff;
+		int64 b = sum >> 16;
+		a = (a-out_byte+in_byte) % ADLER_MOD;
+		if (a < 0) {
+			a += ADLER_MOD;
+		}
+		b = (b - (int64) len*out_byte % ADLER_MOD + a - 1) % ADLER_MOD;
+		if (b < 0) {
+			b += ADLER_MOD;
+		}
+		return (uint32) ((b << 16) | a);
+	}
+
+	public class DeltaSignature {
+		public const int HEADER_SIZE = 8;
+		public const int ENTRY_SIZE = 20;
+		const int STRONG_SIZE = 16;
+
+		public int block_size { get; private set; }
+		public int count { get; private set; }
+
+		uint32[] weak;
+		uint8[] strong;
+		// index of the weak checksums, blocks with the same bucket are chained
+		int[] buckets;
+		int[] chain;
+		uint32 mask;
+
+		public DeltaSignature.parse (uint8[] data) throws Error {
+			if (data.length < HEADER_SIZE) {
+				throw new IOError.INVALID_DATA ("Truncated delta signature");
+			}
+			block_size = (int) read_be32 (data, 0);
+			count = (int) read_be32 (data, 4);
+			if (block_size <= 0 || count < 0 || data.length < HEADER_SIZE+(int64) count*ENTRY_SIZE) {
+				throw new IOError.INVALID_DATA ("Invalid delta signature");
+			}
+
+			weak = new uint32[count];
+			strong = new uint8[count*STRONG_SIZE];
+			for (var i=0; i < count; i++) {
+				var offset = HEADER_SIZE+i*ENTRY_SIZE;
+				weak[i] = read_be32 (data, offset);
+				Memory.copy (&strong[i*STRONG_SIZE], &data[offset+4], STRONG_SIZE);
+			}
+			build_index ();
+		}
+
+		public DeltaSignature.compute (uint8[] data, int block_size) {
+			this.block_size = block_size;
+			count = (data.length+block_size-1)/block_size;
+			weak = new uint32[count];
+			strong = new uint8[count*STRONG_SIZE];
+			var checksum = new Checksum (ChecksumType.MD5);
+			for (var i=0; i < count; i++) {
+				var start = i*block_size;
+				unowned uint8[] block = data[start:int.min (start+block_size, data.length)];
+				weak[i] = adler32 (block);
+				checksum.reset ();
+				checksum.update ((uchar[]) block, block.length);
+				uint8 digest[16];
+				size_t len = STRONG_SIZE;
+				checksum.get_digest (digest, ref len);
+				Memory.copy (&strong[i*STRONG_SIZE], digest, STRONG_SIZE);
+			}
+			build_index ();
+		}
+
+		/* The size of the whole signature, given at least its header */
+		public static int64 data_size (uint8[] header) {
+			return HEADER_SIZE+(int64) read_be32 (header, 4)*ENTRY_SIZE;
+		}
+
+		public uint8[] to_data () {
+			var data = new uint8[HEADER_SIZE+count*ENTRY_SIZE];
+			write_be32 (data, 0, block_size);
+			write_be32 (data, 4, count);
+			for (var i=0; i < count; i++) {
+				var offset = HEADER_SIZE+i*ENTRY_SIZE;
+				write_be32 (data, offset, weak[i]);
+				Memory.copy (&data[offset+4], &strong[i*STRONG_SIZE], STRONG_SIZE);
+			}
+			return data;
+		}
+
+		void build_index () {
+			uint size = 1;
+			while (size < count*2) {
+				size <<= 1;
+			}
+			mask = size-1;
+			buckets = new int[size];
+			for (var i=0; i < size; i++) {
+				buckets[i] = -1;
+			}
+			chain = new int[count];
+			// insert backwards so that chains are in block order
+			for (var i=count-1; i >= 0; i--) {
+				var bucket = bucket_of (weak[i]);
+				chain[i] = buckets[bucket];
+				buckets[bucket] = i;
+			}
+		}
+
+		uint bucket_of (uint32 sum) {
+			return (sum ^ (sum >> 16)) & mask;
+		}
+
+		/* Returns a block with the same contents as the window, preferring the hint, or -1 */
+		internal int find (uint32 sum, uint8[] window, int hint, Checksum checksum) {
+			if (count == 0) {
+				return -1;
+			}
+
+			uint8 digest[16];
+			var have_digest = false;
+			var found = -1;
+			for (var i = buckets[bucket_of (sum)]; i >= 0; i = chain[i]) {
+				if (weak[i] != sum) {
+					continue;
+				}
+				if (!have_digest) {
+					checksum.reset ();
+					checksum.update ((uchar[]) window, window.length);
+					size_t len = STRONG_SIZE;
+					checksum.get_digest (digest, ref len);
+					have_digest = true;
+				}
+				if (Memory.cmp (digest, &strong[i*STRONG_SIZE], STRONG_SIZE) != 0) {
+					continue;
+				}
+				// the hint extends the current copy
+				if (i == hint) {
+					return i;
+				}
+				if (found < 0) {
+					found = i;
+				}
+			}
+			return found;
+		}
+	}
+
+	/* Computes the operations to rebuild data from the old copy described by sig */
+	public ByteArray compute_delta (DeltaSignature sig, uint8[] data) {
+		var delta = new ByteArray ();
+		var bs = sig.block_size;
+		var checksum = new Checksum (ChecksumType.MD5);
+
+		int literal_start = 0;
+		int copy_start = -1;
+		int copy_count = 0;
+		int pos = 0;
+		uint32 sum = 0;
+		var rolling = false;
+
+		while (pos+bs <= data.length) {
+			unowned uint8[] window = data[pos:pos+bs];
+			if (!rolling) {
+				sum = adler32 (window);
+				rolling = true;
+			}
+
+			var block = sig.find (sum, window, copy_start >= 0 ? copy_start+copy_count : -1, checksum);
+			if (block >= 0) {
+				if (literal_start < pos) {
+					flush_copy (delta, ref copy_start, ref copy_count);
+					append_literal (delta, data[literal_start:pos]);
+				}
+				if (copy_start >= 0 && block == copy_start+copy_count) {
+					copy_count++;
+				} else {
+					flush_copy (delta, ref copy_start, ref copy_count);
+					copy_start = block;
+					copy_count = 1;
+				}
+				pos += bs;
+				literal_start = pos;
+				rolling = false;
+				continue;
+			}
+
+			if (pos+bs < data.length) {
+				sum = adler32_roll (sum, bs, data[pos], data[pos+bs]);
+			}
+			pos++;
+		}
+
+		// the trailing bytes are always sent as literal
+		if (literal_start < data.length) {
+			flush_copy (delta, ref copy_start, ref copy_count);
+			append_literal (delta, data[literal_start:data.length]);
+		}
+		flush_copy (delta, ref copy_start, ref copy_count);
+		return delta;
+	}
+
+	/* Rebuilds the new copy from the old one and the delta */
+	public ByteArray apply_delta (uint8[] old, int block_size, uint8[] delta) throws Error {
+		var res = new ByteArray ();
+		var pos = 0;
+		while (pos < delta.length) {
+			if (pos+9 > delta.length) {
+				throw new IOError.INVALID_DATA ("Truncated delta");
+			}
+			var op = delta[pos];
+			var arg1 = read_be32 (delta, pos+1);
+			var arg2 = read_be32 (delta, pos+5);
+			pos += 9;
+
+			if (op == 'C') {
+				var start = (int64) arg1*block_size;
+				var end = int64.min (start+(int64) arg2*block_size, old.length);
+				if (start > end) {
+					throw new IOError.INVALID_DATA ("Delta copy out of range");
+				}
+				res.append (old[(int) start:(int) end]);
+			} else if (op == 'L') {
+				if (pos+(int64) arg1 > delta.length) {
+					throw new IOError.INVALID_DATA ("Truncated delta literal");
+				}
+				res.append (delta[pos:pos+(int) arg1]);
+				pos += (int) arg1;
+			} else {
+				throw new IOError.INVALID_DATA ("Invalid delta operation: %d", op);
+			}
+		}
+		return res;
+	}
+
+	void flush_copy (ByteArray delta, ref int copy_start, ref int copy_count) {
+		if (copy_start < 0) {
+			return;
+		}
+		append_op (delta, 'C', copy_start, copy_count);
+		copy_start = -1;
+		copy_count = 0;
+	}
+
+	void append_literal (ByteArray delta, uint8[] data) {
+		append_op (delta, 'L', data.length, 0);
+		delta.append (data);
+	}
+
+	void append_op (ByteArray delta, uint8 op, uint32 arg1, uint32 arg2) {
+		uint8 header[9];
+		header[0] = op;
+		write_be32 (header, 1, arg1);
+		write_be32 (header, 5, arg2);
+		delta.append (header);
+	}
+
+	uint32 read_be32 (uint8[] buf, int offset) {
+		return ((uint32) buf[offset] << 24) | ((uint32) buf[offset+1] << 16) | ((uint32) buf[offset+2] << 8) | buf[offset+3];
+	}
+
+	void write_be32 (uint8[] buf, int offset, uint32 val) {
+		buf[offset] = (uint8) (val >> 24);
+		buf[offset+1] = (uint8) (val >> 16);
+		buf[offset+2] = (uint8) (val >> 8);
+		buf[offset+3] = (uint8) val;
+	}
+}
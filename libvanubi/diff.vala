@@ -0,0 +1,554 @@
+/*
+ *  Copyright © 2014 Luca Bruno
+ *
+ *  This file is part of Vanubi.
+ *
+ *  Vanubi is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Vanubi is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Vanubi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+namespace Vanubi {
+	public enum DiffType {
+		ADD,
+		DEL,
+		MOD
+	}
+
+	/* A changed range of lines, 0-based. Pure insertions have no old lines, pure deletions have no new lines. */
+	public struct DiffHunk {
+		public int old_start;
+		public int old_count;
+		public int new_start;
+		public int new_count;
+	}
+
+	/* A run of changed lines of the new text, 1-based. A deletion marks the line following it. */
+	public struct DiffRange {
+		public int start;
+		public int count;
+		public DiffType type;
+	}
+
+	/* The changed lines of the new text as a sorted run-length list */
+	public class DiffRanges {
+		public DiffRange[] ranges = {};
+
+		public DiffRanges (DiffHunk[] hunks) {
+			foreach (var hunk in hunks) {
+				var range = DiffRange () { start = hunk.new_start+1, count = hunk.new_count };
+				if (hunk.old_count == 0) {
+					range.type = DiffType.ADD;
+				} else if (hunk.new_count == 0) {
+					range.type = DiffType.DEL;
+					range.count = 1;
+				} else {
+					range.type = DiffType.MOD;
+				}
+
+				// a deletion right before the next change is hidden by it
+				if (ranges.length > 0 && ranges[ranges.length-1].start == range.start) {
+					ranges.resize (ranges.length-1);
+				}
+				ranges += range;
+			}
+		}
+
+		public bool lookup (int line, out DiffType type) {
+			type = DiffType.MOD;
+			// last range starting before the line
+			var lo = 0;
+			var hi = ranges.length;
+			while (lo < hi) {
+				var mid = (lo+hi)/2;
+				if (ranges[mid].start <= line) {
+					lo = mid+1;
+				} else {
+					hi = mid;
+				}
+			}
+			if (lo == 0) {
+				return false;
+			}
+			var range = ranges[lo-1];
+			if (line >= range.start+range.count) {
+				return false;
+			}
+			type = range.type;
+			return true;
+		}
+	}
+
+	public DiffHunk[] diff_lines (string[] a, string[] b, Cancellable? cancellable = null) throws IOError {
+		return new LineDiff (a).update (b, cancellable);
+	}
+
+	/* Line diff of a new text against a fixed old one, such as the HEAD version of a file.
+	 * Lines are interned to integers. After the first update, only the lines changed since
+	 * the previous update are interned, and only the region around them is diffed again.
+	 * Updates are thread safe. */
+	public class LineDiff {
+		HashTable<string, int> ids = new HashTable<string, int> (str_hash, str_equal);
+		string[] old_lines;
+		int[] old_ids;
+		string[]? new_lines = null;
+		int[]? new_ids = null;
+		DiffHunk[] hunks = {};
+		Mutex mutex = Mutex ();
+
+		public LineDiff (string[] old_lines) {
+			this.old_lines = old_lines;
+			old_ids = intern (old_lines);
+		}
+
+		int intern_line (string line) {
+			var id = ids[line];
+			if (id == 0 && !(line in ids)) {
+				id = (int) ids.size ();
+				ids[line] = id;
+			}
+			return id;
+		}
+
+		int[] intern (string[] lines) {
+			var res = new int[lines.length];
+			for (var i=0; i < lines.length; i++) {
+				res[i] = intern_line (lines[i]);
+			}
+			return res;
+		}
+
+		/* Returns the hunks turning the old text into new_lines */
+		public DiffHunk[] update (owned string[] new_lines, Cancellable? cancellable = null) throws IOError {
+			mutex.lock ();
+			try {
+				return update_locked ((owned) new_lines, cancellable);
+			} finally {
+				mutex.unlock ();
+			}
+		}
+
+		// The ids of the lines, only the lines changed since the previous update are interned
+		int[] intern_changed (string[] lines) {
+			if (new_ids == null) {
+				return intern (lines);
+			}
+
+			var n = new_lines.length;
+			var m = lines.length;
+			var prefix = 0;
+			while (prefix < n && prefix < m && new_lines[prefix] == lines[prefix]) {
+				prefix++;
+			}
+			var suffix = 0;
+			while (suffix < n-prefix && suffix < m-prefix && new_lines[n-1-suffix] == lines[m-1-suffix]) {
+				suffix++;
+			}
+
+			var res = new int[m];
+			Memory.copy (res, new_ids, prefix*sizeof(int));
+			for (var i=prefix; i < m-suffix; i++) {
+				res[i] = intern_line (lines[i]);
+			}
+			for (var i=0; i < suffix; i++) {
+				res[m-suffix+i] = new_ids[n-suffix+i];
+			}
+			return res;
+		}
+
+		// Forgets the lines of the previous versions, keeps the old and the current ones
+		void rebuild_ids () {
+			ids.remove_all ();
+			old_ids = intern (old_lines);
+			new_ids = intern (new_lines);
+		}
+
+		DiffHunk[] update_locked (owned string[] lines, Cancellable? cancellable) throws IOError {
+			var cur = intern_changed (lines);
+			if (new_ids == null) {
+				hunks = diff_ids (old_ids, cur, cancellable);
+				new_lines = (owned) lines;
+				new_ids = cur;
+				return hunks;
+			}
+
+			// the lines edited since the previous update
+			var prev = new_ids;
+			var n = prev.length;
+			var m = cur.length;
+			var prefix = 0;
+			while (prefix < n && prefix < m && prev[prefix] == cur[prefix]) {
+				prefix++;
+			}
+			var suffix = 0;
+			while (suffix < n-prefix && suffix < m-prefix && prev[n-1-suffix] == cur[m-1-suffix]) {
+				suffix++;
+			}
+			if (prefix == n && prefix == m) {
+				new_lines = (owned) lines;
+				new_ids = cur;
+				return hunks;
+			}
+
+			// the hunks touching the edit are diffed again
+			var lo = prefix;
+			var hi = n-suffix;
+			var first = 0;
+			var shift = 0;
+			while (first < hunks.length && hunks[first].new_start+hunks[first].new_count < lo) {
+				shift += hunks[first].new_count-hunks[first].old_count;
+				first++;
+			}
+			var last = first;
+			var region_shift = 0;
+			while (last < hunks.length && hunks[last].new_start <= hi) {
+				region_shift += hunks[last].new_count-hunks[last].old_count;
+				last++;
+			}
+			if (first < last) {
+				lo = int.min (lo, hunks[first].new_start);
+				hi = int.max (hi, hunks[last-1].new_start+hunks[last-1].new_count);
+			}
+
+			// lines outside the hunks are the same in both texts
+			var old_lo = lo-shift;
+			var old_hi = hi-shift-region_shift;
+			var cur_hi = hi+m-n;
+			var region = diff_ids (old_ids[old_lo:old_hi], cur[lo:cur_hi], cancellable);
+
+			DiffHunk[] res = {};
+			for (var i=0; i < first; i++) {
+				res += hunks[i];
+			}
+			foreach (var hunk in region) {
+				hunk.old_start += old_lo;
+				hunk.new_start += lo;
+				append_hunk (ref res, hunk);
+			}
+			for (var i=last; i < hunks.length; i++) {
+				var hunk = hunks[i];
+				hunk.new_start += m-n;
+				append_hunk (ref res, hunk);
+			}
+
+			hunks = res;
+			new_lines = (owned) lines;
+			new_ids = cur;
+			// the ids of the lines edited away are still in the table
+			if (ids.size () > 2*(old_ids.length+cur.length)+1024) {
+				rebuild_ids ();
+			}
+			return hunks;
+		}
+
+		/* Number of interned lines */
+		public int n_ids {
+			get {
+				mutex.lock ();
+				var res = (int) ids.size ();
+				mutex.unlock ();
+				return res;
+			}
+		}
+
+		static void append_hunk (ref DiffHunk[] hunks, DiffHunk hunk) {
+			if (hunks.length > 0) {
+				var last = hunks[hunks.length-1];
+				if (last.old_start+last.old_count == hunk.old_start && last.new_start+last.new_count == hunk.new_start) {
+					last.old_count += hunk.old_count;
+					last.new_count += hunk.new_count;
+					hunks[hunks.length-1] = last;
+					return;
+				}
+			}
+			hunks += hunk;
+		}
+	}
+
+	/* Histogram diff: the region is split at the common line that occurs the least,
+	 * so that unique lines like declarations anchor the diff, then Myers is used when
+	 * all the common lines are too frequent. */
+	class HistogramDiff {
+		// lines occurring more than this in the old region are not used as anchors
+		const int MAX_OCCURRENCES = 64;
+		const int MAX_DEPTH = 256;
+
+		// per id, valid only when the stamp is the current one
+		int[] counts;
+		int[] heads;
+		int[] stamps;
+		int stamp = 0;
+		unowned Cancellable? cancellable;
+
+		public HistogramDiff (int n_ids, Cancellable? cancellable) {
+			counts = new int[n_ids];
+			heads = new int[n_ids];
+			stamps = new int[n_ids];
+			this.cancellable = cancellable;
+		}
+
+		/* Marks the deleted lines of a and the inserted lines of b */
+		public void diff (int[] a, int[] b, bool[] del, bool[] ins, int depth = 0) throws IOError {
+			while (true) {
+				cancellable.set_error_if_cancelled ();
+
+				var n = a.length;
+				var m = b.length;
+				var prefix = 0;
+				while (prefix < n && prefix < m && a[prefix] == b[prefix]) {
+					prefix++;
+				}
+				var suffix = 0;
+				while (suffix < n-prefix && suffix < m-prefix && a[n-1-suffix] == b[m-1-suffix]) {
+					suffix++;
+				}
+				a = a[prefix:n-suffix];
+				b = b[prefix:m-suffix];
+				del = del[prefix:n-suffix];
+				ins = ins[prefix:m-suffix];
+				n = a.length;
+				m = b.length;
+
+				if (n == 0 || m == 0) {
+					mark_all (del, ins);
+					return;
+				}
+				if (depth >= MAX_DEPTH) {
+					myers (a, b, del, ins, cancellable);
+					return;
+				}
+
+				// occurrences of each line in a, chained through next
+				stamp++;
+				var next = new int[n];
+				for (var i=n-1; i >= 0; i--) {
+					var id = a[i];
+					if (stamps[id] != stamp) {
+						stamps[id] = stamp;
+						counts[id] = 0;
+						heads[id] = -1;
+					}
+					counts[id]++;
+					next[i] = heads[id];
+					heads[id] = i;
+				}
+
+				// the longest common run around the rarest common line
+				var best_count = MAX_OCCURRENCES+1;
+				var best_a = -1;
+				var best_b = -1;
+				var best_len = 0;
+				var has_common = false;
+				for (var j=0; j < m; j++) {
+					var id = b[j];
+					if (stamps[id] != stamp) {
+						continue;
+					}
+					has_common = true;
+					var count = counts[id];
+					if (count > best_count) {
+						continue;
+					}
+					// lines of a run already seen would find the same run again
+					var run_end = j+1;
+					for (var i = heads[id]; i >= 0; i = next[i]) {
+						var start_a = i;
+						var start_b = j;
+						while (start_a > 0 && start_b > 0 && a[start_a-1] == b[start_b-1]) {
+							start_a--;
+							start_b--;
+						}
+						var end_a = i+1;
+						var end_b = j+1;
+						while (end_a < n && end_b < m && a[end_a] == b[end_b]) {
+							end_a++;
+							end_b++;
+						}
+						var len = end_a-start_a;
+						if (count < best_count || len > best_len) {
+							best_count = count;
+							best_a = start_a;
+							best_b = start_b;
+							best_len = len;
+						}
+						run_end = int.max (run_end, end_b);
+					}
+					j = run_end-1;
+				}
+
+				if (!has_common) {
+					mark_all (del, ins);
+					return;
+				}
+				if (best_a < 0) {
+					myers (a, b, del, ins, cancellable);
+					return;
+				}
+
+				diff (a[0:best_a], b[0:best_b], del[0:best_a], ins[0:best_b], depth+1);
+				// continue with what follows the common run
+				a = a[best_a+best_len:n];
+				b = b[best_b+best_len:m];
+				del = del[best_a+best_len:n];
+				ins = ins[best_b+best_len:m];
+				depth++;
+			}
+		}
+	}
+
+	DiffHunk[] diff_ids (int[] a, int[] b, Cancellable? cancellable) throws IOError {
+		// dense ids of the region, the tables of the diff are proportional to it
+		var dense = new HashTable<int, int> (direct_hash, direct_equal);
+		var da = compact_ids (a, dense);
+		var db = compact_ids (b, dense);
+		var del = new bool[a.length];
+		var ins = new bool[b.length];
+		new HistogramDiff ((int) dense.size (), cancellable).diff (da, db, del, ins);
+		return collect_hunks (del, ins);
+	}
+
+	int[] compact_ids (int[] ids, HashTable<int, int> dense) {
+		var res = new int[ids.length];
+		for (var i=0; i < ids.length; i++) {
+			// stored plus one, zero is missing
+			var id = dense[ids[i]];
+			if (id == 0) {
+				id = (int) dense.size ()+1;
+				dense[ids[i]] = id;
+			}
+			res[i] = id-1;
+		}
+		return res;
+	}
+
+	/* Myers O(ND) diff. Beyond MAX_DIFF_EDITS the lines are reported as a single change. */
+	public const int MAX_DIFF_EDITS = 2048;
+
+	void myers (int[] a, int[] b, bool[] del, bool[] ins, Cancellable? cancellable) throws IOError {
+		var n = a.length;
+		var m = b.length;
+		if (n == 0 || m == 0) {
+			mark_all (del, ins);
+			return;
+		}
+
+		var max = n+m;
+		var offset = max+1;
+		var v = new int[2*max+3];
+		// the v of each step, only the range [-d, d] of step d is kept
+		int[] trace = new int[0];
+		int[] trace_start = new int[0];
+		var found = -1;
+
+		for (var d=0; d <= max; d++) {
+			if (d > MAX_DIFF_EDITS) {
+				mark_all (del, ins);
+				return;
+			}
+			if ((d & 63) == 0) {
+				cancellable.set_error_if_cancelled ();
+			}
+
+			trace_start += trace.length;
+			for (var k=-d; k <= d; k++) {
+				trace += v[offset+k];
+			}
+
+			for (var k=-d; k <= d; k += 2) {
+				int x;
+				if (k == -d || (k != d && v[offset+k-1] < v[offset+k+1])) {
+					x = v[offset+k+1];
+				} else {
+					x = v[offset+k-1]+1;
+				}
+				var y = x-k;
+				while (x < n && y < m && a[x] == b[y]) {
+					x++;
+					y++;
+				}
+				v[offset+k] = x;
+				if (x >= n && y >= m) {
+					found = d;
+					break;
+				}
+			}
+			if (found >= 0) {
+				break;
+			}
+		}
+
+		// walk back the path
+		var cx = n;
+		var cy = m;
+		for (var d=found; d > 0; d--) {
+			var start = trace_start[d];
+			var k = cx-cy;
+			// trace of step d holds the v of step d-1
+			int prev_k;
+			if (k == -d || (k != d && trace[start+k-1+d] < trace[start+k+1+d])) {
+				prev_k = k+1;
+			} else {
+				prev_k = k-1;
+			}
+			var prev_x = trace[start+prev_k+d];
+			var prev_y = prev_x-prev_k;
+
+			// the snake
+			while (cx > prev_x && cy > prev_y) {
+				cx--;
+				cy--;
+			}
+			if (cx == prev_x) {
+				ins[cy-1] = true;
+			} else {
+				del[cx-1] = true;
+			}
+			cx = prev_x;
+			cy = prev_y;
+		}
+	}
+
+	void mark_all (bool[] del, bool[] ins) {
+		for (var i=0; i < del.length; i++) {
+			del[i] = true;
+		}
+		for (var i=0; i < ins.length; i++) {
+			ins[i] = true;
+		}
+	}
+
+	DiffHunk[] collect_hunks (bool[] del, bool[] ins) {
+		DiffHunk[] hunks = {};
+		var i = 0;
+		var j = 0;
+		while (i < del.length || j < ins.length) {
+			if (i < del.length && j < ins.length && !del[i] && !ins[j]) {
+				i++;
+				j++;
+				continue;
+			}
+
+			var hunk = DiffHunk () { old_start = i, new_start = j };
+			while ((i < del.length && del[i]) || (j < ins.length && ins[j])) {
+				if (i < del.length && del[i]) {
+					i++;
+				} else {
+					j++;
+				}
+			}
+			hunk.old_count = i-hunk.old_start;
+			hunk.new_count = j-hunk.new_start;
+			hunks += hunk;
+		}
+		return hunks;
+	}
+}
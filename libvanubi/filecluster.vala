@@ -32,6 +32,26 @@ namespace Vanubi {
 		List<FileSource> opened_files;
 		HashTable<string, SimilarFlags> keys_flags;
 
+		/* Index of the files known by the configuration, built on first use
+		 * and kept up-to-date by the configuration itself. */
+		class IndexEntry {
+			public FileSource file;
+			// insertion order, the latest entry wins among equally similar files
+			public int seq;
+
+			public IndexEntry (FileSource file, int seq) {
+				this.file = file;
+				this.seq = seq;
+			}
+		}
+
+		bool indexed = false;
+		int next_seq = 0;
+		HashTable<string, IndexEntry> index_by_path;
+		HashTable<string, GenericArray<IndexEntry>> index_by_name;
+		HashTable<string, GenericArray<IndexEntry>> index_by_extension;
+		HashTable<string, GenericArray<IndexEntry>> index_by_parent;
+
 		public FileCluster (Configuration config) {
 			this.config = config;
 			this.keys_flags = new HashTable<string, SimilarFlags> (str_hash, str_equal);
@@ -39,6 +59,11 @@ namespace Vanubi {
 			keys_flags["shell_cwd"] = SimilarFlags.SIBLING;
 			keys_flags["tab_width"] = SimilarFlags.SAME_NAME | SimilarFlags.SAME_EXTENSION;
 			keys_flags["indent_mode"] = SimilarFlags.SAME_NAME | SimilarFlags.SAME_EXTENSION;
+
+			index_by_path = new HashTable<string, IndexEntry> (str_hash, str_equal);
+			index_by_name = new HashTable<string, GenericArray<IndexEntry>> (str_hash, str_equal);
+			index_by_extension = new HashTable<string, GenericArray<IndexEntry>> (str_hash, str_equal);
+			index_by_parent = new HashTable<string, GenericArray<IndexEntry>> (str_hash, str_equal);
 		}
 		
 		public void opened_file (FileSource f) {
@@ -55,15 +80,86 @@ namespace Vanubi {
 				opened_files.delete_link (link);
 			}
 		}
-		
-		bool each_file (Operation<FileSource> op) {
-			var files = config.get_files ();
-			foreach (var other in files) {
-				if (!op (other)) {
-					return false;
-				}
+
+		static string parent_key (FileSource f) {
+			var parent = f.parent;
+			// the empty string is never a valid path, use it for the root
+			return parent != null ? parent.to_string () : "";
+		}
+
+		static void bucket_add (HashTable<string, GenericArray<IndexEntry>> table, string key, IndexEntry entry) {
+			unowned GenericArray<IndexEntry> bucket = table[key];
+			if (bucket == null) {
+				var newbucket = new GenericArray<IndexEntry> ();
+				bucket = newbucket;
+				table.insert (key, (owned) newbucket);
+			}
+			bucket.add (entry);
+		}
+
+		static void bucket_remove (HashTable<string, GenericArray<IndexEntry>> table, string key, IndexEntry entry) {
+			unowned GenericArray<IndexEntry> bucket = table[key];
+			if (bucket == null) {
+				return;
+			}
+			bucket.remove_fast (entry);
+			if (bucket.length == 0) {
+				table.remove (key);
+			}
+		}
+
+		void ensure_index () {
+			if (indexed) {
+				return;
+			}
+			// set before populating, add_file checks it
+			indexed = true;
+			foreach (var f in config.get_files ()) {
+				add_file (f);
+			}
+		}
+
+		/* Called by the configuration when a new source group is created */
+		public void add_file (FileSource f) {
+			if (!indexed) {
+				// will be picked up when the index is built
+				return;
+			}
+
+			var path = f.to_string ();
+			if (path in index_by_path) {
+				return;
+			}
+
+			var entry = new IndexEntry (f, next_seq++);
+			index_by_path[path] = entry;
+			bucket_add (index_by_name, f.basename, entry);
+			var ext = f.extension;
+			if (ext != null) {
+				bucket_add (index_by_extension, ext, entry);
 			}
-			return true;
+			bucket_add (index_by_parent, parent_key (f), entry);
+		}
+
+		/* Called by the configuration when a source group is removed */
+		public void remove_file (FileSource f) {
+			if (!indexed) {
+				return;
+			}
+
+			var path = f.to_string ();
+			var entry = index_by_path[path];
+			if (entry == null) {
+				return;
+			}
+
+			index_by_path.remove (path);
+			bucket_remove (index_by_name, f.basename, entry);
+			var ext = f.extension;
+			if (ext != null) {
+				bucket_remove (index_by_extension, ext, entry);
+			}
+			bucket_remove (index_by_parent, parent_key (f), entry);
 		}
 		
 		bool has_same_parent (FileSource left, FileSource right) {
@@ -92,56 +188,67 @@ namespace Vanubi {
 			return left.basename == right.basename;
 		}
 
-		bool left_more_similar_than_right (SimilarFlags left, SimilarFlags right) {
-			bool lname = SimilarFlags.SAME_NAME in left;
-			bool lext = SimilarFlags.SAME_EXTENSION in left;
-			bool lsibling = SimilarFlags.SIBLING in left;
-			
-			bool rname = SimilarFlags.SAME_NAME in right;
-			bool rext = SimilarFlags.SAME_EXTENSION in right;
-			bool rsibling = SimilarFlags.SIBLING in right;
+		/* The higher the more similar, in order:
+		 * same extension and sibling, same extension and name, same name, same extension, sibling */
+		int similarity_rank (SimilarFlags flags) {
+			bool name = SimilarFlags.SAME_NAME in flags;
+			bool ext = SimilarFlags.SAME_EXTENSION in flags;
+			bool sibling = SimilarFlags.SIBLING in flags;
 
-			// same extension and sibling
-			if (lext && lsibling) {
-				return true;
+			if (ext && sibling) {
+				return 5;
 			}
-			if (rext && rsibling) {
-				return false;
+			if (ext && name) {
+				return 4;
 			}
-
-			// same extension and name
-			if (lext && lname) {
-				return true;
+			if (name) {
+				return 3;
 			}
-			if (rext && rname) {
-				return false;
+			if (ext) {
+				return 2;
 			}
-
-			// same name
-			if (lname) {
-				return true;
-			}
-			if (rname) {
-				return false;
+			if (sibling) {
+				return 1;
 			}
+			return 0;
+		}
 
-			// same extension
-			if (lext) {
-				return true;
-			}
-			if (rext) {
-				return false;
+		void match_bucket (GenericArray<IndexEntry>? bucket, FileSource file, SimilarFlags flags,
+						   ref IndexEntry? best, ref SimilarFlags best_match, ref int best_rank) {
+			if (bucket == null) {
+				return;
 			}
 
-			// sibling
-			if (lsibling) {
-				return true;
-			}
-			if (rsibling) {
-				return false;
-			}
+			foreach (unowned IndexEntry entry in bucket.data) {
+				unowned FileSource f = entry.file;
+				if (f.equal (file)) {
+					continue;
+				}
 
-			return false;
+				SimilarFlags cur_match = SimilarFlags.NONE;
+				if (SimilarFlags.SAME_NAME in flags && has_same_name (file, f)) {
+					cur_match |= SimilarFlags.SAME_NAME;
+				}
+
+				if (SimilarFlags.SAME_EXTENSION in flags && has_same_extension (file, f)) {
+					cur_match |= SimilarFlags.SAME_EXTENSION;
+				}
+
+				if (SimilarFlags.SIBLING in flags && has_same_parent (file, f)) {
+					cur_match |= SimilarFlags.SIBLING;
+				}
+
+				var cur_rank = similarity_rank (cur_match);
+				if (cur_rank == 0) {
+					continue;
+				}
+				// on equal similarity prefer the file that was configured last
+				if (cur_rank > best_rank || (cur_rank == best_rank && entry.seq > best.seq)) {
+					best = entry;
+					best_match = cur_match;
+					best_rank = cur_rank;
+				}
+			}
 		}
 		
 		// Returns a similar file, or itself, for a given configuration key
@@ -156,33 +263,27 @@ namespace Vanubi {
 				return file;
 			}
 
-			FileSource? most_similar = null;
+			ensure_index ();
+
+			// only look at the files sharing at least one trait with the given file
+			IndexEntry? best = null;
 			SimilarFlags best_match = SimilarFlags.NONE;
+			int best_rank = 0;
 
-			each_file ((f) => {
-					if (!f.equal (file)) {
-						SimilarFlags cur_match = SimilarFlags.NONE;
-						
-						if (SimilarFlags.SAME_NAME in flags && has_same_name (file, f)) {
-							cur_match |= SimilarFlags.SAME_NAME;
-						}
-
-						if (SimilarFlags.SAME_EXTENSION in flags && has_same_extension (file, f)) {
-							cur_match |= SimilarFlags.SAME_EXTENSION;
-						}
-
-						if (SimilarFlags.SIBLING in flags && has_same_parent (file, f)) {
-							cur_match |= SimilarFlags.SIBLING;
-						}
-
-						if (cur_match != SimilarFlags.NONE && left_more_similar_than_right (cur_match, best_match)) {
-							most_similar = f;
-							best_match = cur_match;
-						}
-					}
-					return true;
-			});
+			if (SimilarFlags.SAME_NAME in flags) {
+				match_bucket (index_by_name[file.basename], file, flags, ref best, ref best_match, ref best_rank);
+			}
+			if (SimilarFlags.SAME_EXTENSION in flags) {
+				var ext = file.extension;
+				if (ext != null) {
+					match_bucket (index_by_extension[ext], file, flags, ref best, ref best_match, ref best_rank);
+				}
+			}
+			if (SimilarFlags.SIBLING in flags) {
+				match_bucket (index_by_parent[parent_key (file)], file, flags, ref best, ref best_match, ref best_rank);
+			}
 
+			FileSource? most_similar = best != null ? best.file : null;
 			if (most_similar != null) {
 				string[] flag_names = null;
 				if (SimilarFlags.SAME_NAME in best_match) {
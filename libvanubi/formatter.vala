@@ -0,0 +1,141 @@
+/*
+ *  Copyright © 2014 Luca Bruno
+ *
+ *  This file is part of Vanubi.
+ *
+ *  Vanubi is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Vanubi is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Vanubi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+namespace Vanubi {
+	/* The indentation of a file compared with the indenter */
+	public class IndentResult {
+		public string path;
+		public int n_lines;
+		// binary file or language without an indenter
+		public bool skipped;
+		// 0-based lines to reindent, with their current and expected indent
+		public int[] lines = new int[0];
+		public int[] indents = new int[0];
+		public int[] new_indents = new int[0];
+		public string? error;
+
+		public IndentResult (string path) {
+			this.path = path;
+		}
+	}
+
+	/* Checks or fixes the indentation of files with the editor indenters, without GTK */
+	public class IndentFormatter {
+		const int WORKERS = 4;
+
+		public int tab_width = 4;
+		public IndentMode indent_mode = IndentMode.TABS;
+		// write the reindented files
+		public bool in_place;
+
+		/* Returns the editor language id for the file name, or null if its comments and strings
+		 * cannot be told apart from code without the editor highlighting */
+		public static string? language_for_file (string path) {
+			var lang_id = Languages.get_default().language_for_file (path);
+			return CodeSyntax.for_language (lang_id) != null ? lang_id : null;
+		}
+
+		/* Formats the files in parallel, the results are in the same order of the files */
+		public async IndentResult[] format (string[] files, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			initialize_thread_pool ();
+			SourceFunc resume = format.callback;
+			var results = new IndentResult[files.length];
+			var next = 0;
+			var running = WORKERS;
+
+			for (var w=0; w < WORKERS; w++) {
+				thread_pool.add (new ThreadWorker (() => {
+						while (!cancellable.is_cancelled ()) {
+							var i = AtomicInt.add (ref next, 1);
+							if (i >= files.length) {
+								break;
+							}
+							results[i] = format_file (files[i]);
+						}
+
+						if (AtomicInt.dec_and_test (ref running)) {
+							Idle.add_full (io_priority, (owned) resume);
+						}
+						return null;
+				}));
+			}
+			yield;
+			cancellable.set_error_if_cancelled ();
+			return results;
+		}
+
+		public IndentResult format_file (string path) {
+			var result = new IndentResult (path);
+			string contents;
+			size_t length;
+			try {
+				FileUtils.get_contents (path, out contents, out length);
+			} catch (Error e) {
+				result.error = e.message;
+				return result;
+			}
+			if (memchr (contents, 0, size_t.min (length, 8000)) != null) {
+				result.skipped = true;
+				return result;
+			}
+
+			var lang_id = language_for_file (path);
+			var buffer = new StringBuffer.from_text (contents);
+			buffer.tab_width = tab_width;
+			buffer.indent_mode = indent_mode;
+			// brackets in comments and strings are not counted
+			buffer.syntax = CodeSyntax.for_language (lang_id);
+			var indenter = Indent.for_language (lang_id, buffer);
+			// python indentation is part of the syntax, the editor only shifts regions
+			if (indenter == null || indenter is Indent_Python) {
+				result.skipped = true;
+				return result;
+			}
+
+			var n_lines = buffer.lines.length;
+			result.n_lines = n_lines;
+			var indents = indenter.compute_indents (0, n_lines-1);
+			for (var line=0; line < n_lines; line++) {
+				// indenting blank lines would only add trailing spaces
+				if (buffer.empty_line (line)) {
+					continue;
+				}
+				var indent = buffer.get_indent (line);
+				if (indent != indents[line]) {
+					result.lines += line;
+					result.indents += indent;
+					result.new_indents += indents[line];
+				}
+			}
+
+			if (in_place && result.lines.length > 0) {
+				for (var i=0; i < result.lines.length; i++) {
+					buffer.set_indent (result.lines[i], result.new_indents[i]);
+				}
+				try {
+					// keeps the permissions of the file
+					File.new_for_path (path).replace_contents (buffer.text.data, null, false, FileCreateFlags.NONE, null);
+				} catch (Error e) {
+					result.error = e.message;
+				}
+			}
+			return result;
+		}
+	}
+}
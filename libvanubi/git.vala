@@ -19,24 +19,202 @@
  */
 
 namespace Vanubi {
-	public enum DiffType {
-		ADD,
-		DEL,
-		MOD
+	/* What git knows about a repository, shared by all the editors so that refreshing the
+	 * gutter does not spawn git every time. It's invalidated by the changes of the special
+	 * files under .git, see Git.monitor_special_file. */
+	public class GitRepo {
+		public FileSource root { get; private set; }
+		Configuration config;
+
+		// paths relative to the root
+		HashTable<string, bool>? tracked = null;
+		uint tracked_generation = 0;
+		// path -> blob id in HEAD
+		HashTable<string, string>? head_blobs = null;
+		uint head_generation = 0;
+		// blobs never change, so they're kept by id
+		HashTable<string, Bytes> blobs = new HashTable<string, Bytes> (str_hash, str_equal);
+		LRU<string> blobs_lru;
+		// incremental diffs against HEAD, by path
+		HashTable<string, HeadDiff> diffs = new HashTable<string, HeadDiff> (str_hash, str_equal);
+		LRU<string> diffs_lru;
+
+		const uint MAX_BLOBS = 32;
+		const uint MAX_DIFFS = 16;
+
+		class HeadDiff {
+			public string blob;
+			public LineDiff diff;
+		}
+
+		public GitRepo (FileSource root, Configuration config) {
+			this.root = root;
+			this.config = config;
+			blobs_lru = new LRU<string> (str_hash, str_equal, MAX_BLOBS, (id) => { blobs.remove (id); });
+			diffs_lru = new LRU<string> (str_hash, str_equal, MAX_DIFFS, (path) => { diffs.remove (path); });
+		}
+
+		/* Forgets what became stale after the special file changed */
+		public void invalidate (string refname) {
+			if (refname == "index") {
+				tracked = null;
+				tracked_generation++;
+			} else {
+				// HEAD or the current branch moved
+				head_blobs = null;
+				head_generation++;
+			}
+		}
+
+		public async bool is_tracked (string path, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			var table = yield load_tracked (io_priority, cancellable);
+			return path in table;
+		}
+
+		/* Returns the tracked files, relative to the root */
+		public async string[] tracked_files (int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			var table = yield load_tracked (io_priority, cancellable);
+			string[] res = {};
+			foreach (unowned string path in table.get_keys ()) {
+				res += path;
+			}
+			return res;
+		}
+
+		async HashTable<string, bool> load_tracked (int io_priority, Cancellable? cancellable) throws Error {
+			if (tracked != null) {
+				return tracked;
+			}
+
+			var generation = tracked_generation;
+			var output = yield run_git ("ls-files -z", io_priority, cancellable);
+			var table = new HashTable<string, bool> (str_hash, str_equal);
+			if (output != null) {
+				foreach (unowned string name in split_nul (output)) {
+					table[name] = true;
+				}
+			}
+			// don't keep it if it changed meanwhile
+			if (generation == tracked_generation) {
+				tracked = table;
+			}
+			return table;
+		}
+
+		/* Returns the blob id of the file in HEAD, or null if it's not there */
+		public async string? head_blob (string path, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			var table = head_blobs;
+			if (table == null) {
+				var generation = head_generation;
+				// fails in a repository without commits
+				var output = yield run_git ("ls-tree -r -z HEAD", io_priority, cancellable);
+				table = new HashTable<string, string> (str_hash, str_equal);
+				if (output != null) {
+					// <mode> SP <type> SP <id> TAB <path>
+					foreach (unowned string entry in split_nul (output)) {
+						var tab = entry.index_of_char ('\t');
+						if (tab < 0) {
+							continue;
+						}
+						var fields = entry.substring (0, tab).split (" ");
+						if (fields.length == 3 && fields[1] == "blob") {
+							table[entry.substring (tab+1)] = fields[2];
+						}
+					}
+				}
+				if (generation == head_generation) {
+					head_blobs = table;
+				}
+			}
+			return table[path];
+		}
+
+		/* Returns the contents of the file in HEAD, or null if it's not there */
+		public async Bytes? head_contents (string path, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			var id = yield head_blob (path, io_priority, cancellable);
+			if (id == null) {
+				return null;
+			}
+			var blob = blobs[id];
+			if (blob == null) {
+				var data = yield run_git ("cat-file blob "+id, io_priority, cancellable);
+				if (data == null) {
+					return null;
+				}
+				blob = new Bytes.take ((owned) data);
+				blobs[id] = blob;
+				blobs_lru.append (id);
+			}
+			blobs_lru.used (id);
+			return blob;
+		}
+
+		/* Returns the diff against the file in HEAD, to be updated with the current text.
+		 * It's kept across calls so that only the edited region is diffed again. */
+		public async LineDiff head_diff (string path, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			// a file not yet committed is diffed against nothing
+			var id = (yield head_blob (path, io_priority, cancellable)) ?? "";
+			var diff = diffs[path];
+			if (diff != null && diff.blob == id) {
+				diffs_lru.used (path);
+				return diff.diff;
+			}
+
+			var head = yield head_contents (path, io_priority, cancellable);
+			diff = new HeadDiff ();
+			diff.blob = id;
+			diff.diff = yield run_in_thread<LineDiff> (() => {
+					return new LineDiff (head != null ? split_lines (head.get_data ()) : new string[0]);
+			});
+			diffs[path] = diff;
+			diffs_lru.append (path);
+			diffs_lru.used (path);
+			return diff.diff;
+		}
+
+		/* Runs git in the root, returns null if it fails */
+		async uint8[]? run_git (string args, int io_priority, Cancellable? cancellable) throws Error {
+			var git_command = config.get_global_string ("git_command", "git");
+			int status;
+			var output = yield root.execute_shell (@"$git_command $args", null, null, out status, io_priority, cancellable);
+			if (status != 0) {
+				return null;
+			}
+			return output;
+		}
+
+		public static string[] split_lines (uint8[] data) {
+			return ((string) data).substring (0, data.length).split ("\n");
+		}
+
+		static string[] split_nul (uint8[] data) {
+			string[] res = {};
+			var start = 0;
+			for (var i=0; i < data.length; i++) {
+				if (data[i] == '\0') {
+					if (i > start) {
+						res += (string) (&data[start]);
+					}
+					start = i+1;
+				}
+			}
+			return res;
+		}
 	}
 
 	public class Git {
+		class RepoLookup {
+			// null if not in a repository
+			public FileSource? repo;
+			public int64 time;
+		}
+
 		unowned Configuration config;
-		static Regex hunk_regex;
 		static HashTable<DataSource, bool> monitored = new HashTable<DataSource, bool> (DataSource.hash, DataSource.equal);
-		
-		static construct {
-			try {
-				hunk_regex = new Regex ("^@@ -(\\d+),?(\\d*) \\+(\\d+),?(\\d*) @@");
-			} catch (Error e) {
-				warning (e.message);
-			}
-		}
+		static HashTable<DataSource, RepoLookup> lookups = new HashTable<DataSource, RepoLookup> (DataSource.hash, DataSource.equal);
+		static HashTable<DataSource, GitRepo> repos = new HashTable<DataSource, GitRepo> (DataSource.hash, DataSource.equal);
+		// a directory may become part of a repository
+		const int64 NOT_IN_REPO_TTL = 10*TimeSpan.SECOND;
 		
 		[Signal (detailed = true)]
 		public signal void special_file_changed (FileSource dir, string refname);
@@ -47,15 +225,45 @@ namespace Vanubi {
 		
 		/* Returns the git directory that contains this file */
 		public async FileSource? get_repo (FileSource dir, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			var lookup = lookups[dir];
+			if (lookup != null && (lookup.repo != null || get_monotonic_time ()-lookup.time < NOT_IN_REPO_TTL)) {
+				return lookup.repo;
+			}
+			
 			var git_command = config.get_global_string ("git_command", "git");
 
 			int status;
 			var cmd = @"$git_command rev-parse --show-cdup";
 			var stdout = (string) yield dir.execute_shell (cmd, null, null, out status, io_priority, cancellable);
-			if (status != 0 || stdout == null) {
+			lookup = new RepoLookup ();
+			lookup.time = get_monotonic_time ();
+			if (status == 0 && stdout != null) {
+				lookup.repo = (FileSource) dir.child (stdout.strip ());
+			}
+			lookups[dir] = lookup;
+			return lookup.repo;
+		}
+
+		/* Returns the shared cached state of the repository that contains this directory */
+		public async GitRepo? get_repo_service (FileSource dir, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			var root = yield get_repo (dir, io_priority, cancellable);
+			if (root == null) {
 				return null;
 			}
-			return (FileSource) dir.child (stdout.strip ());
+
+			var repo = repos[root];
+			if (repo == null) {
+				repo = new GitRepo (root, config);
+				repos[root] = repo;
+				// the list of tracked files changes with the index
+				monitor_special_file.begin (root, "index", io_priority, null, (s,r) => {
+						try {
+							monitor_special_file.end (r);
+						} catch (Error e) {
+						}
+				});
+			}
+			return repo;
 		}
 
 		public async bool monitor_special_file (FileSource dir, string refname, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
@@ -70,6 +278,10 @@ namespace Vanubi {
 			}
 
 			refsource.changed.connect (() => {
+					var service = repos[repo];
+					if (service != null) {
+						service.invalidate (refname);
+					}
 					special_file_changed (repo, refname);
 			});
 			
@@ -80,28 +292,28 @@ namespace Vanubi {
 		}
 
 		public async bool file_in_repo (FileSource file, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
-			var git_command = config.get_global_string ("git_command", "git");
-			int status;
-			var escaped = Shell.quote (file.local_path);
-			var cmd = @"$git_command ls-files --error-unmatch $escaped";
-			yield file.parent.execute_shell (cmd, null, null, out status, io_priority, cancellable);
-			return status == 0;
+			var repo = yield get_repo_service ((FileSource) file.parent, io_priority, cancellable);
+			if (repo == null) {
+				return false;
+			}
+			var path = repo.root.get_relative_path (file);
+			if (path == null) {
+				return false;
+			}
+			return yield repo.is_tracked (path, io_priority, cancellable);
 		}
 
 		public async InputStream grep (FileSource dir, string pat, owned Func<string> error_callback, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
-			int stdout, stderr;
-
 			bool insensitive = pat.down() == pat;
 			
 			var git_command = config.get_global_string ("git_command", "git");
-			Process.spawn_async_with_pipes (dir.local_path,
-											{git_command, "grep", insensitive ? "-inI" : "-nI", "--color", pat},
-											null,
-											SpawnFlags.SEARCH_PATH,
-											null, null, null, out stdout, out stderr);
-			
-			var stream = new UnixInputStream (stdout, true);
-			var err_stream = new UnixInputStream (stderr, true);
+			// same syntax as the native grep
+			var args = GrepEngine.git_grep_args (pat);
+			var cmd = "%s grep %s %s --color -e %s".printf (git_command, args[0], insensitive ? "-inI" : "-nI", Shell.quote (args[2]));
+			// also works for remote directories, the matches are read while grep runs
+			var proc = yield dir.spawn_shell (cmd, null, io_priority, cancellable);
+			var stream = proc.stdout;
+			var err_stream = proc.stderr;
 
 			read_all_async.begin (err_stream, io_priority, cancellable, (s,r) => {
 					try {
@@ -137,39 +349,6 @@ namespace Vanubi {
 			return output.strip ();
 		}
 		
-		/* Based on https://github.com/jisaacks/GitGutter/blob/master/git_gutter_handler.py#L116 */
-		private HashTable<int, DiffType>? parse_diff (uint8[] diff_buffer, Cancellable cancellable) {
-			var table = new HashTable<int, DiffType> (null, null);
-			string[] lines = ((string)diff_buffer).split ("\n");
-			
-			for (var i=0; i<lines.length; i++) {
-				if (cancellable.is_cancelled ()) {
-					return null;
-				}
-				
-				MatchInfo hunks;
-				if (hunk_regex.match (lines[i], 0, out hunks)) {
-					int start = int.parse (hunks.fetch (3));
-					int old_size = (hunks.fetch (2) == "") ? 1 : int.parse (hunks.fetch (2));
-					int new_size = (hunks.fetch (4) == "") ? 1 : int.parse (hunks.fetch (4));
-					
-					if (old_size == 0) {
-						for (var j=start; j<(start + new_size); j++) {
-							table.insert (j, DiffType.ADD);
-						}
-					} else if (new_size == 0) {
-						table.insert (start + 1, DiffType.DEL);
-					} else {
-						for (var j=start; j<(start + new_size); j++) {
-							table.insert (j, DiffType.MOD);
-						}
-					}
-				}
-			}
-			
-			return table;
-		}
-
 		public async bool add_file (FileSource file, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
 			var repo = yield get_repo ((FileSource) file.parent, io_priority, cancellable);
 			if (repo == null) {
@@ -187,30 +366,38 @@ namespace Vanubi {
 				throw new IOError.FAILED ("Cannot add file to git: %s", err);
 			}
 
+			var service = repos[repo];
+			if (service != null) {
+				service.invalidate ("index");
+			}
 			return true;
 		}
 		
-		public async HashTable<int, DiffType>? diff_buffer (FileSource file, owned uint8[] input, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
-			var in_repo = yield file_in_repo (file, io_priority, cancellable);
-			if (!in_repo) {
+		/* Compares the text with the file in HEAD. The diff runs in-process against the cached HEAD contents,
+		 * so git is only spawned after something changed in the repository. */
+		public async DiffRanges? diff_buffer (FileSource file, owned uint8[] input, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			var repo = yield get_repo_service ((FileSource) file.parent, io_priority, cancellable);
+			if (repo == null) {
 				return null;
 			}
-			
-			var repo = yield get_repo ((FileSource) file.parent, io_priority, cancellable);
-			if (repo == null) {
+			var path = repo.root.get_relative_path (file);
+			if (path == null) {
+				return null;
+			}
+			var in_repo = yield repo.is_tracked (path, io_priority, cancellable);
+			if (!in_repo) {
 				return null;
 			}
-			var git_command = config.get_global_string ("git_command", "git");
-			var filename = repo.get_relative_path (file);
 			
-			string cmdline = @"diff -d -U0 <($git_command show HEAD:$filename) -";
-			var output = yield repo.execute_shell (cmdline, input, null, null, io_priority, cancellable);
+			var diff = yield repo.head_diff (path, io_priority, cancellable);
 			cancellable.set_error_if_cancelled ();
 			
-			var table = yield run_in_thread<HashTable<int, DiffType>> (() => { return parse_diff (output, cancellable); });
+			var ranges = yield run_in_thread<DiffRanges> (() => {
+					return new DiffRanges (diff.update (GitRepo.split_lines (input), cancellable));
+			});
 			cancellable.set_error_if_cancelled ();
 			
-			return table;
+			return ranges;
 		}
 	}
 }
@@ -0,0 +1,557 @@
+/*
+ *  Copyright © 2014 Luca Bruno
+ *
+ *  This file is part of Vanubi.
+ *
+ *  Vanubi is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Vanubi is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Vanubi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+namespace Vanubi {
+	[CCode (cname = "memchr", cheader_filename = "string.h")]
+	extern void* memchr (void* s, int c, size_t n);
+
+	/* A line matching the pattern */
+	public class GrepMatch {
+		// relative to the searched directory
+		public string path;
+		// 0-based
+		public int line;
+		// the line as is, without the newline
+		public uint8[] text;
+		// start and end byte offsets in the line of each match
+		public int[] ranges;
+
+		public GrepMatch (string path, int line, uint8[] text, int[] ranges) {
+			this.path = path;
+			this.line = line;
+			this.text = text;
+			this.ranges = ranges;
+		}
+
+		public int column {
+			get {
+				return ranges[0];
+			}
+		}
+	}
+
+	public delegate void GrepBatchFunc (GrepMatch[] matches);
+
+	/* Searches files in parallel for the lines matching a pattern, like git grep -I.
+	 * Patterns that are not valid regular expressions, e.g. "printf(", are searched literally.
+	 * Literal patterns are searched with memchr. For regular expressions and case insensitive
+	 * searches, a leading literal is searched first so that only the candidate lines are
+	 * matched against the regex. */
+	public class GrepEngine {
+		const int WORKERS = 4;
+		// like git, a NUL in the first bytes marks a binary file
+		const int BINARY_CHECK = 8000;
+
+		public string pattern { get; private set; }
+		public bool case_insensitive { get; private set; }
+
+		Regex? regex = null;
+		// searched first, may be null
+		uint8[]? needle = null;
+		// ignoring the ascii case, the needle is lowercase
+		bool needle_caseless = false;
+		// unsaved contents by absolute path
+		HashTable<string, Bytes> contents = new HashTable<string, Bytes> (str_hash, str_equal);
+
+		public GrepEngine (string pattern, bool case_insensitive) throws RegexError {
+			this.pattern = pattern;
+			this.case_insensitive = case_insensitive;
+
+			var valid = is_valid_regex (pattern);
+			var literal = valid ? literal_prefix (pattern) : pattern;
+			var has_letters = false;
+			for (var i=0; i < literal.length; i++) {
+				if (literal[i].isalpha ()) {
+					has_letters = true;
+				}
+			}
+			if (literal != "") {
+				needle_caseless = case_insensitive && has_letters;
+				needle = needle_caseless ? literal.ascii_down ().data : literal.data;
+			}
+
+			if (literal != pattern || (case_insensitive && has_letters)) {
+				var flags = RegexCompileFlags.RAW | RegexCompileFlags.OPTIMIZE;
+				if (case_insensitive) {
+					flags |= RegexCompileFlags.CASELESS;
+				}
+				regex = new Regex (valid ? pattern : Regex.escape_string (pattern), flags);
+			}
+		}
+
+		public static bool is_valid_regex (string pattern) {
+			try {
+				new Regex (pattern, RegexCompileFlags.RAW);
+				return true;
+			} catch (RegexError e) {
+				return false;
+			}
+		}
+
+		/* The git grep arguments matching the same lines of the engine */
+		public static string[] git_grep_args (string pattern) throws RegexError {
+			if (!is_valid_regex (pattern)) {
+				return { "-F", "-e", pattern };
+			}
+			return { "-E", "-e", to_extended_regex (pattern) };
+		}
+
+		/* The literal text at the start of the pattern that every match contains */
+		static string literal_prefix (string pattern) {
+			if ("|" in pattern) {
+				return "";
+			}
+			var start = pattern.has_prefix ("^") ? 1 : 0;
+			var end = start;
+			while (end < pattern.length && !(pattern[end] in ".^$*+?()[]{}|\\")) {
+				end++;
+			}
+			// the last char is optional or repeated
+			if (end < pattern.length && pattern[end] in "*?{" && end > start) {
+				end--;
+			}
+			return pattern.substring (start, end-start);
+		}
+
+		/* Translates the pattern to the extended syntax of git grep -E, used for remote directories,
+		 * so that they match the same lines. The pattern is checked with the regex engine of the
+		 * local searches first, so that both report the same errors. */
+		public static string to_extended_regex (string pattern) throws RegexError {
+			new Regex (pattern, RegexCompileFlags.RAW);
+
+			var res = new StringBuilder ();
+			var in_class = false;
+			var len = pattern.length;
+			for (var i=0; i < len; i++) {
+				var c = pattern[i];
+				if (c == '\\' && i+1 < len) {
+					var e = pattern[++i];
+					if (e == 'd') {
+						res.append (in_class ? "0-9" : "[0-9]");
+					} else if (e == 's') {
+						res.append (in_class ? "[:space:]" : "[[:space:]]");
+					} else if (e == 'w') {
+						res.append (in_class ? "[:alnum:]_" : "[[:alnum:]_]");
+					} else if (e == 't') {
+						res.append_c ('\t');
+					} else if (!in_class && (e == 'D' || e == 'S' || e == 'W')) {
+						res.append (e == 'D' ? "[^0-9]" : (e == 'S' ? "[^[:space:]]" : "[^[:alnum:]_]"));
+					} else if (!in_class && (e == 'b' || e == 'B' || !e.isalnum ())) {
+						res.append_c (c);
+						res.append_c (e);
+					} else if (in_class && !e.isalnum () && !(e in "]\\^-")) {
+						// backslashes are literal in bracket expressions
+						res.append_c (e);
+					} else {
+						throw new RegexError.COMPILE ("\\%c is not supported when searching remote directories", e);
+					}
+				} else if (c == '[' && !in_class) {
+					in_class = true;
+					res.append_c (c);
+					// a leading ] is literal
+					if (i+1 < len && pattern[i+1] == '^') {
+						res.append_c (pattern[++i]);
+					}
+					if (i+1 < len && pattern[i+1] == ']') {
+						res.append_c (pattern[++i]);
+					}
+				} else if (c == '[' && in_class && i+1 < len && pattern[i+1] == ':' && pattern.index_of (":]", i+2) > 0) {
+					// character class name
+					var end = pattern.index_of (":]", i+2)+2;
+					res.append (pattern.substring (i, end-i));
+					i = end-1;
+				} else if (c == ']' && in_class) {
+					in_class = false;
+					res.append_c (c);
+				} else if (c == '(' && !in_class && i+1 < len && pattern[i+1] == '?') {
+					if (i+2 < len && pattern[i+2] == ':') {
+						// non capturing group
+						res.append_c (c);
+						i += 2;
+					} else {
+						throw new RegexError.COMPILE ("(? groups are not supported when searching remote directories");
+					}
+				} else {
+					res.append_c (c);
+				}
+			}
+			return res.str;
+		}
+
+		/* Searches these contents instead of the file, e.g. for unsaved buffers */
+		public void set_contents (string path, Bytes data) {
+			contents[path] = data;
+		}
+
+		/* Searches the files, relative to dir, and calls func in the main loop with the matches.
+		 * The matches of a file are never split across batches. */
+		public async void search (string dir, string[] files, owned GrepBatchFunc func, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			initialize_thread_pool ();
+			SourceFunc resume = search.callback;
+			var next = 0;
+			var running = WORKERS;
+			var pending = new GenericArray<GrepMatch> ();
+			var flushing = false;
+			Mutex mutex = Mutex ();
+
+			SourceFunc flush = () => {
+				mutex.lock ();
+				var batch = pending;
+				pending = new GenericArray<GrepMatch> ();
+				flushing = false;
+				mutex.unlock ();
+				if (batch.length > 0 && !cancellable.is_cancelled ()) {
+					func (batch.data);
+				}
+				return false;
+			};
+
+			for (var w=0; w < WORKERS; w++) {
+				thread_pool.add (new ThreadWorker (() => {
+						var found = new GenericArray<GrepMatch> ();
+						while (!cancellable.is_cancelled ()) {
+							var i = AtomicInt.add (ref next, 1);
+							if (i >= files.length) {
+								break;
+							}
+
+							search_file (dir, files[i], found);
+							if (found.length == 0) {
+								continue;
+							}
+							// batches are made of the files searched until the main loop picks them up
+							mutex.lock ();
+							foreach (var match in found.data) {
+								pending.add (match);
+							}
+							if (!flushing) {
+								flushing = true;
+								Idle.add_full (io_priority, () => flush ());
+							}
+							mutex.unlock ();
+							found = new GenericArray<GrepMatch> ();
+						}
+
+						mutex.lock ();
+						var last = --running == 0;
+						mutex.unlock ();
+						if (last) {
+							Idle.add_full (io_priority, () => {
+									flush ();
+									resume ();
+									return false;
+							});
+						}
+						return null;
+				}));
+			}
+			yield;
+			cancellable.set_error_if_cancelled ();
+		}
+
+		void search_file (string dir, string path, GenericArray<GrepMatch> res) {
+			var filename = Path.build_filename (dir, path);
+			var data = contents[filename];
+			if (data != null) {
+				search_data (path, data.get_data (), res);
+				return;
+			}
+
+			MappedFile mapped;
+			try {
+				mapped = new MappedFile (filename, false);
+			} catch (Error e) {
+				// deleted or unreadable, like git grep
+				return;
+			}
+			if (mapped.get_length () == 0 || mapped.get_length () > int.MAX) {
+				return;
+			}
+			unowned uint8[] mapped_data = (uint8[]) mapped.get_contents ();
+			mapped_data.length = (int) mapped.get_length ();
+			if (find_byte (mapped_data, 0, int.min (mapped_data.length, BINARY_CHECK), '\0') >= 0) {
+				return;
+			}
+			search_data (path, mapped_data, res);
+		}
+
+		/* Adds the matching lines of data to res */
+		public void search_data (string path, uint8[] data, GenericArray<GrepMatch> res) {
+			var line = 0;
+			var line_start = 0;
+			var pos = 0;
+			while (pos < data.length) {
+				var candidate = pos;
+				if (needle != null) {
+					candidate = find_needle (data, pos);
+					if (candidate < 0) {
+						break;
+					}
+				}
+
+				// count the lines up to the candidate
+				while (true) {
+					var nl = find_byte (data, line_start, candidate, '\n');
+					if (nl < 0) {
+						break;
+					}
+					line++;
+					line_start = nl+1;
+				}
+				var line_end = find_byte (data, candidate, data.length, '\n');
+				if (line_end < 0) {
+					line_end = data.length;
+				}
+
+				unowned uint8[] text = data[line_start:line_end];
+				var ranges = match_line (text);
+				if (ranges.length > 0) {
+					res.add (new GrepMatch (path, line, text, ranges));
+				}
+				pos = line_end+1;
+			}
+		}
+
+		int[] match_line (uint8[] text) {
+			int[] ranges = {};
+			if (regex == null) {
+				var start = 0;
+				while (true) {
+					var found = find_bytes (text, start, needle);
+					if (found < 0) {
+						break;
+					}
+					ranges += found;
+					ranges += found+needle.length;
+					start = found+needle.length;
+				}
+				return ranges;
+			}
+
+			try {
+				MatchInfo info;
+				if (regex.match_full ((string) text, text.length, 0, 0, out info)) {
+					do {
+						int start, end;
+						info.fetch_pos (0, out start, out end);
+						ranges += start;
+						ranges += end;
+					} while (info.next ());
+				}
+			} catch (RegexError e) {
+			}
+			return ranges;
+		}
+
+		int find_needle (uint8[] data, int from) {
+			if (!needle_caseless) {
+				return find_bytes (data, from, needle);
+			}
+
+			var last = data.length-needle.length;
+			var lower = needle[0];
+			var upper = (uint8) ((char) lower).toupper ();
+			// the next occurrence of each case of the first char
+			var next_lower = -1;
+			var next_upper = lower == upper ? -2 : -1;
+			while (from <= last) {
+				if (next_lower >= -1 && next_lower < from) {
+					next_lower = find_byte (data, from, last+1, lower);
+					if (next_lower < 0) {
+						next_lower = -2;
+					}
+				}
+				if (next_upper >= -1 && next_upper < from) {
+					next_upper = find_byte (data, from, last+1, upper);
+					if (next_upper < 0) {
+						next_upper = -2;
+					}
+				}
+				int found;
+				if (next_lower < 0) {
+					found = next_upper;
+				} else if (next_upper < 0) {
+					found = next_lower;
+				} else {
+					found = int.min (next_lower, next_upper);
+				}
+				if (found < 0) {
+					return -1;
+				}
+
+				var i = 1;
+				while (i < needle.length && ((char) data[found+i]).tolower () == needle[i]) {
+					i++;
+				}
+				if (i == needle.length) {
+					return found;
+				}
+				from = found+1;
+			}
+			return -1;
+		}
+
+		static int find_byte (uint8[] data, int from, int to, uint8 c) {
+			if (from >= to) {
+				return -1;
+			}
+			uint8* found = memchr (&data[from], c, to-from);
+			if (found == null) {
+				return -1;
+			}
+			return (int) (found - (uint8*) data);
+		}
+
+		static int find_bytes (uint8[] data, int from, uint8[] needle) {
+			var last = data.length-needle.length;
+			while (from <= last) {
+				var found = find_byte (data, from, last+1, needle[0]);
+				if (found < 0) {
+					return -1;
+				}
+				if (Memory.cmp (&data[found], needle, needle.length) == 0) {
+					return found;
+				}
+				from = found+1;
+			}
+			return -1;
+		}
+
+		/* Lists the files under dir, relative to it, skipping the ones excluded by .gitignore files */
+		public static string[] list_files (string dir, Cancellable? cancellable = null) throws Error {
+			string[] res = {};
+			walk (dir, "", new GenericArray<IgnoreRule> (), ref res, cancellable);
+			return res;
+		}
+
+		public static async string[] list_files_async (string dir, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			string[] res = null;
+			yield run_in_thread<Object?> (() => {
+					res = list_files (dir, cancellable);
+					return null;
+			}, io_priority);
+			return res;
+		}
+
+		class IgnoreRule {
+			public PatternSpec spec;
+			// relative to the searched dir, where the .gitignore is
+			public string base_dir;
+			public bool negate;
+			public bool dir_only;
+			// match the path relative to base_dir rather than the name
+			public bool anchored;
+
+			public bool match (string path, string name, bool is_dir) {
+				if (dir_only && !is_dir) {
+					return false;
+				}
+				if (!anchored) {
+					return spec.match_string (name);
+				}
+				if (base_dir != "" && !path.has_prefix (base_dir+"/")) {
+					return false;
+				}
+				return spec.match_string (base_dir != "" ? path.substring (base_dir.length+1) : path);
+			}
+		}
+
+		static void walk (string root, string rel, GenericArray<IgnoreRule> inherited, ref string[] res, Cancellable? cancellable) throws Error {
+			cancellable.set_error_if_cancelled ();
+			var dir = Path.build_filename (root, rel);
+			var rules = inherited;
+			var ignore = Path.build_filename (dir, ".gitignore");
+			if (FileUtils.test (ignore, FileTest.IS_REGULAR)) {
+				try {
+					string ignore_contents;
+					FileUtils.get_contents (ignore, out ignore_contents);
+					rules = new GenericArray<IgnoreRule> ();
+					foreach (var rule in inherited.data) {
+						rules.add (rule);
+					}
+					parse_ignore (ignore_contents, rel, rules);
+				} catch (Error e) {
+				}
+			}
+
+			Dir handle;
+			try {
+				handle = Dir.open (dir);
+			} catch (Error e) {
+				return;
+			}
+
+			unowned string? name;
+			while ((name = handle.read_name ()) != null) {
+				if (name == ".git") {
+					continue;
+				}
+				var path = rel == "" ? name : rel+"/"+name;
+				var filename = Path.build_filename (dir, name);
+				// don't follow links to directories, they may loop
+				var is_dir = FileUtils.test (filename, FileTest.IS_DIR) && !FileUtils.test (filename, FileTest.IS_SYMLINK);
+
+				var ignored = false;
+				foreach (var rule in rules.data) {
+					if (rule.match (path, name, is_dir)) {
+						ignored = !rule.negate;
+					}
+				}
+				if (ignored) {
+					continue;
+				}
+
+				if (is_dir) {
+					walk (root, path, rules, ref res, cancellable);
+				} else if (FileUtils.test (filename, FileTest.IS_REGULAR)) {
+					res += path;
+				}
+			}
+		}
+
+		static void parse_ignore (string contents, string base_dir, GenericArray<IgnoreRule> rules) {
+			foreach (var line in contents.split ("\n")) {
+				var pat = line.strip ();
+				if (pat == "" || pat[0] == '#') {
+					continue;
+				}
+
+				var rule = new IgnoreRule ();
+				rule.base_dir = base_dir;
+				if (pat[0] == '!') {
+					rule.negate = true;
+					pat = pat.substring (1);
+				}
+				if (pat.has_suffix ("/")) {
+					rule.dir_only = true;
+					pat = pat.substring (0, pat.length-1);
+				}
+				rule.anchored = "/" in pat;
+				if (pat.has_prefix ("/")) {
+					pat = pat.substring (1);
+				}
+				if (pat == "") {
+					continue;
+				}
+				rule.spec = new PatternSpec (pat);
+				rules.add (rule);
+			}
+		}
+	}
+}
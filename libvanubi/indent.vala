@@ -32,6 +32,60 @@ namespace Vanubi {
 
 		public abstract void indent (BufferIter iter);
 
+		/* Returns the indenter for the given language id, or null if the language is not indented */
+		public static Indent? for_language (string? lang_id, Buffer buffer) {
+			if (lang_id == null) {
+				return null;
+			}
+
+			switch (lang_id) {
+			case "assembly (intel)":
+			case "i386 assembly":
+				return new Indent_Asm (buffer);
+			case "html":
+			case "xml":
+				return new Indent_Markup (buffer);
+			case "lua":
+				return new Indent_Lua (buffer);
+			case "haskell":
+				return new Indent_Haskell (buffer);
+			case "python":
+				return new Indent_Python (buffer);
+			case "makefile":
+				return null;
+			default:
+				return new Indent_C (buffer);
+			}
+		}
+
+		/* Computes the indent of the given lines as if they were indented one after the other,
+		 * without modifying the buffer */
+		public int[] compute_indents (int start_line, int end_line) {
+			var real = buffer;
+			var overlay = new IndentOverlay (real, start_line, end_line);
+			buffer = overlay;
+			for (var line=start_line; line <= end_line; line++) {
+				indent (real.line_start (line));
+			}
+			buffer = real;
+			return overlay.indents;
+		}
+
+		/* Reindents the given lines, only modifying the lines whose indent changes.
+		 * Returns the number of modified lines. */
+		public int reindent_lines (int start_line, int end_line) {
+			var indents = compute_indents (start_line, end_line);
+			var changed = 0;
+			for (var line=start_line; line <= end_line; line++) {
+				var indent = indents[line-start_line];
+				if (buffer.get_indent (line) != indent) {
+					buffer.set_indent (line, indent);
+					changed++;
+				}
+			}
+			return changed;
+		}
+
 		// utils
 		protected int first_non_empty_prev_line (int line) {
 			// find first non-blank prev line, excluding line
@@ -39,14 +93,23 @@ namespace Vanubi {
 			while (--line >= 0 && buf.empty_line (line));
 			return line;
 		}
-	}
 
-	public class Indent_C : Indent {
-		public Indent_C (Buffer buffer) {
-			base (buffer);
+		/* Identifies the brackets recognized by the engine, engines with the same kind share the bracket cache */
+		protected virtual string bracket_kind {
+			get {
+				return "none";
+			}
+		}
+
+		internal virtual bool is_open_paren (BufferIter iter) {
+			return false;
 		}
 
-		bool is_char (BufferIter iter) {
+		internal virtual bool is_close_paren (BufferIter iter) {
+			return false;
+		}
+
+		protected bool is_char (BufferIter iter) {
 			if (!iter.is_in_code) {
 				return false;
 			}
@@ -62,55 +125,37 @@ namespace Vanubi {
 			return false;
 		}
 
-		bool is_open_paren (BufferIter iter) {
-			var c = iter.char;
-			return (c == '{' || c == '[' || c == '(') && iter.is_in_code && !is_char (iter);
-		}
-
-		bool is_close_paren (BufferIter iter) {
-			var c = iter.char;
-			return (c == '}' || c == ']' || c == ')') && iter.is_in_code && !is_char (iter);
+		BracketCache brackets {
+			owned get {
+				var cache = buffer.bracket_cache;
+				if (cache == null || cache.kind != bracket_kind) {
+					cache = new BracketCache (bracket_kind);
+					buffer.bracket_cache = cache;
+				}
+				return cache;
+			}
 		}
 
 		// counts closed parens in front of a line
-		int count_closed (int line) {
-			var buf = buffer;
-			var closed = 0;
-			var iter = buf.line_start (line);
-			while (!iter.eol) {
-				var c = iter.char;
-				if (is_close_paren (iter)) {
-					closed++;
-				} else if (!c.isspace ()) {
-					break;
-				}
-				iter.forward_char ();
-			}
-			return closed;
+		protected int count_closed (int line) {
+			return brackets.get_state (this, line).closed;
 		}
 
 		// counts unclosed parens in a line
-		int count_unclosed (int line) {
-			var buf = buffer;
-			var unclosed = 0;
-			var iter = buf.line_start (line);
-			while (!iter.eol) {
-				if (is_open_paren (iter)) {
-					unclosed++;
-				} else if (is_close_paren (iter)) {
-					if (unclosed > 0) {
-						unclosed--;
-					}
-				}
-				iter.forward_char ();
-			}
-			return unclosed;
+		protected int count_unclosed (int line) {
+			return brackets.get_state (this, line).unclosed;
 		}
 
 		// returns the iter for the opened paren for which there's a given unbalance
-		BufferIter unclosed_paren (int line, int unbalance) {
+		protected BufferIter unclosed_paren (int line, int unbalance) {
+			int offset;
+			var opener = brackets.find_opener (this, line, unbalance, out offset);
+			if (opener >= 0) {
+				return buffer.line_at_char (opener, offset);
+			}
+
+			// unbalanced brackets, walk back the lines
 			var buf = buffer;
-			// find line that is semantically opening the paren
 			int balance = 0;
 			var iter = buf.line_start (line);
 			var paren_iter = iter;
@@ -138,6 +183,281 @@ namespace Vanubi {
 				}
 			}
 		}
+	}
+
+	/* Records the indent of a range of lines instead of modifying the wrapped buffer */
+	class IndentOverlay : Buffer {
+		Buffer buffer;
+		int start_line;
+		public int[] indents;
+
+		public IndentOverlay (Buffer buffer, int start_line, int end_line) {
+			this.buffer = buffer;
+			this.start_line = start_line;
+			indents = new int[end_line-start_line+1];
+			for (var i=0; i < indents.length; i++) {
+				indents[i] = buffer.get_indent (start_line+i);
+			}
+		}
+
+		public override int tab_width {
+			get {
+				return buffer.tab_width;
+			}
+			set {
+				buffer.tab_width = value;
+			}
+		}
+
+		public override IndentMode indent_mode {
+			get {
+				return buffer.indent_mode;
+			}
+			set {
+				buffer.indent_mode = value;
+			}
+		}
+
+		// the text is not modified, the brackets are the same
+		public override BracketCache? bracket_cache {
+			get {
+				return buffer.bracket_cache;
+			}
+			set {
+				buffer.bracket_cache = value;
+			}
+		}
+
+		public override BufferIter line_start (int line) {
+			return buffer.line_start (line);
+		}
+
+		public override BufferIter line_end (int line) {
+			return buffer.line_end (line);
+		}
+
+		public override BufferIter line_at_char (int line, int line_offset) {
+			return buffer.line_at_char (line, line_offset);
+		}
+
+		public override BufferIter line_at_byte (int line, int line_offset) {
+			return buffer.line_at_byte (line, line_offset);
+		}
+
+		public override void insert (BufferIter iter, string text) {
+			warning ("Cannot insert text while computing the indentation");
+		}
+
+		public override void delete (BufferIter start, BufferIter end) {
+			warning ("Cannot delete text while computing the indentation");
+		}
+
+		public override string line_text (int line) {
+			return buffer.line_text (line);
+		}
+
+		public override bool empty_line (int line) {
+			return buffer.empty_line (line);
+		}
+
+		bool in_range (int line) {
+			return line >= start_line && line < start_line+indents.length;
+		}
+
+		public override void set_indent (int line, int indent) {
+			if (in_range (line)) {
+				indents[line-start_line] = int.max (indent, 0);
+			}
+		}
+
+		public override int get_indent (int line) {
+			return in_range (line) ? indents[line-start_line] : buffer.get_indent (line);
+		}
+
+		// the iter is after the indentation of the line
+		public override int effective_line_offset (BufferIter iter) {
+			var offset = buffer.effective_line_offset (iter);
+			var line = iter.line;
+			if (in_range (line)) {
+				offset += indents[line-start_line] - buffer.get_indent (line);
+			}
+			return offset;
+		}
+	}
+
+	/* Bracket state of a line */
+	public struct LineBrackets {
+		public bool empty;
+		// balance of the previous lines
+		public int depth;
+		// balance of the line
+		public int balance;
+		// brackets left open by the line
+		public int unclosed;
+		// brackets closed in front of the line
+		public int closed;
+		// char offset of the last bracket opened to the final balance of the line, or -1
+		public int opener;
+	}
+
+	/* Bracket balance of each line of a buffer, shared by the indentation engines.
+	 * Lines are scanned forward once, so that finding the line opening a bracket is a lookup
+	 * instead of a walk back through the buffer. Editing a line invalidates it and the lines below. */
+	public class BracketCache {
+		// non-empty lines starting at a given depth, in order
+		class DepthLines {
+			public int[] lines = new int[8];
+			public int length;
+
+			public void append (int line) {
+				if (length == lines.length) {
+					lines.resize (length*2);
+				}
+				lines[length++] = line;
+			}
+
+			// last line before or equal the given line, or -1
+			public int find (int line) {
+				int lo = 0, hi = length;
+				while (lo < hi) {
+					var mid = (lo+hi)/2;
+					if (lines[mid] <= line) {
+						lo = mid+1;
+					} else {
+						hi = mid;
+					}
+				}
+				return lo > 0 ? lines[lo-1] : -1;
+			}
+		}
+
+		public string kind { get; private set; }
+		LineBrackets[] states = new LineBrackets[64];
+		int n_states;
+		HashTable<int, DepthLines> depth_lines = new HashTable<int, DepthLines> (direct_hash, direct_equal);
+
+		public BracketCache (string kind) {
+			this.kind = kind;
+		}
+
+		public void invalidate (int line) {
+			line = int.max (line, 0);
+			while (n_states > line) {
+				n_states--;
+				if (!states[n_states].empty) {
+					var lines = depth_lines[states[n_states].depth];
+					lines.length--;
+				}
+			}
+		}
+
+		public LineBrackets get_state (Indent indent, int line) {
+			update (indent, line);
+			return states[line];
+		}
+
+		/* Returns the line of the paren opened with the given unbalance at the end of line,
+		 * or -1 if the backward search would not stop at a bracket of that line. */
+		public int find_opener (Indent indent, int line, int unbalance, out int offset) {
+			offset = 0;
+			update (indent, line);
+			var depth = states[line].depth + states[line].balance - unbalance;
+			var lines = depth_lines[depth];
+			var opener = lines != null ? lines.find (line) : -1;
+			if (opener < 0) {
+				return -1;
+			}
+			if (states[opener].opener >= 0) {
+				offset = states[opener].opener;
+				return opener;
+			}
+			// the paren is searched from the start of the line
+			return opener == line ? line : -1;
+		}
+
+		void update (Indent indent, int line) {
+			if (line < n_states) {
+				return;
+			}
+			if (line >= states.length) {
+				states.resize (int.max (line+1, states.length*2));
+			}
+
+			var buf = indent.buffer;
+			for (var i=n_states; i <= line; i++) {
+				LineBrackets state = LineBrackets ();
+				state.depth = i > 0 ? states[i-1].depth+states[i-1].balance : 0;
+				state.empty = buf.empty_line (i);
+				state.opener = -1;
+				if (!state.empty) {
+					scan_line (indent, i, ref state);
+					var lines = depth_lines[state.depth];
+					if (lines == null) {
+						lines = new DepthLines ();
+						depth_lines[state.depth] = lines;
+					}
+					lines.append (i);
+				}
+				states[i] = state;
+			}
+			n_states = line+1;
+		}
+
+		void scan_line (Indent indent, int line, ref LineBrackets state) {
+			// offset and balance of each opened paren
+			int[] opened = {};
+			var leading = true;
+			var iter = indent.buffer.line_start (line);
+			while (!iter.eol) {
+				if (indent.is_open_paren (iter)) {
+					state.balance++;
+					state.unclosed++;
+					opened += iter.line_offset;
+					opened += state.balance;
+					leading = false;
+				} else if (indent.is_close_paren (iter)) {
+					state.balance--;
+					if (state.unclosed > 0) {
+						state.unclosed--;
+					}
+					if (leading) {
+						state.closed++;
+					}
+				} else if (!iter.char.isspace ()) {
+					leading = false;
+				}
+				iter.forward_char ();
+			}
+
+			for (var i=opened.length-2; i >= 0; i -= 2) {
+				if (opened[i+1] == state.balance) {
+					state.opener = opened[i];
+					break;
+				}
+			}
+		}
+	}
+
+	public class Indent_C : Indent {
+		public Indent_C (Buffer buffer) {
+			base (buffer);
+		}
+
+		protected override string bracket_kind {
+			get {
+				return "c";
+			}
+		}
+
+		internal override bool is_open_paren (BufferIter iter) {
+			var c = iter.char;
+			return (c == '{' || c == '[' || c == '(') && iter.is_in_code && !is_char (iter);
+		}
+
+		internal override bool is_close_paren (BufferIter iter) {
+			var c = iter.char;
+			return (c == '}' || c == ']' || c == ')') && iter.is_in_code && !is_char (iter);
+		}
 
 		public override void indent (BufferIter indent_iter) {
 			var buf = buffer;
@@ -188,7 +508,7 @@ namespace Vanubi {
 				if (paren_iter.line != prev_line || paren_iter.eol || paren_iter.line > prev_line) {
 					new_indent = buf.get_indent (paren_iter.line) + unclosed * tab_width;
 				} else {
-					new_indent = paren_iter.effective_line_offset-1;
+					new_indent = buf.effective_line_offset (paren_iter)-1;
 				}
 			}
 
@@ -227,99 +547,22 @@ namespace Vanubi {
 			base (buffer);
 		}
 
-		bool is_char (BufferIter iter) {
-			if (!iter.is_in_code) {
-				return false;
+		protected override string bracket_kind {
+			get {
+				return "python";
 			}
-			var cp = iter.copy ();
-			cp.backward_char ();
-			if (cp.char == '\'') {
-				cp = iter.copy ();
-				cp.forward_char ();
-				if (cp.char == '\'') {
-					return true;
-				}
-			}
-			return false;
 		}
 
-		bool is_open_paren (BufferIter iter) {
+		internal override bool is_open_paren (BufferIter iter) {
 			var c = iter.char;
 			return (c == '{' || c == '[' || c == '(') && iter.is_in_code && !is_char (iter);
 		}
 
-		bool is_close_paren (BufferIter iter) {
+		internal override bool is_close_paren (BufferIter iter) {
 			var c = iter.char;
 			return (c == '}' || c == ']' || c == ')') && iter.is_in_code && !is_char (iter);
 		}
 
-		// counts closed parens in front of a line
-		int count_closed (int line) {
-			var buf = buffer;
-			var closed = 0;
-			var iter = buf.line_start (line);
-			while (!iter.eol) {
-				var c = iter.char;
-				if (is_close_paren (iter)) {
-					closed++;
-				} else if (!c.isspace ()) {
-					break;
-				}
-				iter.forward_char ();
-			}
-			return closed;
-		}
-
-		// counts unclosed parens in a line
-		int count_unclosed (int line) {
-			var buf = buffer;
-			var unclosed = 0;
-			var iter = buf.line_start (line);
-			while (!iter.eol) {
-				if (is_open_paren (iter)) {
-					unclosed++;
-				} else if (is_close_paren (iter)) {
-					if (unclosed > 0) {
-						unclosed--;
-					}
-				}
-				iter.forward_char ();
-			}
-			return unclosed;
-		}
-
-		// returns the iter for the opened paren for which there's a given unbalance
-		BufferIter unclosed_paren (int line, int unbalance) {
-			var buf = buffer;
-			// find line that is semantically opening the paren
-			int balance = 0;
-			var iter = buf.line_start (line);
-			var paren_iter = iter;
-			while (true) {
-				if (is_open_paren (iter)) {
-					balance++;
-					if (balance == unbalance) {
-						paren_iter = iter.copy ();
-					}
-				} else if (is_close_paren (iter)) {
-					balance--;
-				}
-				if (iter.eol) {
-					if (balance == unbalance) {
-						return paren_iter;
-					}
-					line = first_non_empty_prev_line (line);
-					if (line < 0) {
-						// not found
-						return iter;
-					}
-					iter = buf.line_start (line);
-				} else {
-					iter.forward_char ();
-				}
-			}
-		}
-
 		public override void indent (BufferIter indent_iter) {
 			var buf = buffer;
 
@@ -357,7 +600,7 @@ namespace Vanubi {
 				if (paren_iter.line != prev_line || paren_iter.eol || paren_iter.line > prev_line) {
 					new_indent = buf.get_indent (paren_iter.line) + unclosed * tab_width;
 				} else {
-					new_indent = paren_iter.effective_line_offset-1;
+					new_indent = buf.effective_line_offset (paren_iter)-1;
 				}
 			}
 
@@ -384,7 +627,13 @@ namespace Vanubi {
 			base (buffer);
 		}
 
-		bool is_open_tag (BufferIter iter) {
+		protected override string bracket_kind {
+			get {
+				return "markup";
+			}
+		}
+
+		internal override bool is_open_paren (BufferIter iter) {
 			if (!iter.is_in_code) {
 				return false;
 			}
@@ -396,7 +645,7 @@ namespace Vanubi {
 			return cp.is_in_code && cp.char != '!' && cp.char != '/';
 		}
 
-		bool is_close_tag (BufferIter iter) {
+		internal override bool is_close_paren (BufferIter iter) {
 			if (!iter.is_in_code) {
 				return false;
 			}
@@ -413,73 +662,6 @@ namespace Vanubi {
 			return false;
 		}
 
-		// counts closed parens in front of a line
-		int count_closed (int line) {
-			var buf = buffer;
-			var closed = 0;
-			var iter = buf.line_start (line);
-			while (!iter.eol) {
-				var c = iter.char;
-				if (is_close_tag (iter)) {
-					closed++;
-				} else if (!c.isspace ()) {
-					break;
-				}
-				iter.forward_char ();
-			}
-			return closed;
-		}
-
-		// counts unclosed parens in a line
-		int count_unclosed (int line) {
-			var buf = buffer;
-			var unclosed = 0;
-			var iter = buf.line_start (line);
-			while (!iter.eol) {
-				if (is_open_tag (iter)) {
-					unclosed++;
-				} else if (is_close_tag (iter)) {
-					if (unclosed > 0) {
-						unclosed--;
-					}
-				}
-				iter.forward_char ();
-			}
-			return unclosed;
-		}
-
-		// returns the iter for the opened paren for which there's a given unbalance
-		BufferIter unclosed_paren (int line, int unbalance) {
-			var buf = buffer;
-			// find line that is semantically opening the paren
-			int balance = 0;
-			var iter = buf.line_start (line);
-			var paren_iter = iter;
-			while (true) {
-				if (is_open_tag (iter)) {
-					balance++;
-					if (balance == unbalance) {
-						paren_iter = iter.copy ();
-					}
-				} else if (is_close_tag (iter)) {
-					balance--;
-				}
-				if (iter.eol) {
-					if (balance == unbalance) {
-						return paren_iter;
-					}
-					line = first_non_empty_prev_line (line);
-					if (line < 0) {
-						// not found
-						return iter;
-					}
-					iter = buf.line_start (line);
-				} else {
-					iter.forward_char ();
-				}
-			}
-		}
-
 		public override void indent (BufferIter indent_iter) {
 			var buf = buffer;
 
@@ -515,7 +697,7 @@ namespace Vanubi {
 				if (paren_iter.line != prev_line || paren_iter.eol || paren_iter.line > prev_line) {
 					new_indent = buf.get_indent (paren_iter.line) + unclosed * tab_width;
 				} else {
-					new_indent = paren_iter.effective_line_offset-1;
+					new_indent = buf.effective_line_offset (paren_iter)-1;
 				}
 			}
 
@@ -557,83 +739,22 @@ namespace Vanubi {
 			base (buffer);
 		}
 
-		bool is_open_paren (BufferIter iter) {
+		protected override string bracket_kind {
+			get {
+				return "lua";
+			}
+		}
+
+		internal override bool is_open_paren (BufferIter iter) {
 			var c = iter.char;
 			return (c == '{' || c == '[' || c == '(') && iter.is_in_code;
 		}
 
-		bool is_close_paren (BufferIter iter) {
+		internal override bool is_close_paren (BufferIter iter) {
 			var c = iter.char;
 			return (c == '}' || c == ']' || c == ')') && iter.is_in_code;
 		}
 
-		// counts closed parens in front of a line
-		int count_closed (int line) {
-			var buf = buffer;
-			var closed = 0;
-			var iter = buf.line_start (line);
-			while (!iter.eol) {
-				var c = iter.char;
-				if (is_close_paren (iter)) {
-					closed++;
-				} else if (!c.isspace ()) {
-					break;
-				}
-				iter.forward_char ();
-			}
-			return closed;
-		}
-
-		// counts unclosed parens in a line
-		int count_unclosed (int line) {
-			var buf = buffer;
-			var unclosed = 0;
-			var iter = buf.line_start (line);
-			while (!iter.eol) {
-				if (is_open_paren (iter)) {
-					unclosed++;
-				} else if (is_close_paren (iter)) {
-					if (unclosed > 0) {
-						unclosed--;
-					}
-				}
-				iter.forward_char ();
-			}
-			return unclosed;
-		}
-
-		// returns the iter for the opened paren for which there's a given unbalance
-		BufferIter unclosed_paren (int line, int unbalance) {
-			var buf = buffer;
-			// find line that is semantically opening the paren
-			int balance = 0;
-			var iter = buf.line_start (line);
-			var paren_iter = iter;
-			while (true) {
-				if (is_open_paren (iter)) {
-					balance++;
-					if (balance == unbalance) {
-						paren_iter = iter.copy ();
-					}
-				} else if (is_close_paren (iter)) {
-					balance--;
-				}
-				if (iter.eol) {
-					if (balance == unbalance) {
-						return paren_iter;
-					}
-					line = first_non_empty_prev_line (line);
-					if (line < 0) {
-						// not found
-						return iter;
-					}
-					iter = buf.line_start (line);
-				} else {
-					iter.forward_char ();
-				}
-			}
-		}
-
 		public override void indent (BufferIter indent_iter) {
 			var buf = buffer;
 
@@ -671,7 +792,7 @@ namespace Vanubi {
 				if (paren_iter.line != prev_line || paren_iter.eol || paren_iter.line > prev_line) {
 					new_indent = buf.get_indent (paren_iter.line) + unclosed * tab_width;
 				} else {
-					new_indent = paren_iter.effective_line_offset-1;
+					new_indent = buf.effective_line_offset (paren_iter)-1;
 				}
 			}
 
@@ -705,83 +826,22 @@ namespace Vanubi {
 			base (buffer);
 		}
 
-		bool is_open_paren (BufferIter iter) {
+		protected override string bracket_kind {
+			get {
+				return "haskell";
+			}
+		}
+
+		internal override bool is_open_paren (BufferIter iter) {
 			var c = iter.char;
 			return (c == '{' || c == '[' || c == '(') && iter.is_in_code;
 		}
 
-		bool is_close_paren (BufferIter iter) {
+		internal override bool is_close_paren (BufferIter iter) {
 			var c = iter.char;
 			return (c == '}' || c == ']' || c == ')') && iter.is_in_code;
 		}
 
-		// counts closed parens in front of a line
-		int count_closed (int line) {
-			var buf = buffer;
-			var closed = 0;
-			var iter = buf.line_start (line);
-			while (!iter.eol) {
-				var c = iter.char;
-				if (is_close_paren (iter)) {
-					closed++;
-				} else if (!c.isspace ()) {
-					break;
-				}
-				iter.forward_char ();
-			}
-			return closed;
-		}
-
-		// counts unclosed parens in a line
-		int count_unclosed (int line) {
-			var buf = buffer;
-			var unclosed = 0;
-			var iter = buf.line_start (line);
-			while (!iter.eol) {
-				if (is_open_paren (iter)) {
-					unclosed++;
-				} else if (is_close_paren (iter)) {
-					if (unclosed > 0) {
-						unclosed--;
-					}
-				}
-				iter.forward_char ();
-			}
-			return unclosed;
-		}
-
-		// returns the iter for the opened paren for which there's a given unbalance
-		BufferIter unclosed_paren (int line, int unbalance) {
-			var buf = buffer;
-			// find line that is semantically opening the paren
-			int balance = 0;
-			var iter = buf.line_start (line);
-			var paren_iter = iter;
-			while (true) {
-				if (is_open_paren (iter)) {
-					balance++;
-					if (balance == unbalance) {
-						paren_iter = iter.copy ();
-					}
-				} else if (is_close_paren (iter)) {
-					balance--;
-				}
-				if (iter.eol) {
-					if (balance == unbalance) {
-						return paren_iter;
-					}
-					line = first_non_empty_prev_line (line);
-					if (line < 0) {
-						// not found
-						return iter;
-					}
-					iter = buf.line_start (line);
-				} else {
-					iter.forward_char ();
-				}
-			}
-		}
-
 		public override void indent (BufferIter indent_iter) {
 			var buf = buffer;
 
@@ -817,7 +877,7 @@ namespace Vanubi {
 				if (paren_iter.line != prev_line || paren_iter.eol || paren_iter.line > prev_line) {
 					new_indent = buf.get_indent (paren_iter.line) + unclosed * tab_width;
 				} else {
-					new_indent = paren_iter.effective_line_offset-1;
+					new_indent = buf.effective_line_offset (paren_iter)-1;
 				}
 			}
 
@@ -846,7 +906,7 @@ namespace Vanubi {
 					while (idx < len && prev_text[idx].isspace ()) idx++;
 
 					var iter = buf.line_at_byte (prev_line, idx);
-					new_indent = iter.effective_line_offset;
+					new_indent = buf.effective_line_offset (iter);
 				}
 			}
 
@@ -0,0 +1,250 @@
+/*
+ *  Copyright © 2014 Luca Bruno
+ *
+ *  This file is part of Vanubi.
+ *
+ *  Vanubi is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Vanubi is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Vanubi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+namespace Vanubi {
+	/* Comment and string delimiters of a language, enough to tell code apart without syntax highlighting */
+	public class CodeSyntax {
+		public string? line_comment;
+		public string? block_start;
+		public string? block_end;
+		// characters opening and closing a string
+		public string quotes;
+		public char escape = '\\';
+
+		public CodeSyntax (string? line_comment, string? block_start, string? block_end, string quotes) {
+			this.line_comment = line_comment;
+			this.block_start = block_start;
+			this.block_end = block_end;
+			this.quotes = quotes;
+		}
+
+		/* Returns null for languages whose syntax is unknown */
+		public static CodeSyntax? for_language (string? lang_id) {
+			switch (lang_id) {
+			case "c":
+			case "chdr":
+			case "cpp":
+			case "vala":
+			case "js":
+			case "java":
+			case "c-sharp":
+			case "php":
+			case "go":
+				return new CodeSyntax ("//", "/*", "*/", "\"'");
+			case "css":
+				return new CodeSyntax (null, "/*", "*/", "\"'");
+			case "sh":
+				return new CodeSyntax ("#", null, null, "\"'");
+			case "lua":
+				return new CodeSyntax ("--", "--[[", "]]", "\"'");
+			case "haskell":
+				// the quote is also part of identifiers
+				return new CodeSyntax ("--", "{-", "-}", "\"");
+			case "html":
+			case "xml":
+				return new CodeSyntax (null, "<!--", "-->", "");
+			case "assembly (intel)":
+				return new CodeSyntax (";", "/*", "*/", "\"");
+			case "i386 assembly":
+				return new CodeSyntax ("#", "/*", "*/", "\"");
+			default:
+				return null;
+			}
+		}
+	}
+
+	/* Maps file names to the language ids of the editor without GTK. Reads the globs of the
+	 * GtkSourceView language specs when installed, otherwise falls back to a builtin table. */
+	public class Languages {
+		static Languages instance;
+
+		class Spec {
+			public string id;
+			public PatternSpec[] globs = new PatternSpec[0];
+		}
+
+		Spec[] specs = new Spec[0];
+
+		public static Languages get_default () {
+			lock (instance) {
+				if (instance == null) {
+					instance = new Languages ();
+				}
+			}
+			return instance;
+		}
+
+		Languages () {
+			// same search path of the editor, earlier directories win
+			string[] dirs = { Path.build_filename (Environment.get_user_data_dir (), "gtksourceview-3.0", "language-specs") };
+			foreach (unowned string dir in Environment.get_system_data_dirs ()) {
+				dirs += Path.build_filename (dir, "gtksourceview-3.0", "language-specs");
+			}
+			dirs += "./data/languages/";
+			dirs += Configuration.VANUBI_DATADIR + "/vanubi/languages";
+
+			var seen = new HashTable<string, Spec> (str_hash, str_equal);
+			foreach (var dir in dirs) {
+				try {
+					var d = Dir.open (dir);
+					unowned string name;
+					while ((name = d.read_name ()) != null) {
+						if (name.has_suffix (".lang")) {
+							var spec = read_spec (Path.build_filename (dir, name));
+							if (spec != null && !(spec.id in seen)) {
+								seen[spec.id] = spec;
+							}
+						}
+					}
+				} catch (Error e) {
+					// not installed
+				}
+			}
+
+			// like GtkSourceView, the first matching id in alphabetical order wins
+			var ids = seen.get_keys ();
+			ids.sort (strcmp);
+			foreach (var id in ids) {
+				specs += seen[id];
+			}
+		}
+
+		static string unescape (string s) {
+			return s.replace ("&lt;", "<").replace ("&gt;", ">").replace ("&quot;", "\"").replace ("&apos;", "'").replace ("&amp;", "&");
+		}
+
+		/* Only the header and the metadata are read, in both the 1.0 and 2.0 formats */
+		static Spec? read_spec (string path) {
+			string contents;
+			try {
+				FileUtils.get_contents (path, out contents);
+				var metadata_end = contents.index_of ("</metadata>");
+				if (metadata_end >= 0) {
+					contents = contents.substring (0, metadata_end);
+				}
+
+				MatchInfo info;
+				if (!/<language\s[^>]*>/.match (contents, 0, out info)) {
+					return null;
+				}
+				var header = info.fetch (0);
+				var spec = new Spec ();
+				if (/\sid="([^"]+)"/.match (header, 0, out info)) {
+					spec.id = info.fetch (1);
+				} else if (/\s_?name="([^"]+)"/.match (header, 0, out info)) {
+					// 1.0 format
+					spec.id = unescape (info.fetch (1)).down ();
+				} else {
+					return null;
+				}
+
+				string globs = null;
+				if (/<property\s+name="globs">([^<]*)</.match (contents, 0, out info)) {
+					globs = info.fetch (1);
+				} else if (/\sglobs="([^"]*)"/.match (header, 0, out info)) {
+					globs = info.fetch (1);
+				}
+				if (globs != null) {
+					foreach (unowned string glob in unescape (globs).split (";")) {
+						if (glob != "") {
+							spec.globs += new PatternSpec (glob);
+						}
+					}
+				}
+				return spec;
+			} catch (Error e) {
+				return null;
+			}
+		}
+
+		/* Returns the language id for the file name, or null if unknown */
+		public string? language_for_file (string path) {
+			var basename = Path.get_basename (path);
+			foreach (var spec in specs) {
+				foreach (unowned PatternSpec glob in spec.globs) {
+					if (glob.match_string (basename)) {
+						return spec.id;
+					}
+				}
+			}
+			return builtin_language (basename);
+		}
+
+		static string? builtin_language (string basename) {
+			if (basename == "Makefile" || basename == "GNUmakefile" || basename.has_suffix (".mk") || basename.has_suffix (".am")) {
+				return "makefile";
+			}
+
+			var dot = basename.last_index_of_char ('.');
+			if (dot < 0) {
+				return null;
+			}
+			switch (basename.substring (dot+1)) {
+			case "c":
+				return "c";
+			case "h":
+				return "chdr";
+			case "cc":
+			case "cpp":
+			case "cxx":
+			case "hh":
+			case "hpp":
+				return "cpp";
+			case "vala":
+			case "vapi":
+				return "vala";
+			case "js":
+				return "js";
+			case "java":
+				return "java";
+			case "cs":
+				return "c-sharp";
+			case "php":
+				return "php";
+			case "go":
+				return "go";
+			case "css":
+				return "css";
+			case "sh":
+			case "bash":
+				return "sh";
+			case "py":
+				return "python";
+			case "lua":
+				return "lua";
+			case "hs":
+				return "haskell";
+			case "html":
+			case "htm":
+				return "html";
+			case "xml":
+			case "ui":
+				return "xml";
+			case "asm":
+			case "s":
+			case "nasm":
+				return "assembly (intel)";
+			case "S":
+				return "i386 assembly";
+			default:
+				return null;
+			}
+		}
+	}
+}
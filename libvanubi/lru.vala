@@ -18,54 +18,203 @@
  */
 
 namespace Vanubi {
+	public delegate void EvictFunc<G> (G item);
+
+	class LRUNode<G> {
+		public G data;
+		// the nodes are owned by the hash table
+		public unowned LRUNode<G>? prev;
+		public unowned LRUNode<G>? next;
+
+		public LRUNode (G data) {
+			this.data = data;
+		}
+	}
+
+	/* The actual storage of an LRU, shared among copies until either of them is modified */
+	class LRUStore<G> {
+		public HashTable<G, LRUNode<G>> nodes;
+		public unowned LRUNode<G>? head;
+		public unowned LRUNode<G>? tail;
+		public int users = 1;
+
+		public LRUStore (HashFunc<G> hash, EqualFunc<G> equal) {
+			nodes = new HashTable<G, LRUNode<G>> (hash, equal);
+		}
+
+		public uint length {
+			get {
+				return nodes.size ();
+			}
+		}
+
+		public void link_head (LRUNode<G> node) {
+			node.next = head;
+			if (head != null) {
+				head.prev = node;
+			} else {
+				tail = node;
+			}
+			head = node;
+		}
+
+		public void push_tail (G data) {
+			var node = new LRUNode<G> (data);
+			node.prev = tail;
+			if (tail != null) {
+				tail.next = node;
+			} else {
+				head = node;
+			}
+			tail = node;
+			nodes[data] = node;
+		}
+
+		public void unlink (LRUNode<G> node) {
+			if (node.prev != null) {
+				node.prev.next = node.next;
+			} else {
+				head = node.next;
+			}
+			if (node.next != null) {
+				node.next.prev = node.prev;
+			} else {
+				tail = node.prev;
+			}
+			node.prev = null;
+			node.next = null;
+		}
+	}
+
 	// last recently used
 	public class LRU<G> {
-		List<G> lru = new List<G> ();
-		unowned CompareFunc<G> compare;
+		LRUStore<G> store;
+		unowned HashFunc<G> hash;
+		unowned EqualFunc<G> equal;
+		EvictFunc<G>? evict_func;
+
+		// 0 means unbounded
+		public uint max_size { get; private set; }
 
-		public LRU (CompareFunc<G> compare) {
-			this.compare = compare;
+		public LRU (HashFunc<G> hash, EqualFunc<G> equal, uint max_size = 0, owned EvictFunc<G>? evict_func = null) {
+			this.hash = hash;
+			this.equal = equal;
+			this.max_size = max_size;
+			this.evict_func = (owned) evict_func;
+			store = new LRUStore<G> (hash, equal);
 		}
-		
+
+		~LRU () {
+			store.users--;
+		}
+
+		public uint length {
+			get {
+				return store.length;
+			}
+		}
+
+		// The most recently used item, or null
+		public G? head {
+			get {
+				return store.head != null ? store.head.data : null;
+			}
+		}
+
+		// The least recently used item, or null
+		public G? tail {
+			get {
+				return store.tail != null ? store.tail.data : null;
+			}
+		}
+
+		// Copy the shared storage before modifying it
+		void detach () {
+			if (store.users == 1) {
+				return;
+			}
+
+			store.users--;
+			var newstore = new LRUStore<G> (hash, equal);
+			for (unowned LRUNode<G> node = store.head; node != null; node = node.next) {
+				newstore.push_tail (node.data);
+			}
+			store = newstore;
+		}
+
+		public bool contains (G f) {
+			return store.nodes.contains (f);
+		}
+
+		/* Adds f as the least recently used item. If the LRU is full,
+		 * the current least recently used item is evicted first. */
 		public void append (G f) {
-			unowned List<G> link = lru.find_custom (f, compare);
 			// ensure we have no duplicates
-			if (link == null) {
-				lru.append (f);
+			if (store.nodes.contains (f)) {
+				return;
 			}
+
+			detach ();
+			if (max_size > 0 && store.length >= max_size) {
+				evict ();
+			}
+			store.push_tail (f);
 		}
 		
 		public void used (G s) {
 			// bring to head
-			unowned List<G> link = lru.find_custom (s, compare);
-			if (link != null) {
-				lru.delete_link (link);
-				lru.prepend (s);
+			unowned LRUNode<G>? node = store.nodes[s];
+			if (node == null || node == store.head) {
+				return;
 			}
+
+			detach ();
+			node = store.nodes[s];
+			store.unlink (node);
+			store.link_head (node);
 		}
 		
 		public void remove (G f) {
-			unowned List<G> link = lru.find_custom (f, compare);
-			if (link != null) {
-				lru.delete_link (link);
+			unowned LRUNode<G>? node = store.nodes[f];
+			if (node == null) {
+				return;
+			}
+
+			detach ();
+			node = store.nodes[f];
+			store.unlink (node);
+			store.nodes.remove (f);
+		}
+
+		void evict () {
+			unowned LRUNode<G> node = store.tail;
+			G data = node.data;
+			store.unlink (node);
+			store.nodes.remove (data);
+			if (evict_func != null) {
+				evict_func (data);
 			}
 		}
 
 		public void clear () {
-			lru = null;
+			store.users--;
+			store = new LRUStore<G> (hash, equal);
 		}
 		
-		public unowned List<G> list () {
-			return lru;
+		// Returns the items, from the most recently used to the least recently used
+		public List<G> list () {
+			var res = new List<G> ();
+			for (unowned LRUNode<G> node = store.tail; node != null; node = node.prev) {
+				res.prepend (node.data);
+			}
+			return res;
 		}
 		
+		// The copy shares the storage until either LRU is modified, the evict function is not copied
 		public LRU<G> copy () {
-			var res = new LRU<G> (compare);
-			unowned List<G> ptr = lru;
-			while (ptr != null) {
-				res.lru.append (ptr.data);
-				ptr = ptr.next;
-			}
+			var res = new LRU<G> (hash, equal, max_size);
+			res.store = store;
+			store.users++;
 			return res;
 		}
 	}
@@ -0,0 +1,515 @@
+/*
+ *  Copyright © 2014 Luca Bruno
+ *
+ *  This file is part of Vanubi.
+ *
+ *  Vanubi is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Vanubi is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Vanubi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+namespace Vanubi {
+	/*****************
+	 * MAPPED FILE BUFFER
+	 *****************/
+
+	/* Read-only buffer for files too big to be loaded in memory.
+	 * The file is memory mapped, and the offsets of the lines are indexed lazily,
+	 * either on demand or in a background thread with index_lines (). */
+	public class MappedFileBuffer : Buffer {
+		MappedFile mapped;
+		internal uint8* data;
+		internal int64 size;
+
+		// start offset of each line indexed so far
+		int64[] line_offsets = new int64[1024];
+		int n_lines = 1;
+		int64 scanned = 0;
+		bool index_complete = false;
+		Mutex index_mutex = Mutex ();
+
+		// lines indexed at once by the background thread, before releasing the lock
+		const int INDEX_BATCH = 65536;
+		// bytes searched at once
+		const int SEARCH_BLOCK = 16*1024*1024;
+
+		public MappedFileBuffer (LocalFileSource source) throws Error {
+			this.source = source;
+			mapped = new MappedFile (source.local_path, false);
+			data = (uint8*) mapped.get_contents ();
+			size = (int64) mapped.get_length ();
+			line_offsets[0] = 0;
+			index_complete = size == 0;
+		}
+
+		public override int tab_width { get; set; default = 4; }
+
+		public override IndentMode indent_mode { get; set; default = IndentMode.TABS; }
+
+		// detected by window_text, the file is searched in this charset
+		public string? charset { get; private set; default = null; }
+
+		public int64 length {
+			get {
+				return size;
+			}
+		}
+
+		// Must be called with the index lock held
+		void index_until (int line, int64 offset) {
+			while ((n_lines <= line || line_offsets[n_lines-1] <= offset) && !index_complete) {
+				var p = (uint8*) Posix.memchr (data+scanned, '\n', (size_t) (size-scanned));
+				if (p == null) {
+					scanned = size;
+					index_complete = true;
+					break;
+				}
+				scanned = (int64) (p-data)+1;
+				if (n_lines == line_offsets.length) {
+					line_offsets.resize (line_offsets.length*2);
+				}
+				line_offsets[n_lines++] = scanned;
+			}
+		}
+
+		/* Indexes all the lines in a thread */
+		public async void index_lines (int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			yield run_in_thread<void*> (() => {
+					var complete = false;
+					while (!complete) {
+						cancellable.set_error_if_cancelled ();
+						index_mutex.lock ();
+						index_until (n_lines+INDEX_BATCH, -1);
+						complete = index_complete;
+						index_mutex.unlock ();
+					}
+					return null;
+			}, io_priority);
+		}
+
+		/* Number of lines, indexes the whole file if needed */
+		public int line_count {
+			get {
+				index_mutex.lock ();
+				index_until (int.MAX, -1);
+				var res = n_lines;
+				index_mutex.unlock ();
+				return res;
+			}
+		}
+
+		/* Whether the file has the given line, indexes only up to that line */
+		public bool has_line (int line) {
+			index_mutex.lock ();
+			index_until (line, -1);
+			var res = line < n_lines;
+			index_mutex.unlock ();
+			return res;
+		}
+
+		/* Returns the byte offset of the start of the line, clamped to the last line */
+		public int64 line_offset (int line) {
+			line = int.max (line, 0);
+			index_mutex.lock ();
+			index_until (line, -1);
+			var res = line_offsets[int.min (line, n_lines-1)];
+			index_mutex.unlock ();
+			return res;
+		}
+
+		/* Returns the byte offset of the end of the line, before the newline */
+		public int64 line_end_offset (int line) {
+			line = int.max (line, 0);
+			index_mutex.lock ();
+			index_until (line+1, -1);
+			int64 res;
+			if (line+1 < n_lines) {
+				res = line_offsets[line+1]-1;
+			} else {
+				res = size;
+			}
+			index_mutex.unlock ();
+			return res;
+		}
+
+		/* Returns the line containing the given byte offset */
+		public int line_at_offset (int64 offset) {
+			index_mutex.lock ();
+			index_until (-1, offset);
+			// last line starting at or before offset
+			var low = 0;
+			var high = n_lines-1;
+			while (low < high) {
+				var mid = low+(high-low+1)/2;
+				if (line_offsets[mid] <= offset) {
+					low = mid;
+				} else {
+					high = mid-1;
+				}
+			}
+			index_mutex.unlock ();
+			return low;
+		}
+
+		/* Returns the character offset of the given byte offset within its line */
+		public int line_char_offset (int64 offset) {
+			var start = line_offset (line_at_offset (offset));
+			if (charset == null || charset == "UTF-8") {
+				return ((string) (data+start)).substring (0, (long) (offset-start)).char_count ();
+			}
+			unowned uint8[] bytes = (uint8[]) (data+start);
+			bytes.length = (int) (offset-start);
+			string? cset = charset;
+			var text = convert_to_utf8 (bytes, ref cset, null, null);
+			if (text == null) {
+				return 0;
+			}
+			return ((string) text).substring (0, text.length).char_count ();
+		}
+
+		public override string line_text (int line) {
+			var start = line_offset (line);
+			var end = line_end_offset (line);
+			return ((string) (data+start)).substring (0, (long) (end-start));
+		}
+
+		/* Returns the text of count lines starting at first_line converted to utf-8, with line terminators */
+		public string window_text (int first_line, int count, ref string? charset) throws Error {
+			var start = line_offset (first_line);
+			var end = line_offset (first_line+count);
+			if (end == start) {
+				// last line
+				end = size;
+			}
+			unowned uint8[] bytes = (uint8[]) (data+start);
+			bytes.length = (int) (end-start);
+			var text = convert_to_utf8 (bytes, ref charset, null, null);
+			this.charset = charset;
+			if (text == null) {
+				return "";
+			}
+			// the converted text is not nul terminated
+			return ((string) text).substring (0, text.length);
+		}
+
+		public override BufferIter line_start (int line) {
+			return new MappedFileBufferIter (this, line_offset (line));
+		}
+
+		public override BufferIter line_end (int line) {
+			return new MappedFileBufferIter (this, line_end_offset (line));
+		}
+
+		public override BufferIter line_at_char (int line, int line_offset) {
+			var iter = line_start (line);
+			for (var i=0; i < line_offset && !iter.eol; i++) {
+				iter.forward_char ();
+			}
+			return iter;
+		}
+
+		public override BufferIter line_at_byte (int line, int line_offset) {
+			var offset = int64.min (this.line_offset (line)+line_offset, line_end_offset (line));
+			return new MappedFileBufferIter (this, offset);
+		}
+
+		public override void insert (BufferIter iter, string text) {
+			warning ("Cannot insert text in a read-only buffer");
+		}
+
+		public override void delete (BufferIter start, BufferIter end) {
+			warning ("Cannot delete text in a read-only buffer");
+		}
+
+		/* Compiles a pattern to search the raw bytes of the file, in the charset of the file.
+		 * Matching in raw mode does not require the file to be valid utf-8. */
+		public Regex search_regex (string pattern, bool is_regex, bool insensitive) throws Error {
+			var p = is_regex ? pattern : Regex.escape_string (pattern);
+			if (charset != null && charset != "UTF-8") {
+				p = convert (p, -1, charset, "UTF-8");
+			}
+			var flags = RegexCompileFlags.OPTIMIZE | RegexCompileFlags.MULTILINE | RegexCompileFlags.RAW;
+			if (!is_regex && insensitive) {
+				flags |= RegexCompileFlags.CASELESS;
+			}
+			return new Regex (p, flags);
+		}
+
+		/* Commands that can run on the viewer, they only move around, search or manage the editors.
+		 * The others may edit the buffer, which only holds a window of the file, or write that window
+		 * over the file. */
+		public static bool allows_command (string command) {
+			switch (command) {
+			// navigation
+			case "forward-char":
+			case "backward-char":
+			case "forward-char-select":
+			case "backward-char-select":
+			case "forward-word":
+			case "backward-word":
+			case "forward-word-select":
+			case "backward-word-select":
+			case "forward-line":
+			case "backward-line":
+			case "forward-line-select":
+			case "backward-line-select":
+			case "start-line":
+			case "start-line-select":
+			case "end-line":
+			case "end-line-select":
+			case "select-all":
+			case "copy":
+			case "mark":
+			case "unmark":
+			case "clear-marks":
+			case "next-mark":
+			case "prev-mark":
+			case "next-error":
+			case "prev-error":
+			// search, goto and grep
+			case "search-forward":
+			case "search-backward":
+			case "search-forward-regexp":
+			case "search-backward-regexp":
+			case "goto-line":
+			case "repo-grep":
+			case "repo-open-file":
+			// files, editors and layouts
+			case "open-file":
+			case "open-file-right":
+			case "open-file-down":
+			case "switch-buffer":
+			case "kill-buffer":
+			case "kill-all":
+			case "quit":
+			case "split-add-right":
+			case "split-add-down":
+			case "next-editor":
+			case "prev-editor":
+			case "next-layout":
+			case "prev-layout":
+			case "kill-layout":
+			case "join":
+			case "join-all":
+			case "save-session":
+			case "restore-session":
+			case "delete-session":
+			case "full-screen":
+			case "zen-mode":
+			case "help":
+			case "about":
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		/* Searches the regex starting at the given byte offset, without loading the whole file.
+		 * Returns false if there's no match. Matches do not span search blocks. */
+		public bool search_forward (Regex regex, int64 from, out int64 match_start, out int64 match_end, Cancellable? cancellable = null) throws Error {
+			match_start = match_end = -1;
+			var block_start = from;
+			while (block_start < size) {
+				cancellable.set_error_if_cancelled ();
+				var block_end = block_end_offset (block_start);
+				
+				MatchInfo info;
+				var subject = data+block_start;
+				if (regex.match_full ((string) subject, (ssize_t) (block_end-block_start), 0, 0, out info)) {
+					int start, end;
+					info.fetch_pos (0, out start, out end);
+					match_start = block_start+start;
+					match_end = block_start+end;
+					return true;
+				}
+				block_start = block_end;
+			}
+			return false;
+		}
+
+		/* Searches the last match of the regex starting before the given byte offset */
+		public bool search_backward (Regex regex, int64 from, out int64 match_start, out int64 match_end, Cancellable? cancellable = null) throws Error {
+			match_start = match_end = -1;
+			var block_end = int64.min (from, size);
+			while (block_end > 0) {
+				cancellable.set_error_if_cancelled ();
+				var block_start = block_start_offset (block_end);
+
+				MatchInfo info;
+				var subject = data+block_start;
+				var found = false;
+				regex.match_full ((string) subject, (ssize_t) (block_end-block_start), 0, 0, out info);
+				while (info.matches ()) {
+					int start, end;
+					info.fetch_pos (0, out start, out end);
+					if (block_start+start >= from) {
+						break;
+					}
+					match_start = block_start+start;
+					match_end = block_start+end;
+					found = true;
+					info.next ();
+				}
+				if (found) {
+					return true;
+				}
+				block_end = block_start;
+			}
+			return false;
+		}
+
+		// End of the search block starting at the given offset, at a line boundary if possible
+		// so that a block never splits a character
+		int64 block_end_offset (int64 block_start) {
+			var end = block_start+SEARCH_BLOCK;
+			if (end >= size) {
+				return size;
+			}
+			var p = (uint8*) Posix.memchr (data+end, '\n', (size_t) (size-end));
+			return p == null ? size : (int64) (p-data)+1;
+		}
+
+		// Start of the search block ending at the given offset, at a line boundary if possible
+		int64 block_start_offset (int64 block_end) {
+			var start = block_end-SEARCH_BLOCK;
+			if (start <= 0) {
+				return 0;
+			}
+			return line_offset (line_at_offset (start));
+		}
+	}
+
+	/* Byte based iter on a MappedFileBuffer, decodes utf-8 characters */
+	public class MappedFileBufferIter : BufferIter {
+		int64 offset;
+		MappedFileBuffer buf;
+
+		public MappedFileBufferIter (MappedFileBuffer buffer, int64 offset) {
+			base (buffer);
+			buf = buffer;
+			this.offset = offset;
+		}
+
+		public int64 byte_offset {
+			get {
+				return offset;
+			}
+		}
+
+		public override BufferIter forward_char () {
+			if (offset >= buf.size) {
+				return this;
+			}
+			var c = buf.data[offset];
+			if (c < 0x80) {
+				offset++;
+			} else {
+				// skip the continuation bytes
+				offset++;
+				while (offset < buf.size && (buf.data[offset] & 0xc0) == 0x80) {
+					offset++;
+				}
+			}
+			return this;
+		}
+
+		public override BufferIter backward_char () {
+			if (offset <= 0) {
+				return this;
+			}
+			offset--;
+			while (offset > 0 && (buf.data[offset] & 0xc0) == 0x80) {
+				offset--;
+			}
+			return this;
+		}
+
+		public override BufferIter forward_line () {
+			var l = line;
+			offset = buf.line_offset (l+1);
+			if (buf.line_at_offset (offset) == l) {
+				// last line
+				offset = buf.line_end_offset (l);
+			}
+			return this;
+		}
+
+		public override BufferIter backward_line () {
+			offset = buf.line_offset (int.max (line-1, 0));
+			return this;
+		}
+
+		public override bool is_in_code {
+			get {
+				// no syntax information
+				return true;
+			}
+		}
+
+		public override bool is_in_comment {
+			get {
+				return false;
+			}
+		}
+
+		public override int line_offset {
+			get {
+				var iter = new MappedFileBufferIter (buf, buf.line_offset (line));
+				var res = 0;
+				while (iter.offset < offset) {
+					iter.forward_char ();
+					res++;
+				}
+				return res;
+			}
+		}
+
+		public override int line {
+			get {
+				return buf.line_at_offset (offset);
+			}
+		}
+
+		public override bool eol {
+			get {
+				return offset >= buf.size || buf.data[offset] == '\n';
+			}
+		}
+
+		public override bool eof {
+			get {
+				return offset >= buf.size;
+			}
+		}
+
+		public override bool sol {
+			get {
+				return offset == 0 || buf.data[offset-1] == '\n';
+			}
+		}
+
+		public override unichar char {
+			get {
+				if (offset >= buf.size) {
+					return 0;
+				}
+				var c = ((string) (buf.data+offset)).get_char_validated ((ssize_t) int64.min (buf.size-offset, 6));
+				// invalid utf-8, assume latin1
+				return c >= 0 ? c : (unichar) buf.data[offset];
+			}
+		}
+
+		public override BufferIter copy () {
+			return new MappedFileBufferIter (buf, offset);
+		}
+	}
+}
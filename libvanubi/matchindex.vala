@@ -0,0 +1,198 @@
+/*
+ *  Copyright © 2014 Luca Bruno
+ *
+ *  This file is part of Vanubi.
+ *
+ *  Vanubi is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Vanubi is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Vanubi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+namespace Vanubi {
+	/* The matches of a pattern in a text, as sorted char offsets.
+	 * Matches do not span lines and do not overlap. */
+	public class MatchIndex {
+		public string pattern { get; private set; }
+		public bool is_regex { get; private set; }
+		public bool insensitive { get; private set; }
+		public Regex regex { get; private set; }
+
+		int[] starts = new int[0];
+		int[] ends = new int[0];
+
+		public int length {
+			get {
+				return starts.length;
+			}
+		}
+
+		public MatchIndex (string pattern, bool is_regex, bool insensitive) throws RegexError {
+			this.pattern = pattern;
+			this.is_regex = is_regex;
+			this.insensitive = insensitive;
+
+			var flags = RegexCompileFlags.OPTIMIZE | RegexCompileFlags.MULTILINE;
+			if (!is_regex && insensitive) {
+				flags |= RegexCompileFlags.CASELESS;
+			}
+			regex = new Regex (is_regex ? pattern : Regex.escape_string (pattern), flags);
+		}
+
+		/* Indexes a snapshot of the whole text in a thread */
+		public async void scan (owned string text, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			int[] new_starts = null;
+			int[] new_ends = null;
+			yield run_in_thread<Object?> (() => {
+					find_all (text, 0, out new_starts, out new_ends, cancellable);
+					return null;
+			}, io_priority);
+			if (cancellable != null) {
+				cancellable.set_error_if_cancelled ();
+			}
+			starts = (owned) new_starts;
+			ends = (owned) new_ends;
+		}
+
+		/* The chars in [start, old_end) have been replaced by text.
+		 * The region must be made of whole lines, its matches are searched again and the following ones are moved. */
+		public void replace_region (int start, int old_end, string text) {
+			int[] new_starts, new_ends;
+			find_all (text, start, out new_starts, out new_ends, null);
+			var delta = text.char_count () - (old_end-start);
+			var first = lower_bound (start);
+			var last = lower_bound (old_end);
+
+			var res_starts = new int[first + new_starts.length + starts.length-last];
+			var res_ends = new int[res_starts.length];
+			Memory.copy (res_starts, starts, first*sizeof(int));
+			Memory.copy (res_ends, ends, first*sizeof(int));
+			Memory.copy (&res_starts[first], new_starts, new_starts.length*sizeof(int));
+			Memory.copy (&res_ends[first], new_ends, new_ends.length*sizeof(int));
+			var j = first+new_starts.length;
+			for (var i=last; i < starts.length; i++, j++) {
+				res_starts[j] = starts[i]+delta;
+				res_ends[j] = ends[i]+delta;
+			}
+			starts = (owned) res_starts;
+			ends = (owned) res_ends;
+		}
+
+		/* Finds the first match starting at or after offset */
+		public bool next (int offset, out int start, out int end) {
+			var i = lower_bound (offset);
+			return get_match (i, out start, out end);
+		}
+
+		/* Finds the last match starting at or before offset */
+		public bool prev (int offset, out int start, out int end) {
+			var i = lower_bound (offset+1)-1;
+			return get_match (i, out start, out end);
+		}
+
+		/* Returns the position of the match starting at offset, or -1 */
+		public int index_of (int offset) {
+			var i = lower_bound (offset);
+			return i < starts.length && starts[i] == offset ? i : -1;
+		}
+
+		/* Returns the position of the first match starting at or after offset */
+		public int index_after (int offset) {
+			return lower_bound (offset);
+		}
+
+		public bool get_match (int i, out int start, out int end) {
+			if (i < 0 || i >= starts.length) {
+				start = end = -1;
+				return false;
+			}
+			start = starts[i];
+			end = ends[i];
+			return true;
+		}
+
+		// first match starting at or after offset
+		int lower_bound (int offset) {
+			int lo = 0, hi = starts.length;
+			while (lo < hi) {
+				var mid = (lo+hi)/2;
+				if (starts[mid] < offset) {
+					lo = mid+1;
+				} else {
+					hi = mid;
+				}
+			}
+			return lo;
+		}
+
+		void find_all (string text, int offset, out int[] res_starts, out int[] res_ends, Cancellable? cancellable) {
+			int[] found_starts = {};
+			int[] found_ends = {};
+			// char offset of the byte at pos
+			var pos = 0;
+			var char_pos = offset;
+			// checked by iterations, the matches may be all skipped
+			var iterations = 0;
+			// the next newline, -1 if none
+			var line_end = text.index_of_char ('\n');
+			MatchInfo info;
+			try {
+				regex.match_full (text, text.length, 0, 0, out info);
+				while (info.matches ()) {
+					if ((++iterations & 1023) == 0 && cancellable != null && cancellable.is_cancelled ()) {
+						break;
+					}
+
+					int match_start, match_end;
+					info.fetch_pos (0, out match_start, out match_end);
+					if (line_end >= 0 && line_end < match_start) {
+						line_end = text.index_of_char ('\n', match_start);
+					}
+					var next_start = -1;
+					var found = match_end > match_start;
+					if (line_end >= 0 && line_end < match_end) {
+						// spans lines, match again within the line like the search does
+						next_start = line_end+1;
+						found = false;
+						MatchInfo line_info;
+						if (regex.match_full (text, line_end, match_start, 0, out line_info)) {
+							line_info.fetch_pos (0, out match_start, out match_end);
+							found = match_end > match_start;
+							if (found) {
+								next_start = match_end;
+							}
+						}
+					}
+
+					// skip empty matches
+					if (found) {
+						char_pos += text.offset (pos).char_count (match_start-pos);
+						pos = match_start;
+						found_starts += char_pos;
+						found_ends += char_pos+text.offset (match_start).char_count (match_end-match_start);
+					}
+
+					if (next_start < 0) {
+						info.next ();
+					} else if (next_start <= text.length) {
+						regex.match_full (text, text.length, next_start, 0, out info);
+					} else {
+						break;
+					}
+				}
+			} catch (RegexError e) {
+				// match limits, keep the matches found so far
+			}
+			res_starts = (owned) found_starts;
+			res_ends = (owned) found_ends;
+		}
+	}
+}
@@ -18,17 +18,47 @@
  */
 
 namespace Vanubi {
+	inline char fold_char (char c) {
+		return (c >= 'A' && c <= 'Z') ? (char) (c+32) : c;
+	}
+
+	/* Set of the characters contained in a string, case insensitive.
+	 * Letters and digits have their own bit, other characters share the remaining ones. */
+	public uint64 char_mask (string str) {
+		uint64 mask = 0;
+		char* p = (char*) str;
+		for (; *p != '\0'; p++) {
+			var c = fold_char (*p);
+			int bit;
+			if (c >= 'a' && c <= 'z') {
+				bit = c-'a';
+			} else if (c >= '0' && c <= '9') {
+				bit = 26+c-'0';
+			} else {
+				bit = 36+(int)((uchar) c % 28);
+			}
+			mask |= (uint64) 1 << bit;
+		}
+		return mask;
+	}
+
 	// returns a ranking, lower is better, 0 for perfect match, -1 for no match
 	public int pattern_match (string pattern, string haystack) {
+		return pattern_match_folded (pattern.ascii_down (), haystack);
+	}
+
+	// same as pattern_match, with a lower case pattern
+	int pattern_match_folded (string pattern, string haystack) {
 		int rank = 0;
 		int n = pattern.length;
 		int m = haystack.length;
 		int j = 0;
+		char* h = (char*) haystack;
 		for (int i=0; i < n; i++) {
 			char c = pattern[i];
 			bool found = false;
 			for (; j < m; j++) {
-				if (c.tolower () == haystack[j].tolower ()) {
+				if (c == fold_char (h[j])) {
 					found = true;
 					break;
 				}
@@ -62,54 +92,222 @@ namespace Vanubi {
 	public class Annotated<G> {
 		public string str;
 		public G? obj;
+		// see char_mask (), used to quickly discard non-matching strings
+		public uint64 mask;
 
 		public Annotated (owned string str, owned G? obj) {
 			this.obj = (owned) obj;
 			this.str = (owned) str;
+			this.mask = char_mask (this.str);
 		}
 	}
 
-	/* Object match with score */
-	public class Match<G> {
-		public G obj;
-		internal int score;
-
-		public Match (G obj, int score) {
-			this.obj = obj;
-			this.score = score;
-		}
+	/* Matches a pattern against objects, and returns a ranking of the objects that match */
+	public GenericArray<Annotated<G>> pattern_match_many<G> (string pattern, Annotated<G>[] objects, bool sort = true, Cancellable? cancellable = null) throws Error {
+		var result = new GenericArray<Annotated<G>> ();
+		pattern_match_many_into<G> (pattern, objects, result, sort, cancellable);
+		return result;
 	}
 
-	#if VALA_0_24
-	public int match_compare_func (Match a, Match b) {
-		return a.score - b.score;
+	int match_key_compare (void* a, void* b) {
+		var ka = *((int64*) a);
+		var kb = *((int64*) b);
+		return ka < kb ? -1 : (ka > kb ? 1 : 0);
 	}
-	#else
-	public int match_compare_func (Match** a, Match** b) {
-		return (*a)->score - (*b)->score;
+
+	/* Same as pattern_match_many, but reuses the given result array, which is cleared first */
+	public void pattern_match_many_into<G> (string pattern, Annotated<G>[] objects, GenericArray<Annotated<G>> result, bool sort = true, Cancellable? cancellable = null) throws Error {
+		var folded = pattern.ascii_down ();
+		var pattern_mask = char_mask (folded);
+
+		var keys = match_range<G> (folded, pattern_mask, objects, 0, objects.length, pattern != "" && sort, cancellable);
+		cancellable.set_error_if_cancelled ();
+
+		result.set_size (0);
+		foreach (var key in keys) {
+			result.add (objects[(int) (key & 0xffffffff)]);
+		}
 	}
-	#endif
 
-	/* Matches a pattern against objects, and returns a ranking of the objects that match */
-	public GenericArray<Annotated<G>> pattern_match_many<G> (string pattern, Annotated<G>[] objects, bool sort = true, Cancellable? cancellable = null) throws Error {
-		Match<Annotated<G>?>[] matches = null;
-		foreach (var object in objects) {
-			cancellable.set_error_if_cancelled ();
-			var score = pattern_match (pattern, object.str);
+	/* Matches the objects in [start, end) and returns their keys:
+	 * score in the high bits, index in the low bits. Sorting the keys is a stable sort by score. */
+	int64[] match_range<G> (string folded, uint64 pattern_mask, Annotated<G>[] objects, int start, int end, bool sort, Cancellable? cancellable) throws Error {
+		var keys = new int64[end-start];
+		var n_matches = 0;
+		for (var i=start; i < end; i++) {
+			if ((i & 1023) == 0) {
+				cancellable.set_error_if_cancelled ();
+			}
+			unowned Annotated<G> object = objects[i];
+			if ((pattern_mask & ~object.mask) != 0) {
+				// some character of the pattern is missing
+				continue;
+			}
+			var score = pattern_match_folded (folded, object.str);
 			if (score >= 0) {
-				matches += new Match<Annotated<G>?> ((owned) object, score);
+				keys[n_matches++] = ((int64) score << 32) | i;
 			}
 		}
+		keys.length = n_matches;
 		
-		if (pattern != "" && sort) {
-			qsort_with_data<Match> (matches, sizeof (Match), (CompareDataFunc<Match>) match_compare_func);
+		if (sort) {
+			Posix.qsort (keys, keys.length, sizeof (int64), match_key_compare);
 		}
-		
+		return keys;
+	}
+
+	// Number of threads used by pattern_match_many_parallel, 0 for the number of processors
+	public int pattern_match_threads = 0;
+
+	// Candidates per chunk, small enough for the chunk to stay in cache
+	const int MATCH_CHUNK_SIZE = 4096;
+
+	class MatchChunk {
+		public int64[] keys;
+
+		public MatchChunk (owned int64[] keys) {
+			this.keys = (owned) keys;
+		}
+	}
+
+	/* Chunks are claimed by the calling thread and by the helper threads,
+	 * until none is left. The caller never waits for a helper to start. */
+	class MatchJob<G> {
+		public string folded;
+		public uint64 pattern_mask;
+		public unowned Annotated<G>[] objects;
+		public bool sort;
+		public Cancellable? cancellable;
+
+		public MatchChunk[] chunks;
+		int next_chunk = 0;
+		int completed = 0;
+		Mutex mutex = Mutex ();
+		Cond cond = Cond ();
+
+		public MatchJob (string folded, uint64 pattern_mask, Annotated<G>[] objects, bool sort, Cancellable? cancellable) {
+			this.folded = folded;
+			this.pattern_mask = pattern_mask;
+			this.objects = objects;
+			this.sort = sort;
+			this.cancellable = cancellable;
+			chunks = new MatchChunk[(objects.length+MATCH_CHUNK_SIZE-1)/MATCH_CHUNK_SIZE];
+		}
+
+		public void run () {
+			while (true) {
+				var chunk = AtomicInt.add (ref next_chunk, 1);
+				if (chunk >= chunks.length) {
+					return;
+				}
+
+				int64[] keys = null;
+				// on cancellation keep consuming chunks, so that the caller wakes up
+				if (cancellable == null || !cancellable.is_cancelled ()) {
+					var start = chunk*MATCH_CHUNK_SIZE;
+					var end = int.min (start+MATCH_CHUNK_SIZE, objects.length);
+					try {
+						keys = match_range<G> (folded, pattern_mask, objects, start, end, sort, cancellable);
+					} catch (Error e) {
+					}
+				}
+				chunks[chunk] = new MatchChunk ((owned) keys);
+
+				mutex.lock ();
+				completed++;
+				if (completed == chunks.length) {
+					cond.signal ();
+				}
+				mutex.unlock ();
+			}
+		}
+
+		public void wait () {
+			mutex.lock ();
+			while (completed < chunks.length) {
+				cond.wait (mutex);
+			}
+			mutex.unlock ();
+		}
+	}
+
+	void match_heap_sift_down (int[] heap, int n, int i, MatchChunk[] chunks, int[] pos) {
+		while (true) {
+			var min = i;
+			var left = 2*i+1;
+			var right = left+1;
+			if (left < n && chunks[heap[left]].keys[pos[heap[left]]] < chunks[heap[min]].keys[pos[heap[min]]]) {
+				min = left;
+			}
+			if (right < n && chunks[heap[right]].keys[pos[heap[right]]] < chunks[heap[min]].keys[pos[heap[min]]]) {
+				min = right;
+			}
+			if (min == i) {
+				return;
+			}
+			var tmp = heap[i];
+			heap[i] = heap[min];
+			heap[min] = tmp;
+			i = min;
+		}
+	}
+
+	/* Same as pattern_match_many, but large inputs are split in chunks that are matched
+	 * in parallel on the thread pool. Meant to be called from a thread, like pattern_match_many. */
+	public GenericArray<Annotated<G>> pattern_match_many_parallel<G> (string pattern, Annotated<G>[] objects, bool sort = true, Cancellable? cancellable = null) throws Error {
+		var n_threads = pattern_match_threads > 0 ? pattern_match_threads : (int) get_num_processors ();
+		if (n_threads <= 1 || objects.length <= MATCH_CHUNK_SIZE) {
+			return pattern_match_many<G> (pattern, objects, sort, cancellable);
+		}
+
+		var folded = pattern.ascii_down ();
+		sort = pattern != "" && sort;
+		var job = new MatchJob<G> (folded, char_mask (folded), objects, sort, cancellable);
+
+		initialize_thread_pool ();
+		// the calling thread works too
+		var n_helpers = int.min (n_threads, job.chunks.length)-1;
+		for (var i=0; i < n_helpers; i++) {
+			thread_pool.add (new ThreadWorker (() => {
+						job.run ();
+						return null;
+			}));
+		}
+		job.run ();
+		job.wait ();
 		cancellable.set_error_if_cancelled ();
 
 		var result = new GenericArray<Annotated<G>> ();
-		foreach (var match in matches) {
-			result.add ((owned) match.obj);
+		unowned MatchChunk[] chunks = job.chunks;
+		if (!sort) {
+			foreach (unowned MatchChunk chunk in chunks) {
+				foreach (var key in chunk.keys) {
+					result.add (objects[(int) (key & 0xffffffff)]);
+				}
+			}
+			return result;
+		}
+
+		// k-way merge of the sorted chunks, using a min-heap of chunk indexes
+		var pos = new int[chunks.length];
+		var heap = new int[chunks.length];
+		var n = 0;
+		for (var i=0; i < chunks.length; i++) {
+			if (chunks[i].keys.length > 0) {
+				heap[n++] = i;
+			}
+		}
+		for (var i=n/2-1; i >= 0; i--) {
+			match_heap_sift_down (heap, n, i, chunks, pos);
+		}
+		while (n > 0) {
+			var c = heap[0];
+			var key = chunks[c].keys[pos[c]++];
+			result.add (objects[(int) (key & 0xffffffff)]);
+			if (pos[c] == chunks[c].keys.length) {
+				heap[0] = heap[--n];
+			}
+			match_heap_sift_down (heap, n, 0, chunks, pos);
 		}
 		return result;
 	}
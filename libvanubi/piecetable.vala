@@ -0,0 +1,551 @@
+/*
+ *  Copyright © 2014 Luca Bruno
+ *
+ *  This file is part of Vanubi.
+ *
+ *  Vanubi is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Vanubi is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Vanubi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+namespace Vanubi {
+	/*****************
+	 * PIECE TABLE BUFFER
+	 *****************/
+
+	/* A piece of either the original or the added text. Pieces are kept in a treap
+	 * ordered by position in the buffer, each node knows the size and the number
+	 * of newlines of its subtree. */
+	class PieceNode {
+		public bool added;
+		public int start;
+		public int length;
+		public int newlines;
+		public uint priority;
+		// subtree
+		public int size;
+		public int lines;
+		public PieceNode? left;
+		public PieceNode? right;
+
+		public PieceNode (bool added, int start, int length, int newlines, uint priority) {
+			this.added = added;
+			this.start = start;
+			this.length = length;
+			this.newlines = newlines;
+			this.priority = priority;
+			size = length;
+			lines = newlines;
+		}
+
+		public void update () {
+			size = length;
+			lines = newlines;
+			if (left != null) {
+				size += left.size;
+				lines += left.lines;
+			}
+			if (right != null) {
+				size += right.size;
+				lines += right.lines;
+			}
+		}
+	}
+
+	/* Headless buffer with O(log n) multi-line insert and delete. The text is never
+	 * copied: the original text is kept as is, inserted text is appended to another
+	 * string, and the tree of pieces tells which parts make up the buffer. */
+	public class PieceTableBuffer : Buffer {
+		string original;
+		StringBuilder added = new StringBuilder ();
+		// byte offsets of the newlines in both strings, sorted
+		int[] original_newlines = new int[0];
+		int[] added_newlines = new int[0];
+		PieceNode? root;
+		// live iters, updated on each change
+		internal unowned PieceTableBufferIter? iters;
+
+		public PieceTableBuffer (string text = "") {
+			original = text;
+			for (var i=0; i < text.length; i++) {
+				if (text[i] == '\n') {
+					original_newlines += i;
+				}
+			}
+			if (text.length > 0) {
+				root = new PieceNode (false, 0, text.length, original_newlines.length, Random.next_int ());
+			}
+		}
+
+		public override int tab_width { get; set; default = 4; }
+
+		public override IndentMode indent_mode { get; set; default = IndentMode.TABS; }
+
+		/* Length in bytes */
+		public int length {
+			get {
+				return root != null ? root.size : 0;
+			}
+		}
+
+		public int line_count {
+			get {
+				return root != null ? root.lines+1 : 1;
+			}
+		}
+
+		public string text {
+			owned get {
+				return get_text (0, length);
+			}
+		}
+
+		/* Returns the text between the given byte offsets */
+		public string get_text (int start, int end) {
+			var b = new StringBuilder.sized (int.max (end-start, 0)+1);
+			append_range (root, 0, start, end, b);
+			return (owned) b.str;
+		}
+
+		public override string line_text (int line) {
+			return get_text (line_start_offset (line), line_end_offset (line));
+		}
+
+		public override BufferIter line_start (int line) {
+			return new PieceTableBufferIter (this, line_start_offset (line));
+		}
+
+		public override BufferIter line_end (int line) {
+			return new PieceTableBufferIter (this, line_end_offset (line));
+		}
+
+		public override BufferIter line_at_char (int line, int line_offset) {
+			var iter = new PieceTableBufferIter (this, line_start_offset (line));
+			for (var i=0; i < line_offset && !iter.eol; i++) {
+				iter.forward_char ();
+			}
+			return iter;
+		}
+
+		public override BufferIter line_at_byte (int line, int line_offset) {
+			var offset = int.min (line_start_offset (line)+int.max (line_offset, 0), line_end_offset (line));
+			return new PieceTableBufferIter (this, offset);
+		}
+
+		public override void insert (BufferIter iter, string text) {
+			var piter = (PieceTableBufferIter) iter;
+			var offset = piter.offset;
+			var len = text.length;
+			if (len == 0) {
+				return;
+			}
+			if (bracket_cache != null) {
+				bracket_cache.invalidate (line_at_offset (offset));
+			}
+
+			var start = (int) added.len;
+			added.append (text);
+			var newlines = 0;
+			for (var i=0; i < len; i++) {
+				if (text[i] == '\n') {
+					added_newlines += start+i;
+					newlines++;
+				}
+			}
+
+			PieceNode? l, r;
+			split ((owned) root, offset, out l, out r);
+			unowned PieceNode? last = l;
+			while (last != null && last.right != null) {
+				last = last.right;
+			}
+			if (last != null && last.added && last.start+last.length == start) {
+				// typing, grow the last piece
+				extend_last (l, len, newlines);
+			} else {
+				l = merge ((owned) l, new PieceNode (true, start, len, newlines, Random.next_int ()));
+			}
+			root = merge ((owned) l, (owned) r);
+
+			// other iters keep pointing to the same text, the given iter is moved after the inserted text
+			for (unowned PieceTableBufferIter? it = iters; it != null; it = it.next) {
+				if (it != piter && it.offset > offset) {
+					it.offset += len;
+				}
+			}
+			piter.offset += len;
+		}
+
+		public override void delete (BufferIter start, BufferIter end) {
+			var a = int.min (((PieceTableBufferIter) start).offset, ((PieceTableBufferIter) end).offset);
+			var b = int.max (((PieceTableBufferIter) start).offset, ((PieceTableBufferIter) end).offset);
+			if (a == b) {
+				return;
+			}
+			if (bracket_cache != null) {
+				bracket_cache.invalidate (line_at_offset (a));
+			}
+
+			PieceNode? l, rest, removed, r;
+			split ((owned) root, a, out l, out rest);
+			split ((owned) rest, b-a, out removed, out r);
+			root = merge ((owned) l, (owned) r);
+
+			for (unowned PieceTableBufferIter? it = iters; it != null; it = it.next) {
+				if (it.offset >= b) {
+					it.offset -= b-a;
+				} else if (it.offset > a) {
+					it.offset = a;
+				}
+			}
+		}
+
+		/* Byte offset of the start of the line, clamped to the last line */
+		public int line_start_offset (int line) {
+			if (line <= 0 || root == null) {
+				return 0;
+			}
+			line = int.min (line, root.lines);
+
+			// find the line-th newline
+			var offset = 0;
+			unowned PieceNode? node = root;
+			while (true) {
+				var left_lines = node.left != null ? node.left.lines : 0;
+				var left_size = node.left != null ? node.left.size : 0;
+				if (line <= left_lines) {
+					node = node.left;
+					continue;
+				}
+				line -= left_lines;
+				if (line <= node.newlines) {
+					unowned int[] newlines = node.added ? added_newlines : original_newlines;
+					var i = lower_bound (newlines, node.start)+line-1;
+					return offset+left_size+newlines[i]-node.start+1;
+				}
+				line -= node.newlines;
+				offset += left_size+node.length;
+				node = node.right;
+			}
+		}
+
+		/* Byte offset of the end of the line, before the newline */
+		public int line_end_offset (int line) {
+			line = int.max (line, 0);
+			if (root == null || line >= root.lines) {
+				return length;
+			}
+			return line_start_offset (line+1)-1;
+		}
+
+		/* Line containing the given byte offset */
+		public int line_at_offset (int offset) {
+			var line = 0;
+			unowned PieceNode? node = root;
+			while (node != null) {
+				var left_size = node.left != null ? node.left.size : 0;
+				if (offset < left_size) {
+					node = node.left;
+					continue;
+				}
+				line += node.left != null ? node.left.lines : 0;
+				offset -= left_size;
+				if (offset < node.length) {
+					return line+count_newlines (node.added, node.start, node.start+offset);
+				}
+				line += node.newlines;
+				offset -= node.length;
+				node = node.right;
+			}
+			return line;
+		}
+
+		internal uint8 byte_at (int offset) {
+			unowned PieceNode? node = root;
+			while (node != null) {
+				var left_size = node.left != null ? node.left.size : 0;
+				if (offset < left_size) {
+					node = node.left;
+				} else if (offset < left_size+node.length) {
+					unowned string data = node.added ? added.str : original;
+					return (uint8) data[node.start+offset-left_size];
+				} else {
+					offset -= left_size+node.length;
+					node = node.right;
+				}
+			}
+			return 0;
+		}
+
+		internal unichar char_at (int offset) {
+			var c = byte_at (offset);
+			if (c < 0x80) {
+				return c;
+			}
+			// collect the utf-8 sequence, which may span several pieces
+			uint8 seq[7];
+			var n = 0;
+			seq[n++] = c;
+			while (n < 6 && offset+n < length && (byte_at (offset+n) & 0xc0) == 0x80) {
+				seq[n] = byte_at (offset+n);
+				n++;
+			}
+			seq[n] = 0;
+			var res = ((string) seq).get_char_validated (n);
+			// invalid utf-8, assume latin1
+			return res >= 0 ? res : (unichar) c;
+		}
+
+		int count_newlines (bool is_added, int start, int end) {
+			unowned int[] newlines = is_added ? added_newlines : original_newlines;
+			return lower_bound (newlines, end)-lower_bound (newlines, start);
+		}
+
+		// index of the first element not less than value
+		static int lower_bound (int[] array, int value) {
+			var low = 0;
+			var high = array.length;
+			while (low < high) {
+				var mid = low+(high-low)/2;
+				if (array[mid] < value) {
+					low = mid+1;
+				} else {
+					high = mid;
+				}
+			}
+			return low;
+		}
+
+		void append_range (PieceNode? node, int node_offset, int start, int end, StringBuilder b) {
+			if (node == null || start >= node_offset+node.size || end <= node_offset) {
+				return;
+			}
+			var left_size = node.left != null ? node.left.size : 0;
+			append_range (node.left, node_offset, start, end, b);
+
+			var piece_offset = node_offset+left_size;
+			var piece_start = int.max (start, piece_offset);
+			var piece_end = int.min (end, piece_offset+node.length);
+			if (piece_start < piece_end) {
+				unowned string data = node.added ? added.str : original;
+				b.append_len (data.offset (node.start+piece_start-piece_offset), piece_end-piece_start);
+			}
+
+			append_range (node.right, piece_offset+node.length, start, end, b);
+		}
+
+		// splits the tree in the pieces before and after the given offset, cutting a piece if needed
+		void split (owned PieceNode? node, int offset, out PieceNode? l, out PieceNode? r) {
+			if (node == null) {
+				l = r = null;
+				return;
+			}
+
+			var left_size = node.left != null ? node.left.size : 0;
+			if (offset <= left_size) {
+				PieceNode? ll, lr;
+				split ((owned) node.left, offset, out ll, out lr);
+				node.left = (owned) lr;
+				node.update ();
+				l = (owned) ll;
+				r = (owned) node;
+			} else if (offset >= left_size+node.length) {
+				PieceNode? rl, rr;
+				split ((owned) node.right, offset-left_size-node.length, out rl, out rr);
+				node.right = (owned) rl;
+				node.update ();
+				l = (owned) node;
+				r = (owned) rr;
+			} else {
+				// the tail inherits the priority, so that it can keep the right subtree
+				var cut = offset-left_size;
+				var tail_newlines = count_newlines (node.added, node.start+cut, node.start+node.length);
+				var tail = new PieceNode (node.added, node.start+cut, node.length-cut, tail_newlines, node.priority);
+				tail.right = (owned) node.right;
+				tail.update ();
+				node.length = cut;
+				node.newlines -= tail_newlines;
+				node.update ();
+				l = (owned) node;
+				r = (owned) tail;
+			}
+		}
+
+		static PieceNode? merge (owned PieceNode? a, owned PieceNode? b) {
+			if (a == null) {
+				return b;
+			}
+			if (b == null) {
+				return a;
+			}
+			if (a.priority > b.priority) {
+				a.right = merge ((owned) a.right, (owned) b);
+				a.update ();
+				return a;
+			} else {
+				b.left = merge ((owned) a, (owned) b.left);
+				b.update ();
+				return b;
+			}
+		}
+
+		static void extend_last (PieceNode node, int len, int newlines) {
+			if (node.right != null) {
+				extend_last (node.right, len, newlines);
+			} else {
+				node.length += len;
+				node.newlines += newlines;
+			}
+			node.size += len;
+			node.lines += newlines;
+		}
+	}
+
+	/* Byte based iter on a PieceTableBuffer, decodes utf-8 characters.
+	 * The iter stays valid after any change to the buffer: text inserted before the iter moves it forward,
+	 * text deleted around the iter moves it to the start of the deleted range. */
+	public class PieceTableBufferIter : BufferIter {
+		internal int offset;
+		PieceTableBuffer buf;
+		internal unowned PieceTableBufferIter? prev;
+		internal unowned PieceTableBufferIter? next;
+
+		public PieceTableBufferIter (PieceTableBuffer buffer, int offset) {
+			base (buffer);
+			buf = buffer;
+			this.offset = offset;
+
+			next = buf.iters;
+			if (next != null) {
+				next.prev = this;
+			}
+			buf.iters = this;
+		}
+
+		~PieceTableBufferIter () {
+			if (prev != null) {
+				prev.next = next;
+			} else {
+				buf.iters = next;
+			}
+			if (next != null) {
+				next.prev = prev;
+			}
+		}
+
+		public int byte_offset {
+			get {
+				return offset;
+			}
+		}
+
+		public override BufferIter forward_char () {
+			if (offset >= buf.length) {
+				return this;
+			}
+			offset++;
+			// skip the continuation bytes
+			while (offset < buf.length && (buf.byte_at (offset) & 0xc0) == 0x80) {
+				offset++;
+			}
+			return this;
+		}
+
+		public override BufferIter backward_char () {
+			if (offset <= 0) {
+				return this;
+			}
+			offset--;
+			while (offset > 0 && (buf.byte_at (offset) & 0xc0) == 0x80) {
+				offset--;
+			}
+			return this;
+		}
+
+		public override BufferIter forward_line () {
+			var l = line;
+			if (l+1 < buf.line_count) {
+				offset = buf.line_start_offset (l+1);
+			}
+			return this;
+		}
+
+		public override BufferIter backward_line () {
+			offset = buf.line_start_offset (int.max (line-1, 0));
+			return this;
+		}
+
+		public override bool is_in_code {
+			get {
+				// no syntax information
+				return true;
+			}
+		}
+
+		public override bool is_in_comment {
+			get {
+				return false;
+			}
+		}
+
+		public override int line_offset {
+			get {
+				var res = 0;
+				var it = buf.line_start_offset (line);
+				while (it < offset) {
+					it++;
+					if ((buf.byte_at (it) & 0xc0) != 0x80) {
+						res++;
+					}
+				}
+				return res;
+			}
+		}
+
+		public override int line {
+			get {
+				return buf.line_at_offset (offset);
+			}
+		}
+
+		public override bool eol {
+			get {
+				return offset >= buf.length || buf.byte_at (offset) == '\n';
+			}
+		}
+
+		public override bool eof {
+			get {
+				return offset >= buf.length;
+			}
+		}
+
+		public override bool sol {
+			get {
+				return offset == 0 || buf.byte_at (offset-1) == '\n';
+			}
+		}
+
+		public override unichar char {
+			get {
+				if (offset >= buf.length) {
+					return 0;
+				}
+				return buf.char_at (offset);
+			}
+		}
+
+		public override BufferIter copy () {
+			return new PieceTableBufferIter (buf, offset);
+		}
+	}
+}
@@ -87,11 +87,229 @@ namespace Vanubi {
 		
 	}
 
+	/* Bounded max-heap keeping the best (lowest score) results seen so far */
+	class SearchResultHeap {
+		class Entry {
+			public SearchDocument doc;
+			public int score;
+			public int seq;
+
+			public Entry (SearchDocument doc, int score, int seq) {
+				this.doc = doc;
+				this.score = score;
+				this.seq = seq;
+			}
+		}
+
+		GenericArray<Entry> heap = new GenericArray<Entry> ();
+		int limit;
+
+		// limit <= 0 means unbounded
+		public SearchResultHeap (int limit) {
+			this.limit = limit;
+		}
+
+		// Returns true if a is a worse result than b. On equal score, the later result comes first.
+		static bool worse (Entry a, Entry b) {
+			return a.score > b.score || (a.score == b.score && a.seq < b.seq);
+		}
+
+		void swap (int i, int j) {
+			var tmp = heap[i];
+			heap[i] = heap[j];
+			heap[j] = tmp;
+		}
+
+		void sift_up (int i) {
+			while (i > 0) {
+				var parent = (i-1)/2;
+				if (!worse (heap[i], heap[parent])) {
+					break;
+				}
+				swap (i, parent);
+				i = parent;
+			}
+		}
+
+		void sift_down (int i, int length) {
+			while (true) {
+				var worst = i;
+				var left = 2*i+1;
+				var right = left+1;
+				if (left < length && worse (heap[left], heap[worst])) {
+					worst = left;
+				}
+				if (right < length && worse (heap[right], heap[worst])) {
+					worst = right;
+				}
+				if (worst == i) {
+					break;
+				}
+				swap (i, worst);
+				i = worst;
+			}
+		}
+
+		public void add (SearchDocument doc, int score, int seq) {
+			var entry = new Entry (doc, score, seq);
+			if (limit <= 0 || heap.length < limit) {
+				heap.add (entry);
+				sift_up (heap.length-1);
+			} else if (worse (heap[0], entry)) {
+				// replace the worst result
+				heap[0] = entry;
+				sift_down (0, heap.length);
+			}
+		}
+
+		// Returns the results from the best to the worst, the heap is consumed
+		public List<SearchResultItem> to_list () {
+			var res = new List<SearchResultItem> ();
+			// pop the worst result each time
+			for (var length = heap.length; length > 0; length--) {
+				res.prepend (new SearchResultItem (heap[0].doc, heap[0].score));
+				swap (0, length-1);
+				sift_down (0, length-1);
+			}
+			heap = new GenericArray<Entry> ();
+			return res;
+		}
+	}
+
 	public class StringSearchIndex : SearchIndex<StringSearchDocument> {
 		HashTable<string, HashTable<SearchDocument, SearchDocument>> index = new HashTable<string, HashTable<SearchDocument, SearchDocument>> (str_hash, str_equal);
 		public HashTable<StringSearchDocument,HashTable<string, int>> documents = new HashTable<StringSearchDocument,HashTable<string, int>> (NamedSearchDocument.hash, NamedSearchDocument.equal);
 		public HashTable<string, string> synonyms = new HashTable<string, string> (str_hash, str_equal);
 
+		/* Candidate documents for fuzzy matching. A query word can only match a document word
+		 * if every pair of consecutive query characters appears in the same order in the document word,
+		 * thus we keep a posting list of document ids for each ordered character pair,
+		 * and for each single character. */
+		GenericArray<StringSearchDocument> doc_ids = new GenericArray<StringSearchDocument> ();
+		HashTable<StringSearchDocument, int> doc_id_map = new HashTable<StringSearchDocument, int> (NamedSearchDocument.hash, NamedSearchDocument.equal);
+		HashTable<uint, PostingList> postings = new HashTable<uint, PostingList> (direct_hash, direct_equal);
+
+		class PostingList {
+			// sorted document ids
+			public int[] ids;
+		}
+
+		const uint SINGLE_CHAR = 0x10000;
+
+		static uint pair_key (char a, char b) {
+			return (((uint) (uchar) a.tolower ()) << 8) | (uint) (uchar) b.tolower ();
+		}
+
+		static uint char_key (char a) {
+			return SINGLE_CHAR | (uint) (uchar) a.tolower ();
+		}
+
+		void add_posting (uint key, int id) {
+			unowned PostingList list = postings[key];
+			if (list == null) {
+				var newlist = new PostingList ();
+				list = newlist;
+				postings.insert (key, (owned) newlist);
+			}
+
+			// keep ids sorted and unique, usually the id is the greatest
+			var pos = list.ids.length;
+			while (pos > 0 && list.ids[pos-1] >= id) {
+				if (list.ids[pos-1] == id) {
+					return;
+				}
+				pos--;
+			}
+			list.ids += id;
+			for (var i=list.ids.length-1; i > pos; i--) {
+				list.ids[i] = list.ids[i-1];
+			}
+			list.ids[pos] = id;
+		}
+
+		void index_word_chars (string word, int id) {
+			var seen = new HashTable<uint, bool> (direct_hash, direct_equal);
+			for (var i=0; i < word.length; i++) {
+				var key = char_key (word[i]);
+				if (!(key in seen)) {
+					seen[key] = true;
+					add_posting (key, id);
+				}
+				for (var j=i+1; j < word.length; j++) {
+					key = pair_key (word[i], word[j]);
+					if (!(key in seen)) {
+						seen[key] = true;
+						add_posting (key, id);
+					}
+				}
+			}
+		}
+
+		static int[] intersect (int[] a, int[] b) {
+			int[] res = null;
+			var i = 0;
+			var j = 0;
+			while (i < a.length && j < b.length) {
+				if (a[i] < b[j]) {
+					i++;
+				} else if (a[i] > b[j]) {
+					j++;
+				} else {
+					res += a[i];
+					i++;
+					j++;
+				}
+			}
+			return res;
+		}
+
+		static int[] union (int[] a, int[] b) {
+			int[] res = null;
+			var i = 0;
+			var j = 0;
+			while (i < a.length || j < b.length) {
+				if (j >= b.length || (i < a.length && a[i] < b[j])) {
+					res += a[i++];
+				} else if (i >= a.length || b[j] < a[i]) {
+					res += b[j++];
+				} else {
+					res += a[i];
+					i++;
+					j++;
+				}
+			}
+			return res;
+		}
+
+		int[] all_ids () {
+			var res = new int[doc_ids.length];
+			for (var i=0; i < res.length; i++) {
+				res[i] = i;
+			}
+			return res;
+		}
+
+		// Returns the sorted ids of the documents that might match the given query word
+		int[] candidates (string qword) {
+			if (qword.length == 0) {
+				return all_ids ();
+			}
+
+			unowned PostingList list = postings[char_key (qword[0])];
+			if (list == null) {
+				return null;
+			}
+			int[] res = list.ids;
+			for (var i=1; i < qword.length && res.length > 0; i++) {
+				list = postings[pair_key (qword[i-1], qword[i])];
+				if (list == null) {
+					return null;
+				}
+				res = intersect (res, list.ids);
+			}
+			return res;
+		}
+
 		public void add_occurrence (string word, StringSearchDocument doc) {
 			unowned string syn = synonyms[word];
 			if (syn != null) {
@@ -108,8 +326,13 @@ namespace Vanubi {
 			if (wordsfreq == null) {
 				wordsfreq = new HashTable<string, int> (str_hash, str_equal);
 				documents[doc] = wordsfreq;
+				doc_id_map[doc] = doc_ids.length;
+				doc_ids.add (doc);
 			}
 			var wordfreq = wordsfreq[word];
+			if (wordfreq == 0) {
+				index_word_chars (word, doc_id_map[doc]);
+			}
 			wordsfreq[word] = wordfreq+1;
 		}
 		
@@ -118,20 +341,38 @@ namespace Vanubi {
 		}
 
 		/* include_partial false: the document must match all of the query terms
-		 * include_partial true:  the document must match at least one of the query terms */
-		public List<SearchResultItem> search (string query, bool include_partial) {
-			var res = new List<SearchResultItem> ();
+		 * include_partial true:  the document must match at least one of the query terms
+		 * limit > 0: return only the best limit results */
+		public List<SearchResultItem> search (string query, bool include_partial, int limit = 0) {
 			string[] qwords = query.split (" ");
-			foreach (var doc in documents.get_keys ()) {
+			for (var i=0; i < qwords.length; i++) {
+				unowned string syn = synonyms[qwords[i]];
+				if (syn != null) {
+					qwords[i] = syn;
+				}
+			}
+
+			// only fuzzy match the documents that might match
+			int[] ids = null;
+			for (var i=0; i < qwords.length; i++) {
+				var cands = candidates (qwords[i]);
+				if (i == 0) {
+					ids = cands;
+				} else if (include_partial) {
+					ids = union (ids, cands);
+				} else {
+					ids = intersect (ids, cands);
+				}
+			}
+
+			var heap = new SearchResultHeap (limit);
+			foreach (var id in ids) {
+				var doc = doc_ids[id];
 				var dwords = documents[doc];
 				var score = 0;
 				var word_matches = 0;
 				var is_partial = false;
 				foreach (unowned string qword in qwords) {
-					unowned string syn = synonyms[qword];
-					if (syn != null) {
-						qword = syn;
-					}
 					if (qword.length <= 0 && qword in StringSearchDocument.stopwords) {
 						continue;
 					}
@@ -155,10 +396,10 @@ namespace Vanubi {
 					}
 				}
 				if ((include_partial && word_matches > 0) || !is_partial) {
-					res.insert_sorted (new SearchResultItem (doc, score), (a,b) => a.score-b.score);
+					heap.add (doc, score, id);
 				}
 			}
-			return res;
+			return heap.to_list ();
 		}
 	}
 }
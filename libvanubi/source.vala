@@ -21,13 +21,101 @@ namespace Vanubi {
 	public class SourceInfo {
 		public DataSource source { get; private set; }
 		public bool is_directory { get; private set; }
+		// -1 when unknown
+		public int64 size { get; private set; default = -1; }
+		// seconds since the epoch, -1 when unknown
+		public int64 mtime { get; private set; default = -1; }
+		// microseconds since the epoch, -1 when unknown
+		public int64 mtime_usec { get; private set; default = -1; }
+		public uint mode { get; private set; default = 0; }
 		
 		public SourceInfo (DataSource source, bool is_directory) {
 			this.source = source;
 			this.is_directory = is_directory;
 		}
+		
+		public SourceInfo.with_stat (DataSource source, bool is_directory, int64 size, int64 mtime, uint mode, int64 mtime_usec = -1) {
+			this.source = source;
+			this.is_directory = is_directory;
+			this.size = size;
+			this.mtime = mtime;
+			if (mtime_usec < 0 && mtime >= 0) {
+				mtime_usec = mtime*1000000;
+			}
+			this.mtime_usec = mtime_usec;
+			this.mode = mode;
+		}
 	}
 			
+	/* A shell command spawned by a source, its output can be read while it runs */
+	public class ShellProcess : Object {
+		public InputStream stdout { get; protected set; }
+		public InputStream stderr { get; protected set; }
+		
+		bool exited = false;
+		int status = 0;
+		string? error_message = null;
+		// resumes the waiters
+		signal void process_exited ();
+		
+		protected ShellProcess () {
+		}
+		
+		/* A command that already exited, with its whole output */
+		public ShellProcess.finished (owned uint8[]? output, owned uint8[]? errors, int status) {
+			if (output == null) {
+				output = new uint8[0];
+			}
+			if (errors == null) {
+				errors = new uint8[0];
+			}
+			stdout = new MemoryInputStream.from_data ((owned) output);
+			stderr = new MemoryInputStream.from_data ((owned) errors);
+			set_exited (status);
+		}
+		
+		protected void set_exited (int status, string? error_message = null) {
+			this.status = status;
+			this.error_message = error_message;
+			exited = true;
+			process_exited ();
+		}
+		
+		/* Waits for the command to exit and returns its status, there may be several waiters.
+		 * Cancelling only stops waiting, the command keeps running. */
+		public async int wait (int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			if (!exited) {
+				var resumed = false;
+				SourceFunc callback = wait.callback;
+				SourceFunc resume = () => {
+					if (!resumed) {
+						resumed = true;
+						callback ();
+					}
+					return false;
+				};
+				var exited_id = process_exited.connect (() => { resume (); });
+				ulong cancelled_id = 0;
+				if (cancellable != null) {
+					// may be cancelled from another thread
+					cancelled_id = cancellable.connect (() => { Idle.add_full (io_priority, () => { return resume (); }); });
+				}
+				yield;
+				disconnect (exited_id);
+				if (cancellable != null) {
+					cancellable.disconnect (cancelled_id);
+				}
+				if (!exited) {
+					throw new IOError.CANCELLED ("Operation was cancelled");
+				}
+			}
+			if (error_message != null) {
+				throw new IOError.FAILED ("Error while executing shell command: %s".printf (error_message));
+			}
+			return status;
+		}
+	}
+	
 	public abstract class SourceIterator {
 		public abstract SourceInfo? next (Cancellable? cancellable = null) throws Error;
 	}
@@ -47,7 +135,42 @@ namespace Vanubi {
 		public abstract async void monitor (int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error;
 		
 		public abstract async bool is_directory (int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error;
-		public abstract async uint8[] execute_shell (string command_line, uint8[]? input = null, out uint8[] errors = null, out int status = null, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error;
+		/* Spawns the command in this directory, the input is written in background while the output is read */
+		public abstract async ShellProcess spawn_shell (string command_line, uint8[]? input = null, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error;
+		
+		/* Executes the command and waits for its whole output */
+		public virtual async uint8[] execute_shell (string command_line, uint8[]? input = null, out uint8[] errors = null, out int status = null, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			var proc = yield spawn_shell (command_line, input, io_priority, cancellable);
+			
+			// read both at once, the command may block writing either of them
+			uint8[]? errors_data = null;
+			Error? errors_error = null;
+			var errors_done = false;
+			SourceFunc? resume = null;
+			read_all_async.begin (proc.stderr, io_priority, cancellable, (s,r) => {
+					try {
+						errors_data = read_all_async.end (r);
+					} catch (Error e) {
+						errors_error = e;
+					}
+					errors_done = true;
+					if (resume != null) {
+						resume ();
+					}
+			});
+			var output = yield read_all_async (proc.stdout, io_priority, cancellable);
+			if (!errors_done) {
+				resume = execute_shell.callback;
+				yield;
+			}
+			if (errors_error != null) {
+				throw errors_error;
+			}
+			
+			errors = (owned) errors_data;
+			status = yield proc.wait (io_priority, cancellable);
+			return output;
+		}
 
 		public abstract DataSource child (string path);
 		public abstract SourceIterator iterate_children (Cancellable? cancellable = null) throws Error;
@@ -37,6 +37,32 @@ namespace Vanubi {
 		}
 	}
 	
+	public class LocalShellProcess : ShellProcess {
+		public LocalShellProcess (Pid pid, int stdin, int stdout, int stderr, owned uint8[]? input, int io_priority) {
+			this.stdout = new UnixInputStream (stdout, true);
+			this.stderr = new UnixInputStream (stderr, true);
+			ChildWatch.add (pid, (pid, status) => {
+					Process.close_pid (pid);
+					set_exited (status);
+			}, io_priority);
+			write_input.begin (new UnixOutputStream (stdin, true), (owned) input, io_priority);
+		}
+		
+		static async void write_input (UnixOutputStream os, owned uint8[]? input, int io_priority) {
+			try {
+				if (input != null) {
+					var offset = 0;
+					while (offset < input.length) {
+						offset += (int) yield os.write_async (input[offset:input.length], io_priority);
+					}
+				}
+				yield os.close_async (io_priority);
+			} catch (Error e) {
+				// the command did not read its input
+			}
+		}
+	}
+	
 	public class LocalFileSource : FileSource {
 		public File file { get; private set; }
 		FileMonitor _monitor;
@@ -179,48 +205,14 @@ namespace Vanubi {
 			}
 		}
 		
-		public override async uint8[] execute_shell (string command_line, uint8[]? input = null, out uint8[] errors = null, out int status = null, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+		public override async ShellProcess spawn_shell (string command_line, uint8[]? input = null, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
 			string[] argv = {"bash", "-c", command_line};
 			int stdin, stdout, stderr;
 			Pid child_pid;
 			yield spawn_async_with_pipes (to_string (), argv, null, SpawnFlags.SEARCH_PATH | SpawnFlags.DO_NOT_REAP_CHILD, null, Priority.DEFAULT, cancellable, out child_pid, out stdin, out stdout, out stderr);
-			
-			int st = 0xdead;
-			bool requires_resume = false;
-			ChildWatch.add (child_pid, (pid, sta) => {
-					// Triggered when the child indicated by child_pid exits
-					Process.close_pid (pid);
-					st = sta;
-					if (requires_resume) {
-						execute_shell.callback ();
-					}
-			}, io_priority);
-			
-			var os = new UnixOutputStream (stdin, true);
-			if (input != null) {
-				yield os.write_async (input, io_priority, cancellable);
-			}
-			os.close ();
-			
-			var is = new UnixInputStream (stdout, true);
-			var res = yield read_all_async (is, io_priority, cancellable);
-			
-			var eis = new UnixInputStream (stderr, true);
-			errors = yield read_all_async (is, io_priority, cancellable);
-			
-			is.close ();
-			eis.close ();
-			
-			if (st == 0xdead) {
-				requires_resume = true;
-				// wait till child watch
-				yield;
-			}
-			status = st;
-			return res;
+			return new LocalShellProcess (child_pid, stdin, stdout, stderr, input, io_priority);
 		}
 		
-		
 		public override DataSource child (string path) {
 			return new LocalFileSource (file.get_child (path));
 		}
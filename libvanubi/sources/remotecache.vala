@@ -0,0 +1,337 @@
+/*
+ *  Copyright © 2014 Luca Bruno
+ *
+ *  This file is part of Vanubi.
+ *
+ *  Vanubi is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Vanubi is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Vanubi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+namespace Vanubi {
+	/* Cache of the stat results and of the contents of the files of a remote connection.
+	 * Stat results expire after the ttl. Contents are keyed by path, size and mtime, so they are
+	 * revalidated with a stat. They are kept in memory and on disk across sessions, each within a budget. */
+	public class RemoteCache {
+		class CachedInfo {
+			// null if the file does not exist
+			public SourceInfo? info;
+			public int64 time;
+		}
+
+		class CachedContent {
+			public uint8[] data;
+			public int64 size;
+			public int64 mtime;
+		}
+
+		// prune expired stat results above this number of entries
+		const uint MAX_INFOS = 16384;
+		const string DISK_MAGIC = "vanubi-cache 1";
+
+		public int64 ttl { get; set; default = 5*TimeSpan.SECOND; }
+		public int64 memory_budget { get; private set; }
+		public int64 memory_used { get; private set; default = 0; }
+		public string? disk_dir { get; private set; }
+		public int64 disk_budget { get; private set; }
+		public int64 disk_used { get; private set; default = 0; }
+
+		HashTable<string, CachedInfo> infos = new HashTable<string, CachedInfo> (str_hash, str_equal);
+		// directories whose children are all in the cache
+		HashTable<string, int64?> listed = new HashTable<string, int64?> (str_hash, str_equal);
+		// the stat cache is also filled by the directory iterators, which run in threads
+		Mutex info_mutex = Mutex ();
+
+		HashTable<string, CachedContent> contents = new HashTable<string, CachedContent> (str_hash, str_equal);
+		LRU<string> contents_lru = new LRU<string> (str_hash, str_equal);
+
+		// size of the files on disk by name, loaded on the first use of the disk
+		HashTable<string, int64?> disk_sizes = null;
+		LRU<string> disk_lru = new LRU<string> (str_hash, str_equal);
+
+		/* disk_dir may be null to disable the disk cache */
+		public RemoteCache (int64 memory_budget, string? disk_dir, int64 disk_budget = 256*1024*1024) {
+			this.memory_budget = memory_budget;
+			this.disk_dir = disk_dir;
+			this.disk_budget = disk_budget;
+		}
+
+		public static string default_disk_dir (string ident) {
+			return Path.build_filename (Environment.get_user_cache_dir (), "vanubi", "remote", Uri.escape_string (ident, "@", false));
+		}
+
+		/* STAT RESULTS */
+
+		public void cache_info (string path, SourceInfo? info) {
+			var cached = new CachedInfo ();
+			cached.info = info;
+			cached.time = get_monotonic_time ();
+			info_mutex.lock ();
+			if (infos.size () >= MAX_INFOS) {
+				prune_infos ();
+			}
+			infos[path] = cached;
+			info_mutex.unlock ();
+		}
+
+		public void cache_listed (string path) {
+			info_mutex.lock ();
+			listed[path] = get_monotonic_time ();
+			info_mutex.unlock ();
+		}
+
+		/* Returns true if there's a valid stat result for the path, the info is null if the file does not exist */
+		public bool lookup_info (string path, out SourceInfo? info) {
+			info = null;
+			var found = false;
+			var now = get_monotonic_time ();
+			info_mutex.lock ();
+			var cached = infos[path];
+			if (cached != null) {
+				if (now-cached.time < ttl) {
+					info = cached.info;
+					found = true;
+				} else {
+					// the listing is no longer complete
+					infos.remove (path);
+					listed.remove (Path.get_dirname (path));
+				}
+			}
+			if (!found) {
+				// anything not in a recently listed directory does not exist
+				var time = listed[Path.get_dirname (path)];
+				found = time != null && now-(int64) time < ttl && Path.get_dirname (path) != path;
+			}
+			info_mutex.unlock ();
+			return found;
+		}
+
+		void prune_infos () {
+			var now = get_monotonic_time ();
+			infos.foreach_remove ((k, v) => {
+					if (now-v.time >= ttl) {
+						listed.remove (Path.get_dirname (k));
+						return true;
+					}
+					return false;
+			});
+			listed.foreach_remove ((k, v) => now-(int64) v >= ttl);
+		}
+
+		/* Forgets the stat result of the path, to check it again */
+		public void forget_info (string path) {
+			info_mutex.lock ();
+			infos.remove (path);
+			listed.remove (Path.get_dirname (path));
+			info_mutex.unlock ();
+		}
+
+		/* Forgets everything about the path, to be called when it gets modified */
+		public void invalidate (string path) {
+			forget_info (path);
+			remove_content (path);
+			remove_disk_content (path);
+		}
+
+		/* CONTENTS */
+
+		/* Returns the cached contents of the file, only if it still has the given size and mtime */
+		public async uint8[]? lookup_content (string path, int64 size, int64 mtime, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) {
+			var cached = contents[path];
+			if (cached != null) {
+				if (cached.size == size && cached.mtime == mtime) {
+					contents_lru.used (path);
+					if (disk_sizes != null && disk_name (path) in disk_sizes) {
+						disk_lru.used (disk_name (path));
+					}
+					return cached.data;
+				}
+				// stale, the disk has the same version
+				remove_content (path);
+				remove_disk_content (path);
+				return null;
+			}
+
+			if (disk_dir == null) {
+				return null;
+			}
+
+			// try the disk
+			uint8[] data;
+			try {
+				var file = File.new_for_path (disk_path (path));
+				yield file.load_contents_async (cancellable, out data, null);
+			} catch (Error e) {
+				return null;
+			}
+
+			var header_end = 0;
+			while (header_end < data.length && data[header_end] != '\n') {
+				header_end++;
+			}
+			if (header_end >= data.length) {
+				return null;
+			}
+			var header = ((string) data).substring (0, header_end);
+			if (header != "%s %s %s %s".printf (DISK_MAGIC, size.to_string (), mtime.to_string (), path)) {
+				// stale
+				remove_disk_content (path);
+				return null;
+			}
+
+			// the modification time orders the entries across sessions
+			FileUtils.utime (disk_path (path));
+			load_disk_index ();
+			add_disk_entry (disk_name (path), data.length);
+
+			uint8[] res = data[header_end+1:data.length];
+			add_content (path, res, size, mtime);
+			return res;
+		}
+
+		public async void store_content (string path, uint8[] data, int64 size, int64 mtime, int io_priority = GLib.Priority.DEFAULT) {
+			add_content (path, data, size, mtime);
+			if (disk_dir == null) {
+				return;
+			}
+
+			var header = "%s %s %s %s\n".printf (DISK_MAGIC, size.to_string (), mtime.to_string (), path);
+			if (header.length+data.length > disk_budget) {
+				// do not keep an older version
+				remove_disk_content (path);
+				return;
+			}
+			var buf = new uint8[header.length+data.length];
+			Memory.copy (buf, header, header.length);
+			Memory.copy (&buf[header.length], data, data.length);
+			try {
+				DirUtils.create_with_parents (disk_dir, 0700);
+				var file = File.new_for_path (disk_path (path));
+				yield file.replace_contents_async (buf, null, false, FileCreateFlags.PRIVATE, null, null);
+			} catch (Error e) {
+				warning ("Could not write remote file cache: %s", e.message);
+				return;
+			}
+
+			load_disk_index ();
+			add_disk_entry (disk_name (path), buf.length);
+			// evict the least recently used files
+			while (disk_used > disk_budget && disk_lru.length > 0) {
+				var name = disk_lru.tail;
+				remove_disk_entry (name);
+				FileUtils.unlink (Path.build_filename (disk_dir, name));
+			}
+		}
+
+		void add_content (string path, uint8[] data, int64 size, int64 mtime) {
+			remove_content (path);
+			if (data.length > memory_budget) {
+				return;
+			}
+
+			var cached = new CachedContent ();
+			cached.data = data;
+			cached.size = size;
+			cached.mtime = mtime;
+			contents[path] = cached;
+			contents_lru.append (path);
+			contents_lru.used (path);
+			memory_used += data.length;
+
+			// evict the least recently used contents
+			while (memory_used > memory_budget) {
+				remove_content (contents_lru.tail);
+			}
+		}
+
+		void remove_content (string path) {
+			var cached = contents[path];
+			if (cached != null) {
+				memory_used -= cached.data.length;
+				contents.remove (path);
+				contents_lru.remove (path);
+			}
+		}
+
+		void remove_disk_content (string path) {
+			if (disk_dir == null) {
+				return;
+			}
+			load_disk_index ();
+			remove_disk_entry (disk_name (path));
+			FileUtils.unlink (disk_path (path));
+		}
+
+		// Indexes the files written by the previous sessions, from the least recently used
+		void load_disk_index () {
+			if (disk_sizes != null) {
+				return;
+			}
+			disk_sizes = new HashTable<string, int64?> (str_hash, str_equal);
+
+			var entries = new GenericArray<FileInfo> ();
+			try {
+				var dir = Dir.open (disk_dir);
+				unowned string? name;
+				while ((name = dir.read_name ()) != null) {
+					if (name[0] == '.') {
+						// temporary files
+						continue;
+					}
+					try {
+						var info = File.new_for_path (Path.build_filename (disk_dir, name)).query_info (FileAttribute.STANDARD_SIZE+","+FileAttribute.TIME_MODIFIED, FileQueryInfoFlags.NONE);
+						info.set_name (name);
+						entries.add (info);
+					} catch (Error e) {
+					}
+				}
+			} catch (Error e) {
+				// not created yet
+				return;
+			}
+
+			entries.sort ((a, b) => {
+					var ta = a.get_attribute_uint64 (FileAttribute.TIME_MODIFIED);
+					var tb = b.get_attribute_uint64 (FileAttribute.TIME_MODIFIED);
+					return ta < tb ? -1 : (ta > tb ? 1 : 0);
+			});
+			foreach (var info in entries.data) {
+				add_disk_entry (info.get_name (), info.get_size ());
+			}
+		}
+
+		void add_disk_entry (string name, int64 size) {
+			remove_disk_entry (name);
+			disk_sizes[name] = size;
+			disk_lru.append (name);
+			disk_lru.used (name);
+			disk_used += size;
+		}
+
+		void remove_disk_entry (string name) {
+			var size = disk_sizes[name];
+			if (size != null) {
+				disk_used -= (int64) size;
+				disk_sizes.remove (name);
+				disk_lru.remove (name);
+			}
+		}
+
+		string disk_name (string path) {
+			return Checksum.compute_for_string (ChecksumType.SHA1, path);
+		}
+
+		string disk_path (string path) {
+			return Path.build_filename (disk_dir, disk_name (path));
+		}
+	}
+}
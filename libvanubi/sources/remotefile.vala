@@ -45,10 +45,21 @@ namespace Vanubi {
 		List<SocketConnection> pool = new List<SocketConnection> ();
 		AsyncMutex mutex = new AsyncMutex ();
 		
-		public RemoteConnection (owned string ident) {
+		/* Stat results and contents of the remote files */
+		public RemoteCache cache { get; private set; }
+		
+		/* Set when the agent speaks the multiplexed protocol, then the pool is not used */
+		public RemoteMux? mux { get; private set; }
+		
+		public RemoteConnection (owned string ident, int64 cache_memory = 64*1024*1024, int64 cache_disk = 256*1024*1024) {
+			cache = new RemoteCache (cache_memory, RemoteCache.default_disk_dir (ident), cache_disk);
 			this.ident = (owned) ident;
 		}
 		
+		public void set_mux (owned SocketConnection conn, owned AsyncDataInputStream is, bool compress) {
+			mux = new RemoteMux ((owned) conn, (owned) is, compress);
+		}
+		
 		public void add_connection (owned SocketConnection conn) {
 			conn.set_data ("acquired", false);
 			pool.append ((owned) conn);
@@ -296,7 +307,7 @@ namespace Vanubi {
 	}
 	
 	public class RemoteFileSource : FileSource {
-		RemoteConnection remote;
+		internal RemoteConnection remote;
 		File local;
 		
 		public RemoteFileSource (string local_path, owned RemoteConnection remote) {
@@ -327,7 +338,66 @@ namespace Vanubi {
 			}
 		}
 		
+		/* Returns the stat result from the cache, or asks the agent. Returns null if the file does not exist. */
+		public async SourceInfo? stat (int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			SourceInfo? info;
+			if (remote.cache.lookup_info (local_path, out info)) {
+				return info;
+			}
+			if (remote.mux == null) {
+				throw new IOError.NOT_SUPPORTED ("Remote stat not supported by the agent");
+			}
+			
+			var req = yield remote.mux.request ({"stat", local_path}, io_priority, cancellable);
+			var res = yield req.read_result (io_priority, cancellable);
+			info = parse_stat (this, res);
+			remote.cache.cache_info (local_path, info);
+			return info;
+		}
+		
+		/* Parses "<type> <size> <mtime> <mode>" as sent by the agent, or "none" */
+		internal static SourceInfo? parse_stat (DataSource source, string res) throws Error {
+			if (res == "none") {
+				return null;
+			}
+			var fields = res.split (" ");
+			if (fields.length < 4) {
+				throw new IOError.INVALID_DATA ("Invalid remote stat reply: %s", res);
+			}
+			return stat_from_fields (source, fields);
+		}
+
+		/* The mtime has a fractional part with the newer agents */
+		internal static SourceInfo stat_from_fields (DataSource source, string[] fields) {
+			var mtime = double.parse (fields[2]);
+			var mtime_usec = mtime >= 0 ? (int64) (mtime*1000000) : -1;
+			return new SourceInfo.with_stat (source, fields[0] == "d", int64.parse (fields[1]), (int64) mtime, (uint) uint64.parse (fields[3]), mtime_usec);
+		}
+		
 		public override async InputStream read (int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			if (remote.mux != null) {
+				// revalidate the cached contents against a fresh stat, the cached one may be outdated
+				var cache = remote.cache;
+				var path = local_path;
+				cache.forget_info (path);
+				var info = yield stat (io_priority, cancellable);
+				if (info == null) {
+					throw new IOError.NOT_FOUND ("Remote file not found: %s", local_path);
+				}
+				var data = yield cache.lookup_content (path, info.size, info.mtime_usec, io_priority, cancellable);
+				if (data != null) {
+					return new MemoryInputStream.from_data ((owned) data);
+				}
+				
+				var req = yield remote.mux.request ({"read", path}, io_priority, cancellable);
+				var size = info.size;
+				var mtime = info.mtime_usec;
+				// the contents are cached once completely read
+				return new RemoteMuxInputStream (req, cache.memory_budget, (contents) => {
+						cache.store_content.begin (path, contents, size, mtime);
+				});
+			}
+			
 			var chan = yield remote.acquire (io_priority, cancellable);
 			var os = chan.output_stream;
 			var cmd = "read\n%s\n".printf (local_path);
@@ -338,6 +408,11 @@ namespace Vanubi {
 		}
 		
 		public override async bool exists (int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			if (remote.mux != null) {
+				var info = yield stat (io_priority, cancellable);
+				return info != null;
+			}
+			
 			var chan = yield remote.acquire (io_priority, cancellable);
 			var os = chan.output_stream;
 			var cmd = "exists\n%s\n".printf (local_path);
@@ -346,6 +421,7 @@ namespace Vanubi {
 			
 			var is = chan.input_stream;
 			var res = yield is.read_line_async (io_priority, cancellable);
+			
 			if (res == "true") {
 				return true;
 			} else if (res == "false") {
@@ -360,14 +436,107 @@ namespace Vanubi {
 		}
 
 		public override async TimeVal? get_mtime (int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) {
-			return null;
+			if (remote.mux == null) {
+				return null;
+			}
+			
+			SourceInfo? info;
+			try {
+				info = yield stat (io_priority, cancellable);
+			} catch (Error e) {
+				return null;
+			}
+			if (info == null || info.mtime < 0) {
+				return null;
+			}
+			var tv = TimeVal ();
+			tv.tv_sec = (long) info.mtime;
+			tv.tv_usec = 0;
+			return tv;
 		}
 		
+		/* There are no notifications from the agent, poll the stat instead */
+		const uint MONITOR_INTERVAL = 5;
+		uint monitor_timer = 0;
+		
 		public override async void monitor (int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			if (remote.mux == null || monitor_timer != 0) {
+				return;
+			}
+			
+			var info = yield stat (io_priority, cancellable);
+			if (monitor_timer == 0) {
+				monitor_timer = start_polling (this, info);
+			}
 		}
 		
+		// static to not keep the source alive, the timer is removed when the source is destroyed
+		static uint start_polling (RemoteFileSource source, SourceInfo? info) {
+			unowned RemoteFileSource unowned_source = source;
+			var last = info;
+			var polling = false;
+			return Timeout.add_seconds (MONITOR_INTERVAL, () => {
+					if (polling) {
+						return true;
+					}
+					
+					polling = true;
+					unowned_source.remote.cache.forget_info (unowned_source.local_path);
+					unowned_source.stat.begin (Priority.LOW, null, (s,r) => {
+							polling = false;
+							var source = (RemoteFileSource) s;
+							try {
+								var cur = source.stat.end (r);
+								if ((cur == null) != (last == null) || (cur != null && (cur.mtime != last.mtime || cur.size != last.size))) {
+									last = cur;
+									source.changed (null);
+								}
+							} catch (Error e) {
+							}
+					});
+					return true;
+			});
+		}
+		
+		~RemoteFileSource () {
+			if (monitor_timer != 0) {
+				Source.remove (monitor_timer);
+			}
+		}
+		
+		// smaller files are always sent whole
+		const int DELTA_THRESHOLD = 64*1024;
+		
 		public override async void write (uint8[] data, bool atomic, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
-			// TODO: honor atomic
+			remote.cache.invalidate (local_path);
+			if (remote.mux != null) {
+				try {
+					var done = false;
+					if (data.length >= DELTA_THRESHOLD) {
+						try {
+							yield write_delta (data, atomic, io_priority, cancellable);
+							done = true;
+						} catch (IOError.CANCELLED e) {
+							throw e;
+						} catch (Error e) {
+							// send the whole file
+						}
+					}
+					
+					if (!done) {
+						var req = yield remote.mux.request ({"write", local_path, atomic ? "1" : "0"}, io_priority, cancellable);
+						yield req.send_data (data, io_priority, cancellable);
+						yield req.send_end (io_priority, cancellable);
+						yield req.read_result (io_priority, cancellable);
+					}
+				} finally {
+					// the agent may have been slow, forget any stat done in the meantime
+					remote.cache.invalidate (local_path);
+				}
+				return;
+			}
+			
+			// the old agents always write to a temporary file and rename it
 			
 			var chan = yield remote.acquire (io_priority, cancellable);
 			var os = chan.output_stream;
@@ -393,7 +562,38 @@ namespace Vanubi {
 			}
 		}
 		
+		/* Sends only the blocks that are not in the remote copy, the agent checks the result against the md5 */
+		async void write_delta (uint8[] data, bool atomic, int io_priority, Cancellable? cancellable) throws Error {
+			var md5 = Checksum.compute_for_data (ChecksumType.MD5, data);
+			var req = yield remote.mux.request ({"delta", local_path, atomic ? "1" : "0", data.length.to_string (), md5}, io_priority, cancellable);
+			
+			// the agent first sends the signature of its copy
+			var sigdata = new ByteArray ();
+			int64 sigsize = DeltaSignature.HEADER_SIZE;
+			while (sigdata.len < sigsize) {
+				var frame = yield req.read_frame (io_priority, cancellable);
+				if (frame.type != RemoteFrameType.DATA) {
+					throw new IOError.INVALID_DATA ("Invalid remote frame while reading the delta signature: %d".printf (frame.type));
+				}
+				sigdata.append (frame.payload);
+				if (sigdata.len >= DeltaSignature.HEADER_SIZE) {
+					sigsize = DeltaSignature.data_size (sigdata.data);
+				}
+			}
+			var sig = new DeltaSignature.parse (sigdata.data);
+			
+			var delta = yield run_in_thread<ByteArray> (() => { return compute_delta (sig, data); }, io_priority);
+			yield req.send_data (delta.data, io_priority, cancellable);
+			yield req.send_end (io_priority, cancellable);
+			yield req.read_result (io_priority, cancellable);
+		}
+		
 		public override async bool is_directory (int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			if (remote.mux != null) {
+				var info = yield stat (io_priority, cancellable);
+				return info != null && info.is_directory;
+			}
+			
 			var chan = yield remote.acquire (io_priority, cancellable);
 			var os = chan.output_stream;
 			var cmd = "is directory\n%s\n".printf (local_path);
@@ -402,6 +602,7 @@ namespace Vanubi {
 			
 			var is = chan.input_stream;
 			var res = yield is.read_line_async (io_priority, cancellable);
+			
 			if (res == "true") {
 				return true;
 			} else if (res == "false") {
@@ -414,6 +615,10 @@ namespace Vanubi {
 		public override async uint8[] execute_shell (string command_line, uint8[]? input = null, out uint8[] stderr = null, out int status = null, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
 			stderr = null;
 			
+			if (remote.mux != null) {
+				return yield base.execute_shell (command_line, input, out stderr, out status, io_priority, cancellable);
+			}
+			
 			var chan = yield remote.acquire (io_priority, cancellable);
 			var os = chan.output_stream;
 			var cmd = "execute\n%s\n%s\n".printf (local_path, command_line);
@@ -492,11 +697,29 @@ namespace Vanubi {
 			return stdout;
 		}
 		
+		public override async ShellProcess spawn_shell (string command_line, uint8[]? input = null, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			if (remote.mux == null) {
+				// the old protocol can only return the whole output
+				uint8[] errors;
+				int status;
+				var output = yield execute_shell (command_line, input, out errors, out status, io_priority, cancellable);
+				return new ShellProcess.finished ((owned) output, (owned) errors, status);
+			}
+			
+			var req = yield remote.mux.request ({"execute", local_path, command_line}, io_priority, cancellable);
+			return new RemoteShellProcess (req, input, io_priority);
+		}
+		
 		public override DataSource child (string path) {
 			return new RemoteFileSource (local.get_child(path).get_path(), remote);
 		}
 		
 		public override SourceIterator iterate_children (Cancellable? cancellable = null) throws Error {
+			if (remote.mux != null) {
+				var req = remote.mux.request_sync ({"list", local_path, RemoteMuxFileIterator.LIST_WINDOW.to_string ()}, cancellable);
+				return new RemoteMuxFileIterator (this, req);
+			}
+			
 			var chan = remote.acquire_sync (cancellable);
 			var os = chan.output_stream;
 			var cmd = "iterate children\n%s\n".printf (local_path);
@@ -567,19 +790,44 @@ namespace Vanubi {
 		HashTable<RemoteIdent, RemoteConnection> conns = new HashTable<RemoteIdent, RemoteConnection> (RemoteIdent.hash, RemoteIdent.equal);
 		Configuration conf;
 		
+		public const int PROTOCOL_VERSION = 2;
+		
 		public signal void open_file (RemoteFileSource file);
 		
+		public List<unowned RemoteConnection> connections {
+			owned get {
+				return conns.get_values ();
+			}
+		}
+		
 		public RemoteFileServer (owned Configuration conf) throws Error {
 			add_inet_port ((uint16) conf.get_global_int ("remote_service_port", 62518), null);
 			this.conf = (owned) conf;
 		}
 
-		async string read_version (owned SocketConnection conn, owned AsyncDataInputStream is) throws Error {
+		/* The agent sends the highest protocol version it supports.
+		 * Version 1 uses a pool of connections with line based requests, and expects no answer.
+		 * From version 2 on we reply with the version to use, the agent then opens a single multiplexed connection.
+		 * The version may be followed by "zlib" if the agent can compress frames, we reply the same if we agree. */
+		async int read_version (owned SocketConnection conn, owned AsyncDataInputStream is, out bool compress) throws Error {
+			compress = false;
 			var ver = yield is.read_line_async ();
 			if (ver == null || ver == "") {
 				throw new IOError.PARTIAL_INPUT ("Expected protocol version");
 			}
-			return ver;
+			
+			var fields = ver.split (" ");
+			var version = int.parse (fields[0]);
+			if (version < 1) {
+				throw new IOError.INVALID_ARGUMENT ("Invalid protocol version: %s", ver);
+			}
+			if (version >= 2) {
+				version = int.min (version, PROTOCOL_VERSION);
+				compress = "zlib" in fields[1:fields.length] && conf.get_global_bool ("remote_compression", true);
+				yield conn.output_stream.write_async ("%d%s\n".printf (version, compress ? " zlib" : "").data);
+				yield conn.output_stream.flush_async ();
+			}
+			return version;
 		}
 		
 		async string read_ident (owned SocketConnection conn, owned AsyncDataInputStream is, out bool is_main) throws Error {
@@ -623,7 +871,8 @@ namespace Vanubi {
 		
 		async void handle_client (owned SocketConnection conn) throws Error {
 			var is = new AsyncDataInputStream (conn.input_stream);
-			string version = yield read_version (conn, is);
+			bool compress;
+			int version = yield read_version (conn, is, out compress);
 			bool is_main;
 			string ident = yield read_ident (conn, is, out is_main);
 			
@@ -631,13 +880,17 @@ namespace Vanubi {
 			var remote_ident = new RemoteIdent (inet, ident);
 			var remote_connection = conns[remote_ident];
 			if (remote_connection == null) {
-				remote_connection = new RemoteConnection (ident);
+				remote_connection = new RemoteConnection (ident, (int64) conf.get_global_int ("remote_cache_memory", 64)*1024*1024,
+														  (int64) conf.get_global_int ("remote_cache_disk", 256)*1024*1024);
 				conns[remote_ident] = remote_connection;
 			}
 			
 			if (is_main) {
 				// use this connection to handle remote requests
 				yield handle_remote_requests (remote_connection, conn, is);
+			} else if (version >= 2) {
+				// all user requests go through this connection
+				remote_connection.set_mux (conn, is, compress);
 			} else {
 				// add connection to the pool for handling user requests
 				remote_connection.add_connection (conn);
@@ -0,0 +1,665 @@
+/*
+ *  Copyright © 2014 Luca Bruno
+ *
+ *  This file is part of Vanubi.
+ *
+ *  Vanubi is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Vanubi is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Vanubi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Protocol version 2: many requests are multiplexed over a single connection.
+ *
+ * Each frame is: request id (uint32) | type (uint8) | payload length (uint32) | payload
+ * Integers are big endian.
+ *
+ * REQUEST: starts a request, the payload is the command and its arguments separated by '\0'
+ * DATA: a chunk of the request data, either way (file contents, stdin, stdout, directory entries)
+ * STDERR: a chunk of the stderr of an executed command
+ * END: end of the data, either way. When sent by the agent the payload is the result of the request
+ * ERROR: the request failed, the payload is the error message
+ * CANCEL: the client is no longer interested in the request
+ * CREDIT: the client allows the agent to send more bytes of DATA, the payload is the number of bytes
+ *
+ * When compression has been negotiated with the version, the COMPRESSED bit may be set in the type
+ * and the payload is then zlib compressed. Either side only compresses frames worth it.
+ *
+ * Replies to different requests may be interleaved and come in any order. */
+namespace Vanubi {
+	public enum RemoteFrameType {
+		REQUEST = 1,
+		DATA,
+		STDERR,
+		END,
+		ERROR,
+		CANCEL,
+		CREDIT
+	}
+
+	public class RemoteFrame {
+		public RemoteFrameType type;
+		public uint8[] payload;
+
+		public RemoteFrame (RemoteFrameType type, owned uint8[] payload) {
+			this.type = type;
+			this.payload = (owned) payload;
+		}
+
+		public string text {
+			owned get {
+				if (payload.length == 0) {
+					return "";
+				}
+				return ((string) payload).substring (0, payload.length);
+			}
+		}
+	}
+
+	public class RemoteRequest {
+		public uint id { get; private set; }
+		RemoteMux mux;
+		Queue<RemoteFrame> frames = new Queue<RemoteFrame> ();
+		SourceFunc? waiting = null;
+		bool finished = false;
+
+		internal RemoteRequest (RemoteMux mux, uint id) {
+			this.mux = mux;
+			this.id = id;
+		}
+
+		internal void push (RemoteFrame frame) {
+			if (frame.type == RemoteFrameType.END || frame.type == RemoteFrameType.ERROR) {
+				finished = true;
+			}
+			frames.push_tail (frame);
+			wake ();
+		}
+
+		internal void wake () {
+			if (waiting != null) {
+				SourceFunc cb = (owned) waiting;
+				waiting = null;
+				cb ();
+			}
+		}
+
+		/* Waits for the next frame of the reply. ERROR frames are thrown. */
+		public async RemoteFrame read_frame (int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			ulong cancel_id = 0;
+			if (cancellable != null) {
+				cancel_id = cancellable.connect (() => {
+						Idle.add_full (io_priority, () => { wake (); return false; });
+				});
+			}
+
+			try {
+				while (frames.is_empty ()) {
+					if (cancellable != null && cancellable.is_cancelled ()) {
+						yield cancel ();
+						cancellable.set_error_if_cancelled ();
+					}
+					if (mux.error != null) {
+						throw mux.error.copy ();
+					}
+					waiting = read_frame.callback;
+					yield;
+				}
+			} finally {
+				if (cancel_id != 0) {
+					cancellable.disconnect (cancel_id);
+				}
+			}
+
+			var frame = frames.pop_head ();
+			if (frame.type == RemoteFrameType.ERROR) {
+				throw new IOError.FAILED ("Remote error: %s".printf (frame.text));
+			}
+			return frame;
+		}
+
+		public RemoteFrame read_frame_sync (Cancellable? cancellable = null) throws Error {
+			RemoteFrame? ret = null;
+			Error err = null;
+			var complete = false;
+
+			Mutex mutex = Mutex ();
+			Cond cond = Cond ();
+			mutex.lock ();
+
+			Idle.add (() => {
+					read_frame.begin (Priority.DEFAULT, cancellable, (s,r) => {
+							try {
+								ret = read_frame.end (r);
+							} catch (Error e) {
+								err = e;
+							} finally {
+								mutex.lock ();
+								complete = true;
+								cond.signal ();
+								mutex.unlock ();
+							}
+					});
+					return false;
+			});
+
+			while (!complete) {
+				cond.wait (mutex);
+			}
+			mutex.unlock ();
+
+			if (err != null) {
+				throw err;
+			}
+			return ret;
+		}
+
+		/* Reads frames until the END of the reply, returns its payload */
+		public async string read_result (int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			while (true) {
+				var frame = yield read_frame (io_priority, cancellable);
+				if (frame.type == RemoteFrameType.END) {
+					return frame.text;
+				}
+			}
+		}
+
+		/* Sends the data in frames of at most MAX_PAYLOAD bytes */
+		public async void send_data (uint8[] data, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			for (var offset = 0; offset < data.length; offset += RemoteMux.MAX_PAYLOAD) {
+				var end = int.min (offset+RemoteMux.MAX_PAYLOAD, data.length);
+				yield mux.send_frame (id, RemoteFrameType.DATA, data[offset:end], io_priority, cancellable);
+			}
+		}
+
+		public async void send_end (int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			yield mux.send_frame (id, RemoteFrameType.END, new uint8[0], io_priority, cancellable);
+		}
+
+		/* Allows the agent to send more data, for requests with flow control */
+		public async void send_credit (int bytes, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			if (!finished) {
+				yield mux.send_frame (id, RemoteFrameType.CREDIT, bytes.to_string ().data, io_priority, cancellable);
+			}
+		}
+
+		public async void cancel () {
+			if (!finished) {
+				finished = true;
+				yield mux.cancel_request (id);
+			}
+		}
+	}
+
+	/* A single connection to the agent, shared by all the requests */
+	public class RemoteMux {
+		public const int MAX_PAYLOAD = 65536;
+		public const uint8 COMPRESSED = 0x80;
+		// smaller payloads are sent as they are
+		const int COMPRESS_THRESHOLD = 512;
+
+		SocketConnection conn;
+		AsyncDataInputStream is;
+		OutputStream os;
+		AsyncMutex write_mutex = new AsyncMutex ();
+		// pending requests, until the reply is complete or they get cancelled
+		HashTable<uint, RemoteRequest> requests = new HashTable<uint, RemoteRequest> (null, null);
+		uint next_id = 1;
+		public Error? error { get; private set; }
+		public bool compress { get; private set; }
+		
+		// payload bytes before compression and as sent over the connection
+		public uint64 data_sent { get; private set; default = 0; }
+		public uint64 wire_sent { get; private set; default = 0; }
+		public uint64 data_received { get; private set; default = 0; }
+		public uint64 wire_received { get; private set; default = 0; }
+
+		public RemoteMux (owned SocketConnection conn, owned AsyncDataInputStream is, bool compress = false) {
+			this.compress = compress;
+			this.os = conn.output_stream;
+			this.conn = (owned) conn;
+			this.is = (owned) is;
+			read_frames.begin ();
+		}
+
+		public async RemoteRequest request (string[] args, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			if (error != null) {
+				throw error.copy ();
+			}
+
+			var id = next_id++;
+			if (next_id == 0) {
+				next_id = 1;
+			}
+			var req = new RemoteRequest (this, id);
+			requests.insert (id, req);
+
+			var b = new StringBuilder ();
+			foreach (unowned string arg in args) {
+				b.append (arg);
+				b.append_c ('\0');
+			}
+			yield send_frame (id, RemoteFrameType.REQUEST, b.data, io_priority, cancellable);
+			return req;
+		}
+
+		public RemoteRequest request_sync (string[] args, Cancellable? cancellable = null) throws Error {
+			RemoteRequest? ret = null;
+			Error err = null;
+			var complete = false;
+
+			Mutex mutex = Mutex ();
+			Cond cond = Cond ();
+			mutex.lock ();
+
+			Idle.add (() => {
+					request.begin (args, Priority.DEFAULT, cancellable, (s,r) => {
+							try {
+								ret = request.end (r);
+							} catch (Error e) {
+								err = e;
+							} finally {
+								mutex.lock ();
+								complete = true;
+								cond.signal ();
+								mutex.unlock ();
+							}
+					});
+					return false;
+			});
+
+			while (!complete) {
+				cond.wait (mutex);
+			}
+			mutex.unlock ();
+
+			if (err != null) {
+				throw err;
+			}
+			return ret;
+		}
+
+		internal async void send_frame (uint id, RemoteFrameType type, uint8[] payload, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			uint8 flags = 0;
+			unowned uint8[] wire_payload = payload;
+			uint8[]? compressed = null;
+			if (compress && payload.length >= COMPRESS_THRESHOLD && payload.length <= MAX_PAYLOAD) {
+				compressed = deflate (payload);
+				if (compressed != null) {
+					wire_payload = compressed;
+					flags = COMPRESSED;
+				}
+			}
+			data_sent += payload.length;
+			wire_sent += wire_payload.length;
+			
+			// write the whole frame at once, frames of different requests must not interleave
+			var frame = new uint8[9+wire_payload.length];
+			write_uint32 (frame, 0, id);
+			frame[4] = (uint8) type | flags;
+			write_uint32 (frame, 5, wire_payload.length);
+			Memory.copy (&frame[9], wire_payload, wire_payload.length);
+
+			yield write_mutex.acquire (io_priority, cancellable);
+			try {
+				var offset = 0;
+				while (offset < frame.length) {
+					offset += (int) yield os.write_async (frame[offset:frame.length], io_priority, cancellable);
+				}
+				yield os.flush_async (io_priority, cancellable);
+			} finally {
+				write_mutex.release ();
+			}
+		}
+
+		// the request is removed right away, the replies still on their way will be dropped
+		internal async void cancel_request (uint id) {
+			requests.remove (id);
+			if (error == null) {
+				try {
+					yield send_frame (id, RemoteFrameType.CANCEL, new uint8[0]);
+				} catch (Error e) {
+				}
+			}
+		}
+
+		/* Returns null if the payload does not shrink */
+		static uint8[]? deflate (uint8[] payload) {
+			var compressor = new ZlibCompressor (ZlibCompressorFormat.ZLIB, -1);
+			var res = new uint8[payload.length];
+			size_t read, written;
+			try {
+				if (compressor.convert (payload, res, ConverterFlags.INPUT_AT_END, out read, out written) != ConverterResult.FINISHED) {
+					return null;
+				}
+			} catch (Error e) {
+				// no space left, incompressible
+				return null;
+			}
+			res.resize ((int) written);
+			return res;
+		}
+		
+		static uint8[] inflate (uint8[] payload) throws Error {
+			var decompressor = new ZlibDecompressor (ZlibCompressorFormat.ZLIB);
+			var res = new uint8[MAX_PAYLOAD];
+			size_t read, written;
+			if (decompressor.convert (payload, res, ConverterFlags.INPUT_AT_END, out read, out written) != ConverterResult.FINISHED) {
+				throw new IOError.INVALID_DATA ("Invalid compressed remote frame");
+			}
+			res.resize ((int) written);
+			return res;
+		}
+		
+		static void write_uint32 (uint8[] buf, int offset, uint32 val) {
+			buf[offset] = (uint8) (val >> 24);
+			buf[offset+1] = (uint8) (val >> 16);
+			buf[offset+2] = (uint8) (val >> 8);
+			buf[offset+3] = (uint8) val;
+		}
+
+		async void read_frames () {
+			try {
+				while (true) {
+					var id = yield is.read_uint32_async ();
+					var type = yield is.read_byte_async ();
+					var length = yield is.read_uint32_async ();
+					if (length > MAX_PAYLOAD*16) {
+						throw new IOError.INVALID_DATA ("Remote frame too big: %u bytes".printf (length));
+					}
+					var payload = new uint8[length];
+					yield is.read_exactly_async (payload);
+					wire_received += length;
+					if ((type & COMPRESSED) != 0) {
+						payload = inflate (payload);
+						type = (uint8) (type & ~COMPRESSED);
+					}
+					data_received += payload.length;
+
+					// replies to cancelled requests are dropped
+					var req = requests[id];
+					if (req != null) {
+						if (type == RemoteFrameType.END || type == RemoteFrameType.ERROR) {
+							requests.remove (id);
+						}
+						req.push (new RemoteFrame ((RemoteFrameType) type, (owned) payload));
+					}
+				}
+			} catch (Error e) {
+				error = e;
+				warning ("Closing remote connection: %s", e.message);
+				try {
+					conn.close ();
+				} catch (Error e) {
+				}
+				// wake up all the pending requests
+				foreach (unowned RemoteRequest req in requests.get_values ()) {
+					req.wake ();
+				}
+				requests.remove_all ();
+			}
+		}
+	}
+
+	// called in the main loop
+	public delegate void RemoteContentsFunc (uint8[] contents);
+
+	/* The output of the execute request is pushed to the streams as it arrives */
+	public class RemoteShellProcess : ShellProcess {
+		RemoteRequest req;
+		QueueInputStream out_queue = new QueueInputStream ();
+		QueueInputStream err_queue = new QueueInputStream ();
+		
+		public RemoteShellProcess (RemoteRequest req, owned uint8[]? input, int io_priority) {
+			this.req = req;
+			stdout = out_queue;
+			stderr = err_queue;
+			cancel_on_close (out_queue, req);
+			
+			send_input.begin ((owned) input, io_priority);
+			read_output.begin (io_priority);
+		}
+		
+		// stop the command if the output is no longer wanted, static to not keep the process alive
+		static void cancel_on_close (QueueInputStream stream, RemoteRequest req) {
+			stream.closed.connect (() => { req.cancel.begin (); });
+		}
+		
+		async void send_input (owned uint8[]? input, int io_priority) {
+			try {
+				if (input != null) {
+					yield req.send_data (input, io_priority);
+				}
+				yield req.send_end (io_priority);
+			} catch (Error e) {
+			}
+		}
+		
+		async void read_output (int io_priority) {
+			try {
+				while (true) {
+					var frame = yield req.read_frame (io_priority);
+					if (frame.type == RemoteFrameType.DATA) {
+						out_queue.push ((owned) frame.payload);
+					} else if (frame.type == RemoteFrameType.STDERR) {
+						err_queue.push ((owned) frame.payload);
+					} else if (frame.type == RemoteFrameType.END) {
+						out_queue.push_end ();
+						err_queue.push_end ();
+						set_exited (int.parse (frame.text));
+						return;
+					} else {
+						throw new IOError.INVALID_DATA ("Invalid remote frame while executing shell command: %d".printf (frame.type));
+					}
+				}
+			} catch (Error e) {
+				out_queue.push_end (e.message);
+				err_queue.push_end (e.message);
+				set_exited (-1, e.message);
+			}
+		}
+	}
+
+	/* Contents of a remote file, as sent by the read request */
+	public class RemoteMuxInputStream : InputStream {
+		RemoteRequest req;
+		RemoteFrame? frame = null;
+		int frame_offset = 0;
+		bool at_end = false;
+		// collect the whole contents up to tee_limit bytes, for caching
+		MemoryOutputStream? tee = null;
+		int64 tee_limit;
+		RemoteContentsFunc? on_complete;
+
+		public RemoteMuxInputStream (owned RemoteRequest req, int64 tee_limit = 0, owned RemoteContentsFunc? on_complete = null) {
+			this.req = (owned) req;
+			this.tee_limit = tee_limit;
+			this.on_complete = (owned) on_complete;
+			if (this.on_complete != null) {
+				tee = new MemoryOutputStream.resizable ();
+			}
+		}
+
+		~RemoteMuxInputStream () {
+			if (!at_end) {
+				// the stream may be unreferenced in a thread
+				var req = this.req;
+				Idle.add (() => { req.cancel.begin (); return false; });
+			}
+		}
+
+		public override bool close (Cancellable? cancellable = null) throws IOError {
+			if (!at_end) {
+				req.cancel.begin ();
+			}
+			return true;
+		}
+
+		public override async bool close_async (int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws IOError {
+			if (!at_end) {
+				yield req.cancel ();
+			}
+			return true;
+		}
+
+		// copies the current frame, returns -1 if a new frame is needed
+		ssize_t consume (uint8[] buffer) {
+			if (at_end) {
+				return 0;
+			}
+			if (frame == null || frame_offset >= frame.payload.length) {
+				return -1;
+			}
+			var n = int.min (buffer.length, frame.payload.length-frame_offset);
+			Memory.copy (buffer, &frame.payload[frame_offset], n);
+			frame_offset += n;
+			return n;
+		}
+
+		void set_frame (RemoteFrame frame) throws IOError {
+			if (frame.type == RemoteFrameType.END) {
+				at_end = true;
+				if (tee != null) {
+					tee.close ();
+					// the stream may be read in a thread, the callback runs in the main loop
+					var data = tee.steal_data ();
+					Idle.add (() => { on_complete (data); return false; });
+					tee = null;
+				}
+			} else if (frame.type != RemoteFrameType.DATA) {
+				throw new IOError.INVALID_DATA ("Invalid remote frame while reading file: %d".printf (frame.type));
+			} else if (tee != null) {
+				if (tee.get_data_size ()+frame.payload.length > tee_limit) {
+					// too big to be cached
+					tee = null;
+				} else {
+					tee.write (frame.payload);
+				}
+			}
+			this.frame = frame;
+			frame_offset = 0;
+		}
+
+		public override ssize_t read ([CCode (array_length_type = "gsize")] uint8[] buffer, GLib.Cancellable? cancellable = null) throws IOError {
+			while (true) {
+				var res = consume (buffer);
+				if (res >= 0) {
+					return res;
+				}
+				try {
+					set_frame (req.read_frame_sync (cancellable));
+				} catch (IOError e) {
+					throw e;
+				} catch (Error e) {
+					throw new IOError.FAILED (e.message);
+				}
+			}
+		}
+
+		public override async ssize_t read_async ([CCode (array_length_cname = "count", array_length_pos = 1.5, array_length_type = "gsize")] uint8[] buffer, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws IOError {
+			while (true) {
+				var res = consume (buffer);
+				if (res >= 0) {
+					return res;
+				}
+				try {
+					set_frame (yield req.read_frame (io_priority, cancellable));
+				} catch (IOError e) {
+					throw e;
+				} catch (Error e) {
+					throw new IOError.FAILED (e.message);
+				}
+			}
+		}
+	}
+
+	/* Directory entries are streamed in DATA frames, the agent sends at most LIST_WINDOW bytes
+	 * ahead of what the client consumed.
+	 * Each entry is "<type> <size> <mtime> <mode> <name>\0", type is 'd' for directories and 'f' otherwise. */
+	public class RemoteMuxFileIterator : SourceIterator {
+		public const int LIST_WINDOW = 256*1024;
+
+		RemoteFileSource parent;
+		RemoteRequest req;
+		List<SourceInfo> children = null;
+		bool at_end = false;
+		int consumed = 0;
+
+		public RemoteMuxFileIterator (RemoteFileSource parent, owned RemoteRequest req) {
+			this.parent = parent;
+			this.req = (owned) req;
+		}
+
+		~RemoteMuxFileIterator () {
+			if (!at_end) {
+				// the iterator is usually unreferenced in a thread
+				var req = this.req;
+				Idle.add (() => { req.cancel.begin (); return false; });
+			}
+		}
+
+		public override SourceInfo? next (Cancellable? cancellable = null) throws Error {
+			while (children == null) {
+				if (at_end) {
+					return null;
+				}
+
+				try {
+					var frame = req.read_frame_sync (cancellable);
+					if (frame.type == RemoteFrameType.END) {
+						at_end = true;
+						parent.remote.cache_listed (parent.local_path);
+						return null;
+					} else if (frame.type != RemoteFrameType.DATA) {
+						at_end = true;
+						throw new IOError.INVALID_DATA ("Invalid remote frame while listing directory: %d".printf (frame.type));
+					}
+					parse_entries (frame.payload);
+
+					// give credit back once half of the window has been consumed
+					consumed += frame.payload.length;
+					if (consumed >= LIST_WINDOW/2) {
+						var credit = consumed;
+						var req = this.req;
+						consumed = 0;
+						Idle.add (() => { req.send_credit.begin (credit); return false; });
+					}
+				} catch (Error e) {
+					at_end = true;
+					throw e;
+				}
+			}
+
+			var info = children.data;
+			children.delete_link (children.first ());
+			return info;
+		}
+
+		void parse_entries (uint8[] payload) {
+			var start = 0;
+			for (var i=0; i < payload.length; i++) {
+				if (payload[i] == '\0') {
+					var entry = ((string) &payload[start]).substring (0, i-start);
+					var fields = entry.split (" ", 5);
+					start = i+1;
+					if (fields.length < 5 || fields[4] == "") {
+						continue;
+					}
+
+					var child = parent.child (fields[4]);
+					var info = RemoteFileSource.stat_from_fields (child, fields);
+					parent.remote.cache_info (((FileSource) child).local_path, info);
+					children.append (info);
+				}
+			}
+		}
+	}
+}
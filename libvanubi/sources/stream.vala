@@ -75,7 +75,7 @@ namespace Vanubi {
 			return false;
 		}
 		
-		public override async uint8[] execute_shell (string command_line, uint8[]? input = null, out uint8[] errors = null, out int status = null, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+		public override async ShellProcess spawn_shell (string command_line, uint8[]? input = null, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
 			throw new IOError.INVALID_ARGUMENT ("Commands must be executed in a directory");
 		}
 		
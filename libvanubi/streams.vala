@@ -329,4 +329,122 @@ namespace Vanubi {
 			return true;
 		}
 	}
+	/* Data pushed by a producer in the main loop, to be read as a stream from any thread */
+	public class QueueInputStream : InputStream {
+		Queue<Bytes> chunks = new Queue<Bytes> ();
+		size_t offset = 0;
+		bool at_end = false;
+		string? error_message = null;
+		Mutex mutex = Mutex ();
+		Cond cond = Cond ();
+		SourceFunc? waiting = null;
+		
+		public signal void closed ();
+		
+		public void push (owned uint8[] data) {
+			if (data.length == 0) {
+				return;
+			}
+			mutex.lock ();
+			chunks.push_tail (new Bytes.take ((owned) data));
+			wake_locked ();
+		}
+		
+		/* No more data, the reader gets an error once the queued data has been read, if any */
+		public void push_end (string? error_message = null) {
+			mutex.lock ();
+			at_end = true;
+			this.error_message = error_message;
+			wake_locked ();
+		}
+		
+		void wake () {
+			mutex.lock ();
+			wake_locked ();
+		}
+		
+		// unlocks the mutex
+		void wake_locked () {
+			cond.broadcast ();
+			SourceFunc? cb = (owned) waiting;
+			waiting = null;
+			mutex.unlock ();
+			if (cb != null) {
+				cb ();
+			}
+		}
+		
+		// called with the mutex locked, when there's data or at the end
+		ssize_t take (uint8[] buffer) throws IOError {
+			if (chunks.is_empty ()) {
+				if (error_message != null) {
+					throw new IOError.FAILED (error_message);
+				}
+				return 0;
+			}
+			
+			unowned uint8[] data = chunks.peek_head().get_data ();
+			var n = size_t.min (buffer.length, data.length-offset);
+			Memory.copy (buffer, &data[offset], n);
+			offset += n;
+			if (offset == data.length) {
+				chunks.pop_head ();
+				offset = 0;
+			}
+			return (ssize_t) n;
+		}
+		
+		public override ssize_t read ([CCode (array_length_type = "gsize")] uint8[] buffer, GLib.Cancellable? cancellable = null) throws GLib.IOError {
+			mutex.lock ();
+			try {
+				while (chunks.is_empty () && !at_end) {
+					cancellable.set_error_if_cancelled ();
+					cond.wait_until (mutex, get_monotonic_time () + 100*TimeSpan.MILLISECOND);
+				}
+				return take (buffer);
+			} finally {
+				mutex.unlock ();
+			}
+		}
+		
+		public override async ssize_t read_async ([CCode (array_length_cname = "count", array_length_pos = 1.5, array_length_type = "gsize")] uint8[] buffer, int io_priority = GLib.Priority.DEFAULT, GLib.Cancellable? cancellable = null) throws GLib.IOError {
+			ulong cancel_id = 0;
+			if (cancellable != null) {
+				cancel_id = cancellable.connect (() => {
+						Idle.add_full (io_priority, () => { wake (); return false; });
+				});
+			}
+			
+			try {
+				while (true) {
+					cancellable.set_error_if_cancelled ();
+					mutex.lock ();
+					if (!chunks.is_empty () || at_end) {
+						try {
+							return take (buffer);
+						} finally {
+							mutex.unlock ();
+						}
+					}
+					waiting = read_async.callback;
+					mutex.unlock ();
+					yield;
+				}
+			} finally {
+				if (cancel_id != 0) {
+					cancellable.disconnect (cancel_id);
+				}
+			}
+		}
+		
+		public override bool close (Cancellable? cancellable = null) throws IOError {
+			closed ();
+			return true;
+		}
+		
+		public override async bool close_async (int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws IOError {
+			closed ();
+			return true;
+		}
+	}
 }
\ No newline at end of file
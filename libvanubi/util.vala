@@ -262,6 +262,40 @@ namespace Vanubi {
 			
 			return read_int32 (cancellable);
 		}
+
+		public async uint32 read_uint32_async (int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			while (get_available () < sizeof (uint32)) {
+				var res = yield fill_async ((ssize_t) sizeof (uint32), io_priority, cancellable);
+				if (res == 0) {
+					throw new IOError.PARTIAL_INPUT ("Partial input while reading uint32");
+				}
+			}
+			
+			return read_uint32 (cancellable);
+		}
+
+		public async uint8 read_byte_async (int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			while (get_available () < 1) {
+				var res = yield fill_async (1, io_priority, cancellable);
+				if (res == 0) {
+					throw new IOError.PARTIAL_INPUT ("Partial input while reading byte");
+				}
+			}
+			
+			return read_byte (cancellable);
+		}
+
+		/* Fills the whole buffer, throws on eof */
+		public async void read_exactly_async (uint8[] buffer, int io_priority = GLib.Priority.DEFAULT, Cancellable? cancellable = null) throws Error {
+			var offset = 0;
+			while (offset < buffer.length) {
+				var res = yield read_async (buffer[offset:buffer.length], io_priority, cancellable);
+				if (res == 0) {
+					throw new IOError.PARTIAL_INPUT ("Partial input, expected %d bytes", buffer.length);
+				}
+				offset += (int) res;
+			}
+		}
 	}
 
 	public class AsyncMutex {
@@ -82,11 +82,150 @@ void test_update_copyright_year () {
 	assert (text == @" * ... Copyright (C) 2000-$(year)\n");
 }
 
+void test_piece_table () {
+	var buffer = new PieceTableBuffer ("first\n\tsecond\nàèì");
+	assert (buffer.line_count == 3);
+	assert (buffer.line_text (1) == "\tsecond");
+	assert (buffer.get_indent (1) == 4);
+
+	// utf-8
+	var iter = buffer.line_at_char (2, 2);
+	assert (iter.char == 'ì');
+	assert (iter.line_offset == 2);
+	assert (buffer.line_at_byte (2, 2).char == 'è');
+
+	// multi-line insert, iters after the insertion are moved
+	var last = buffer.line_start (2);
+	var first = buffer.line_start (0);
+	iter = buffer.line_end (0);
+	buffer.insert (iter, " line\nnew");
+	assert (buffer.line_count == 4);
+	assert (buffer.line_text (0) == "first line");
+	assert (buffer.line_text (1) == "new");
+	assert (iter.line == 1 && iter.eol);
+	assert (last.line == 3 && last.char == 'à');
+	assert (first.line == 0 && first.sol);
+
+	// multi-line delete
+	var start = buffer.line_at_char (0, 5);
+	var end = buffer.line_at_char (2, 1);
+	buffer.delete (start, end);
+	assert (buffer.text == "firstsecond\nàèì");
+	assert (start.line_offset == 5 && end.line_offset == 5);
+	assert (last.line == 1 && last.char == 'à');
+
+	// random edits against a plain string
+	var text = buffer.text;
+	for (var i=0; i < 2000; i++) {
+		var offset = Random.int_range (0, text.length+1);
+		if (Random.boolean () || text.length == 0) {
+			var ins = Random.boolean () ? "a\nb" : "x";
+			var it = new PieceTableBufferIter (buffer, offset);
+			buffer.insert (it, ins);
+			assert (it.byte_offset == offset+ins.length);
+			text = text.substring (0, offset)+ins+text.substring (offset);
+		} else {
+			var n = Random.int_range (0, int.min (10, text.length-offset)+1);
+			buffer.delete (new PieceTableBufferIter (buffer, offset), new PieceTableBufferIter (buffer, offset+n));
+			text = text.substring (0, offset)+text.substring (offset+n);
+		}
+	}
+	assert (buffer.text == text);
+	var lines = text.split ("\n");
+	assert (buffer.line_count == lines.length);
+	for (var i=0; i < lines.length; i++) {
+		assert (buffer.line_text (i) == lines[i]);
+	}
+}
+
+void test_mapped () {
+	try {
+		FileIOStream ios;
+		var file = File.new_tmp ("vanubi-XXXXXX", out ios);
+		ios.output_stream.write ("fill\n\tsecond line\nàèì\nlast".data);
+		ios.close ();
+
+		var buffer = new MappedFileBuffer (new LocalFileSource (file));
+		assert (buffer.line_text (1) == "\tsecond line");
+		assert (buffer.line_count == 4);
+		assert (buffer.line_text (3) == "last");
+		assert (buffer.line_at_offset (5) == 1);
+		assert (buffer.line_at_offset (4) == 0);
+		assert (buffer.get_indent (1) == 4);
+
+		var iter = buffer.line_start (2);
+		assert (iter.char == 'à');
+		iter.forward_char ();
+		assert (iter.char == 'è');
+		assert (iter.line_offset == 1);
+		iter.forward_line ();
+		assert (iter.line == 3);
+
+		int64 start, end;
+		var regex = new Regex ("l.*");
+		assert (buffer.search_forward (regex, 5, out start, out end));
+		assert (buffer.line_at_offset (start) == 1 && buffer.line_char_offset (start) == 8);
+		assert (buffer.search_backward (regex, start, out start, out end));
+		assert (buffer.line_at_offset (start) == 0 && buffer.line_char_offset (start) == 2);
+		assert (!buffer.search_backward (regex, start, out start, out end));
+
+		// only a window of the file is in the editor
+		assert (!MappedFileBuffer.allows_command ("save-file"));
+		assert (!MappedFileBuffer.allows_command ("save-as-file"));
+		assert (!MappedFileBuffer.allows_command ("save-as-file-and-open"));
+		assert (!MappedFileBuffer.allows_command ("reindent-buffer"));
+		assert (!MappedFileBuffer.allows_command ("replace-forward"));
+		assert (!MappedFileBuffer.allows_command ("paste"));
+		assert (!MappedFileBuffer.allows_command ("return"));
+		assert (!MappedFileBuffer.allows_command ("close-paren"));
+		assert (!MappedFileBuffer.allows_command ("move-block-up"));
+		assert (!MappedFileBuffer.allows_command ("unknown-command"));
+		assert (MappedFileBuffer.allows_command ("search-forward"));
+		assert (MappedFileBuffer.allows_command ("save-session"));
+		assert (MappedFileBuffer.allows_command ("goto-line"));
+		file.delete ();
+	} catch (Error e) {
+		error (e.message);
+	}
+}
+
+void test_mapped_charset () {
+	try {
+		FileIOStream ios;
+		var file = File.new_tmp ("vanubi-XXXXXX", out ios);
+		// latin1 text, not valid utf-8
+		uint8[] data = { 'f', 'o', 'o', '\n', 'c', 'a', 'f', 0xe8, ' ', 'b', 'a', 'r', '\n' };
+		ios.output_stream.write (data);
+		ios.close ();
+
+		var buffer = new MappedFileBuffer (new LocalFileSource (file));
+		string? charset = null;
+		var text = buffer.window_text (0, 2, ref charset);
+		assert (text == "foo\ncafè bar\n");
+		assert (buffer.charset == "ISO-8859-1");
+
+		int64 start, end;
+		var regex = buffer.search_regex ("è b", false, false);
+		assert (buffer.search_forward (regex, 0, out start, out end));
+		assert (start == 7 && end == 10);
+		assert (buffer.line_char_offset (end) == 6);
+		regex = buffer.search_regex ("b.r", true, false);
+		assert (buffer.search_backward (regex, 13, out start, out end));
+		assert (buffer.line_char_offset (start) == 5);
+		file.delete ();
+	} catch (Error e) {
+		error (e.message);
+	}
+}
+
 int main (string[] args) {
 	Test.init (ref args);
 
 	Test.add_func ("/buffer/simple", test_simple);
 	Test.add_func ("/buffer/insert_delete", test_insert_delete);
+	Test.add_func ("/buffer/piece_table", test_piece_table);
+	Test.add_func ("/buffer/mapped", test_mapped);
+	Test.add_func ("/buffer/mapped_charset", test_mapped_charset);
 	Test.add_func ("/files/update_copyright_year", test_update_copyright_year);
 
 	return Test.run ();
@@ -29,10 +29,77 @@ void test_detect () {
 	assert_charset ("foobar\xeczz", "ISO-8859-1", "foobarìzz");
 }
 
+void test_decoder () {
+	// a multibyte sequence split across chunks
+	var decoder = new CharsetDecoder ();
+	var text = "foobar\xc3\xaczz".data;
+	var res = (string) decoder.decode (text[0:7]);
+	assert (res == "foobar");
+	res = (string) decoder.decode (text[7:text.length]);
+	assert (res == "\xc3\xaczz");
+	res = (string) decoder.decode (new uint8[0], true);
+	assert (res == null || res == "");
+	assert (decoder.charset == "UTF-8");
+	assert (decoder.fallbacks == 0);
+
+	// detected on the first chunk
+	decoder = new CharsetDecoder ();
+	text = "foobar\xeczz".data;
+	res = (string) decoder.decode (text);
+	assert (decoder.charset == "ISO-8859-1");
+	assert (res == "foobar\xc3\xaczz");
+}
+
+void test_decoder_truncated () {
+	// a file truncated in the middle of a sequence
+	var decoder = new CharsetDecoder ();
+	var text = "foo\xc3\xacbar\xe2\x82".data;
+	var res = (string) decoder.decode (text[0:5]);
+	assert (res == "foo\xc3\xac");
+	res = (string) decoder.decode (text[5:text.length]);
+	assert (res == "bar");
+	res = (string) decoder.decode (new uint8[0], true);
+	assert (res == "\xef\xbf\xbd");
+	assert (decoder.charset == "UTF-8");
+	assert (decoder.fallbacks == 1);
+
+	// the last chunk is flushed together with the leftover bytes
+	decoder = new CharsetDecoder ();
+	res = (string) decoder.decode (text, true);
+	assert (res == "foo\xc3\xacbar\xef\xbf\xbd");
+	assert (decoder.fallbacks == 1);
+}
+
+void test_decoder_perf () {
+	if (!Test.perf ()) {
+		return;
+	}
+
+	// a log-like 8 MB chunk
+	var chunk = new uint8[8*1024*1024];
+	var line = "2014-01-01 00:00:00 [info] some log line with ìnternational text\n".data;
+	for (var i=0; i < chunk.length; i++) {
+		chunk[i] = line[i % line.length];
+	}
+
+	foreach (var mb in new int[]{10, 100, 1000}) {
+		var decoder = new CharsetDecoder ();
+		Test.timer_start ();
+		for (var loaded=0; loaded < mb*1024*1024; loaded += chunk.length) {
+			decoder.decode (chunk);
+		}
+		decoder.decode (new uint8[0], true);
+		Test.message ("%d MB: %gs", mb, Test.timer_elapsed ());
+	}
+}
+
 int main (string[] args) {
 	Test.init (ref args);
 
 	Test.add_func ("/charset/detect", test_detect);
+	Test.add_func ("/charset/decoder", test_decoder);
+	Test.add_func ("/charset/decoder_truncated", test_decoder_truncated);
+	Test.add_func ("/charset/decoder_perf", test_decoder_perf);
 
 	return Test.run ();
 }
\ No newline at end of file
@@ -24,8 +24,8 @@ async void test_simple_async_helper (MainLoop loop) {
 	line = yield buf.read_line_async ();
 	assert(line == "yy");
 
-	unowned string outdata = (string) os.get_data ();
-	assert (outdata == "continue\n");
+	// no handshake between chunks
+	assert (os.get_data_size () == 0);
 	
 	loop.quit ();
 }	
@@ -50,8 +50,7 @@ void test_simple_sync_helper (MainLoop loop) {
 	line = buf.read_line ();
 	assert(line == "yy");
 
-	unowned uint8[] outdata = os.get_data ();
-	assert (((string) outdata) == "continue\n");
+	assert (os.get_data_size () == 0);
 
 	loop.quit ();
 }
@@ -71,8 +70,7 @@ void test_simple_sync_mainloop () {
 			line = buf.read_line ();
 			assert (line == "yy");
 
-			unowned uint8[] outdata = os.get_data ();
-			assert (((string) outdata) == "continue\n");
+			assert (os.get_data_size () == 0);
 
 			loop.quit();
 			return false;
@@ -81,12 +79,152 @@ void test_simple_sync_mainloop () {
 	loop.run ();
 }
 
+void test_credit () {
+	var is = new MemoryInputStream.from_data (simple_data, GLib.free);
+	var os = new MemoryOutputStream (null, GLib.realloc, GLib.free);
+
+	var ch = new ChunkedInputStream (new AsyncDataInputStream (is), os, null, 8);
+	var buf = new DataInputStream (ch);
+	var line = buf.read_line ();
+	assert (line == "xxxx");
+	line = buf.read_line ();
+	assert (line == "yy");
+
+	// the window up front, then the first chunk is more than half of it
+	var expected = "credit 8\ncredit 5\n";
+	assert (os.get_data_size () == expected.length);
+	assert (Memory.cmp (os.get_data (), expected, expected.length) == 0);
+}
+
+/* One direction of a link with latency */
+class DelayedPipe : InputStream {
+	class Packet {
+		public uint8[] data;
+		public int64 time;
+	}
+
+	AsyncQueue<Packet> queue = new AsyncQueue<Packet> ();
+	Packet? current = null;
+	int offset = 0;
+	int64 latency;
+
+	public DelayedPipe (int64 latency) {
+		this.latency = latency;
+	}
+
+	public void send (uint8[] data) {
+		var packet = new Packet ();
+		packet.data = data;
+		packet.time = get_monotonic_time ()+latency;
+		queue.push (packet);
+	}
+
+	public override ssize_t read (uint8[] buffer, Cancellable? cancellable = null) throws IOError {
+		if (current == null || offset >= current.data.length) {
+			current = queue.pop ();
+			offset = 0;
+			var wait = current.time-get_monotonic_time ();
+			if (wait > 0) {
+				Thread.usleep ((ulong) wait);
+			}
+		}
+		var n = int.min (buffer.length, current.data.length-offset);
+		Memory.copy (buffer, &current.data[offset], n);
+		offset += n;
+		return n;
+	}
+
+	public override bool close (Cancellable? cancellable = null) throws IOError {
+		return true;
+	}
+}
+
+/* Forwards the credit lines of the reader to the sender */
+class CreditSink : OutputStream {
+	public DelayedPipe pipe;
+
+	public CreditSink (DelayedPipe pipe) {
+		this.pipe = pipe;
+	}
+
+	public override ssize_t write (uint8[] buffer, Cancellable? cancellable = null) throws IOError {
+		pipe.send (buffer);
+		return buffer.length;
+	}
+
+	public override bool close (Cancellable? cancellable = null) throws IOError {
+		return true;
+	}
+}
+
+void send_chunks (DelayedPipe data, DelayedPipe credits, int window, int chunk, int total) {
+	var credit_stream = new DataInputStream (credits);
+	int64 credit = 0;
+	var packet = new uint8[4+chunk];
+	packet[0] = (uint8) (chunk >> 24);
+	packet[1] = (uint8) (chunk >> 16);
+	packet[2] = (uint8) (chunk >> 8);
+	packet[3] = (uint8) chunk;
+	try {
+		for (var sent = 0; sent < total; sent += chunk) {
+			while (window > 0 && credit < chunk) {
+				var line = credit_stream.read_line ();
+				credit += int.parse (line.substring ("credit ".length));
+			}
+			data.send (packet);
+			credit -= chunk;
+		}
+	} catch (Error e) {
+		assert_not_reached ();
+	}
+	// end of the stream
+	data.send (new uint8[4]);
+}
+
+void test_window_perf () {
+	if (!Test.perf ()) {
+		return;
+	}
+
+	// 2ms each way
+	var latency = 2*TimeSpan.MILLISECOND;
+	var chunk = 16*1024;
+	var total = 4*1024*1024;
+	var buffer = new uint8[64*1024];
+	foreach (var window in new int[]{chunk, 4*chunk, 16*chunk, 64*chunk, 0}) {
+		var data = new DelayedPipe (latency);
+		var credits = new DelayedPipe (latency);
+		var sender = new Thread<void*> ("chunked/sender", () => {
+				send_chunks (data, credits, window, chunk, total);
+				return null;
+		});
+
+		Test.timer_start ();
+		var ch = new ChunkedInputStream (new AsyncDataInputStream (data), new CreditSink (credits), null, window);
+		var read = 0;
+		try {
+			ssize_t res;
+			while ((res = ch.read (buffer)) > 0) {
+				read += (int) res;
+			}
+		} catch (Error e) {
+			assert_not_reached ();
+		}
+		assert (read == total);
+		var elapsed = Test.timer_elapsed ();
+		sender.join ();
+		Test.message ("window %d KB: %g MB/s", window/1024, total/1024.0/1024.0/elapsed);
+	}
+}
+
 int main (string[] args) {
 	Test.init (ref args);
 
 	Test.add_func ("/chunked/simple/sync/thread", test_simple_sync_thread);
 	Test.add_func ("/chunked/simple/sync/mainloop", test_simple_sync_mainloop);
 	Test.add_func ("/chunked/simple/async", test_simple_async);
+	Test.add_func ("/chunked/credit", test_credit);
+	Test.add_func ("/chunked/window_perf", test_window_perf);
 
 	return Test.run ();
 }
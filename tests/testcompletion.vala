@@ -0,0 +1,113 @@
+/**
+ * Test the abbreviations index.
+ */
+
+using Vanubi;
+
+void test_counts () {
+	var abbrevs = new AbbrevCompletion ();
+	abbrevs.index_text ("foo bar\nbar baz bar\nqux");
+	assert (abbrevs.n_lines == 3);
+	assert (abbrevs.count ("foo") == 1);
+	// counted once per line
+	assert (abbrevs.count ("bar") == 2);
+	assert (abbrevs.count ("qux") == 1);
+	assert (abbrevs.count ("none") == 0);
+
+	// edit a line
+	abbrevs.replace_lines (1, 1, { "baz" });
+	assert (abbrevs.n_lines == 3);
+	assert (abbrevs.count ("bar") == 1);
+	assert (abbrevs.count ("baz") == 1);
+
+	// split a line
+	abbrevs.replace_lines (0, 1, { "foo", "bar new" });
+	assert (abbrevs.n_lines == 4);
+	assert (abbrevs.count ("new") == 1);
+	assert (abbrevs.count ("foo") == 1);
+
+	// join the last lines
+	abbrevs.replace_lines (2, 2, { "baz qux" });
+	assert (abbrevs.n_lines == 3);
+	assert (abbrevs.count ("baz") == 1);
+	assert (abbrevs.count ("qux") == 1);
+
+	// remove everything before the end
+	abbrevs.replace_lines (0, 3, { "" });
+	assert (abbrevs.n_lines == 1);
+	assert (abbrevs.count ("foo") == 0);
+	assert (abbrevs.count ("qux") == 0);
+}
+
+void test_random () {
+	var rand = new Rand.with_seed (3);
+	var abbrevs = new AbbrevCompletion ();
+	string[] lines = { "" };
+	for (var iter=0; iter < 2000; iter++) {
+		// replace a few lines at a random place
+		var line = rand.int_range (0, lines.length);
+		var n_removed = rand.int_range (1, int.min (4, lines.length-line+1));
+		string[] new_lines = {};
+		var n_added = rand.int_range (0, 4);
+		if (n_added == 0 && n_removed == lines.length) {
+			n_added = 1;
+		}
+		for (var i=0; i < n_added; i++) {
+			new_lines += "w%d w%d".printf (rand.int_range (0, 20), rand.int_range (0, 20));
+		}
+		abbrevs.replace_lines (line, n_removed, new_lines);
+
+		string[] res = {};
+		for (var i=0; i < line; i++) {
+			res += lines[i];
+		}
+		foreach (var l in new_lines) {
+			res += l;
+		}
+		for (var i=line+n_removed; i < lines.length; i++) {
+			res += lines[i];
+		}
+		lines = res;
+		assert (abbrevs.n_lines == lines.length);
+	}
+
+	// compare with indexing from scratch
+	var expected = new AbbrevCompletion ();
+	expected.index_text (string.joinv ("\n", lines));
+	for (var i=0; i < 20; i++) {
+		var word = "w%d".printf (i);
+		assert (abbrevs.count (word) == expected.count (word));
+	}
+}
+
+void test_perf () {
+	if (!Test.perf ()) {
+		return;
+	}
+
+	var text = new StringBuilder ();
+	for (var i=0; i < 100000; i++) {
+		text.append_printf ("line %d with some words\n", i);
+	}
+	var abbrevs = new AbbrevCompletion ();
+	Test.timer_start ();
+	abbrevs.index_text (text.str);
+	Test.message ("index of 100k lines: %.2fms", Test.timer_elapsed ()*1000);
+
+	// typing new lines in the middle of the file
+	Test.timer_start ();
+	for (var i=0; i < 10000; i++) {
+		abbrevs.replace_lines (50000+i, 1, { "typed", "line %d".printf (i) });
+	}
+	Test.message ("edit of a line: %.3fms", Test.timer_elapsed ()*1000/10000);
+}
+
+int main (string[] args) {
+	Test.init (ref args);
+
+	Test.add_func ("/completion/counts", test_counts);
+	Test.add_func ("/completion/random", test_random);
+	Test.add_func ("/completion/perf", test_perf);
+
+	return Test.run ();
+}
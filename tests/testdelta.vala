@@ -0,0 +1,92 @@
+/**
+ * Test the delta encoding of remote saves.
+ */
+
+using Vanubi;
+
+uint8[] random_data (int size) {
+	var data = new uint8[size];
+	var rand = new Rand.with_seed (1);
+	for (var i=0; i < size; i++) {
+		data[i] = (uint8) rand.int_range (0, 256);
+	}
+	return data;
+}
+
+void check_roundtrip (uint8[] old, uint8[] data, int block_size, int max_delta) {
+	var sig = new DeltaSignature.compute (old, block_size);
+	// as sent by the agent
+	try {
+		sig = new DeltaSignature.parse (sig.to_data ());
+	} catch (Error e) {
+		assert_not_reached ();
+	}
+	assert (sig.block_size == block_size);
+
+	var delta = compute_delta (sig, data);
+	assert (delta.len <= max_delta);
+	try {
+		var res = apply_delta (old, block_size, delta.data);
+		assert (res.len == data.length);
+		assert (Memory.cmp (res.data, data, data.length) == 0);
+	} catch (Error e) {
+		assert_not_reached ();
+	}
+}
+
+void test_adler () {
+	var data = random_data (10000);
+	var sum = adler32 (data[0:100]);
+	for (var i=0; i < 1000; i++) {
+		sum = adler32_roll (sum, 100, data[i], data[i+100]);
+		assert (sum == adler32 (data[i+1:i+101]));
+	}
+}
+
+void test_roundtrip () {
+	var old = random_data (200000);
+
+	// identical
+	check_roundtrip (old, old, 2048, 2048+100);
+
+	// one byte inserted, a range deleted and a tail appended
+	var data = new ByteArray ();
+	data.append (old[0:5000]);
+	data.append ("X".data);
+	data.append (old[5000:150000]);
+	data.append (old[151000:old.length]);
+	data.append ("tail".data);
+	check_roundtrip (old, data.data, 2048, 3*2048+200);
+
+	// no old copy
+	check_roundtrip (new uint8[0], data.data, 2048, data.len+100);
+
+	// everything removed
+	check_roundtrip (old, new uint8[0], 2048, 0);
+}
+
+void test_invalid () {
+	var old = random_data (1000);
+	uint8[] truncated_sig = {0, 0, 8, 0, 0, 0, 0, 5};
+	uint8[] truncated_delta = {'L', 0, 0, 0, 10, 0, 0, 0, 0, 'x'};
+	try {
+		new DeltaSignature.parse (truncated_sig);
+		assert_not_reached ();
+	} catch (Error e) {
+	}
+	try {
+		apply_delta (old, 100, truncated_delta);
+		assert_not_reached ();
+	} catch (Error e) {
+	}
+}
+
+int main (string[] args) {
+	Test.init (ref args);
+
+	Test.add_func ("/delta/adler", test_adler);
+	Test.add_func ("/delta/roundtrip", test_roundtrip);
+	Test.add_func ("/delta/invalid", test_invalid);
+
+	return Test.run ();
+}
@@ -0,0 +1,237 @@
+/**
+ * Test the line diff.
+ */
+
+using Vanubi;
+
+DiffHunk[] diff (string a, string b) {
+	try {
+		return diff_lines (a.split ("\n"), b.split ("\n"));
+	} catch (Error e) {
+		assert_not_reached ();
+	}
+}
+
+void assert_hunk (DiffHunk hunk, int old_start, int old_count, int new_start, int new_count) {
+	assert (hunk.old_start == old_start);
+	assert (hunk.old_count == old_count);
+	assert (hunk.new_start == new_start);
+	assert (hunk.new_count == new_count);
+}
+
+/* Rebuilds b from a and the hunks, checking that the unchanged lines match */
+void check_hunks (string[] a, string[] b, DiffHunk[] hunks) {
+	string[] res = {};
+	var i = 0;
+	foreach (var hunk in hunks) {
+		assert (hunk.old_start >= i);
+		for (; i < hunk.old_start; i++) {
+			assert (b[res.length] == a[i]);
+			res += a[i];
+		}
+		assert (hunk.new_start == res.length);
+		for (var j=0; j < hunk.new_count; j++) {
+			res += b[hunk.new_start+j];
+		}
+		i += hunk.old_count;
+	}
+	for (; i < a.length; i++) {
+		res += a[i];
+	}
+	assert (res.length == b.length);
+	for (var j=0; j < b.length; j++) {
+		assert (res[j] == b[j]);
+	}
+}
+
+void test_simple () {
+	assert (diff ("a\nb\nc", "a\nb\nc").length == 0);
+
+	var hunks = diff ("a\nb\nc", "a\nx\nb\nc");
+	assert (hunks.length == 1);
+	assert_hunk (hunks[0], 1, 0, 1, 1);
+
+	hunks = diff ("a\nb\nc", "a\nc");
+	assert (hunks.length == 1);
+	assert_hunk (hunks[0], 1, 1, 1, 0);
+
+	hunks = diff ("a\nb\nc\nd", "a\nx\nc\ny\nz");
+	assert (hunks.length == 2);
+	assert_hunk (hunks[0], 1, 1, 1, 1);
+	assert_hunk (hunks[1], 3, 1, 3, 2);
+
+	var ranges = new DiffRanges (diff ("a\nb\nc\nd\ne", "x\nb\nc\nnew\nnew\ne"));
+	assert (ranges.ranges.length == 2);
+	assert_type (ranges, 1, DiffType.MOD);
+	assert_type (ranges, 4, DiffType.MOD);
+	assert_type (ranges, 5, DiffType.MOD);
+	assert_unchanged (ranges, 2);
+	assert_unchanged (ranges, 6);
+
+	ranges = new DiffRanges (diff ("a\nb\nc", "a\nnew\nb"));
+	assert_type (ranges, 2, DiffType.ADD);
+	// c deleted after the last line
+	assert_type (ranges, 4, DiffType.DEL);
+	assert_unchanged (ranges, 3);
+}
+
+void assert_type (DiffRanges ranges, int line, DiffType type) {
+	DiffType t;
+	assert (ranges.lookup (line, out t));
+	assert (t == type);
+}
+
+void assert_unchanged (DiffRanges ranges, int line) {
+	DiffType t;
+	assert (!ranges.lookup (line, out t));
+}
+
+void test_random () {
+	var rand = new Rand.with_seed (42);
+	for (var iter=0; iter < 200; iter++) {
+		string[] a = {};
+		var n = rand.int_range (0, 60);
+		for (var i=0; i < n; i++) {
+			a += rand.int_range (0, 8).to_string ();
+		}
+
+		// edit a few lines
+		string[] b = {};
+		foreach (var line in a) {
+			var op = rand.int_range (0, 10);
+			if (op == 0) {
+				continue;
+			} else if (op == 1) {
+				b += "new";
+			}
+			b += op == 2 ? "mod" : line;
+		}
+
+		try {
+			check_hunks (a, b, diff_lines (a, b));
+		} catch (Error e) {
+			assert_not_reached ();
+		}
+	}
+}
+
+string[] random_edit (Rand rand, string[] lines) {
+	string[] res = lines;
+	var pos = rand.int_range (0, res.length+1);
+	var op = rand.int_range (0, 3);
+	if (op == 0 || pos == res.length) {
+		string[] ins = {};
+		for (var i=0; i < pos; i++) {
+			ins += res[i];
+		}
+		ins += "inserted %d".printf (rand.int_range (0, 10));
+		for (var i=pos; i < res.length; i++) {
+			ins += res[i];
+		}
+		res = ins;
+	} else if (op == 1) {
+		string[] del = {};
+		for (var i=0; i < res.length; i++) {
+			if (i != pos) {
+				del += res[i];
+			}
+		}
+		res = del;
+	} else {
+		res[pos] = "modified %d".printf (rand.int_range (0, 10));
+	}
+	return res;
+}
+
+void test_incremental () {
+	var rand = new Rand.with_seed (7);
+	for (var iter=0; iter < 50; iter++) {
+		string[] a = {};
+		var n = rand.int_range (0, 40);
+		for (var i=0; i < n; i++) {
+			a += rand.int_range (0, 10).to_string ();
+		}
+
+		var diff = new LineDiff (a);
+		var b = a;
+		try {
+			for (var i=0; i < 20; i++) {
+				b = random_edit (rand, b);
+				check_hunks (a, b, diff.update (b));
+			}
+		} catch (Error e) {
+			assert_not_reached ();
+		}
+	}
+}
+
+void test_bounded_ids () {
+	string[] a = {};
+	for (var i=0; i < 100; i++) {
+		a += "line %d".printf (i);
+	}
+
+	// every edit adds a new line version
+	var diff = new LineDiff (a);
+	var b = a;
+	try {
+		for (var i=0; i < 5000; i++) {
+			b[i % b.length] = "modified %d".printf (i);
+			check_hunks (a, b, diff.update (b));
+			assert (diff.n_ids <= 2*(a.length+b.length)+1024+1);
+		}
+	} catch (Error e) {
+		assert_not_reached ();
+	}
+}
+
+void test_perf () {
+	if (!Test.perf ()) {
+		return;
+	}
+
+	var rand = new Rand.with_seed (1);
+	string[] a = {};
+	for (var i=0; i < 100000; i++) {
+		a += "line %d of the file %d".printf (i, rand.int_range (0, 1000));
+	}
+	// 1% of the lines changed
+	string[] b = a;
+	for (var i=0; i < 1000; i++) {
+		b[rand.int_range (0, b.length)] = "changed %d".printf (i);
+	}
+
+	try {
+		var diff = new LineDiff (a);
+		Test.timer_start ();
+		var hunks = diff.update (b);
+		Test.message ("full diff of 100k lines: %.2fms, %d hunks", Test.timer_elapsed ()*1000, hunks.length);
+
+		Test.timer_start ();
+		for (var i=0; i < 100; i++) {
+			b = random_edit (rand, b);
+			diff.update (b);
+		}
+		Test.message ("incremental diff after an edit: %.3fms", Test.timer_elapsed ()*1000/100);
+
+		Test.timer_start ();
+		for (var i=0; i < 10; i++) {
+			diff_lines (a, b);
+		}
+		Test.message ("full diff after the edits: %.2fms", Test.timer_elapsed ()*1000/10);
+	} catch (Error e) {
+		assert_not_reached ();
+	}
+}
+
+int main (string[] args) {
+	Test.init (ref args);
+
+	Test.add_func ("/diff/simple", test_simple);
+	Test.add_func ("/diff/random", test_random);
+	Test.add_func ("/diff/incremental", test_incremental);
+	Test.add_func ("/diff/bounded_ids", test_bounded_ids);
+	Test.add_func ("/diff/perf", test_perf);
+
+	return Test.run ();
+}
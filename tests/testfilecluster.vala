@@ -0,0 +1,85 @@
+/**
+ * Test the similar files lookup.
+ */
+
+using Vanubi;
+
+Configuration new_config () {
+	// never touch the user configuration
+	return new Configuration (Path.build_filename (Environment.get_tmp_dir (), "vanubi-test-%d".printf ((int) Posix.getpid ())));
+}
+
+FileSource file (string path) {
+	return (FileSource) DataSource.new_from_string (path);
+}
+
+void test_similar () {
+	var conf = new_config ();
+	conf.set_file_int (file ("/a/foo.c"), "tab_width", 2);
+	conf.set_file_int (file ("/b/bar.c"), "tab_width", 8);
+	conf.set_file_string (file ("/c/Makefile"), "shell_cwd", "/c");
+
+	// same extension, the latest configured wins
+	assert (conf.get_file_int (file ("/d/baz.c"), "tab_width", 4) == 8);
+	// same name and extension
+	assert (conf.get_file_int (file ("/d/foo.c"), "tab_width", 4) == 2);
+	// sibling
+	assert (conf.get_file_string (file ("/c/other"), "shell_cwd") == "/c");
+	assert (conf.get_file_string (file ("/d/other"), "shell_cwd") == null);
+	// no similar file
+	assert (conf.get_file_int (file ("/d/baz.h"), "tab_width", 4) == 4);
+
+	// the index is updated incrementally
+	conf.set_file_int (file ("/d/qux.h"), "tab_width", 3);
+	assert (conf.get_file_int (file ("/d/baz.h"), "tab_width", 4) == 3);
+
+	conf.remove_group ("source:/d/qux.h");
+	assert (conf.get_file_int (file ("/d/baz.h"), "tab_width", 4) == 4);
+}
+
+void test_many () {
+	if (!Test.perf ()) {
+		return;
+	}
+
+	var conf = new_config ();
+	for (var i=0; i < 50000; i++) {
+		conf.set_file_int (file ("/dir%d/file%d.ext%d".printf (i%100, i, i%50)), "tab_width", i%8+1);
+	}
+
+	var query = file ("/dir7/new.ext7");
+	var n = 100;
+	
+	// reference: scan every configured file
+	Test.timer_start ();
+	var matches = 0;
+	for (var i=0; i < n; i++) {
+		foreach (var f in conf.get_files ()) {
+			if (f.extension == query.extension && !f.equal (query)) {
+				matches++;
+			}
+		}
+	}
+	assert (matches == n*1000);
+	var scan = Test.timer_elapsed ();
+
+	// first lookup builds the index
+	conf.cluster.get_similar_file (query, "tab_width", true);
+	Test.timer_start ();
+	for (var i=0; i < n; i++) {
+		conf.cluster.get_similar_file (query, "tab_width", true);
+	}
+	var indexed = Test.timer_elapsed ();
+
+	Test.minimized_result (indexed/n, "indexed lookup: %gs", indexed/n);
+	Test.message ("full scan: %gs, indexed lookup: %gs", scan/n, indexed/n);
+}
+
+int main (string[] args) {
+	Test.init (ref args);
+
+	Test.add_func ("/filecluster/similar", test_similar);
+	Test.add_func ("/filecluster/many", test_many);
+
+	return Test.run ();
+}
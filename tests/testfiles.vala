@@ -35,7 +35,7 @@ void test_short_paths () {
 }
 
 void test_lru () {
-	var lru = new LRU<DataSource> (DataSource.compare);
+	var lru = new LRU<DataSource> (DataSource.hash, DataSource.equal);
 	lru.append (DataSource.new_from_string ("/foo"));
 	assert (lru.list().data.equal (DataSource.new_from_string ("/foo")));
 	
@@ -56,12 +56,103 @@ void test_lru () {
 	assert (lru.list().length() == 1);
 }
 
+void test_lru_bounded () {
+	string[] evicted = null;
+	var lru = new LRU<string> (str_hash, str_equal, 2, (s) => { evicted += s; });
+	lru.append ("foo");
+	lru.append ("bar");
+	lru.used ("bar");
+	assert (lru.head == "bar");
+
+	// the least recently used is evicted
+	lru.append ("baz");
+	assert (lru.length == 2);
+	assert (evicted.length == 1 && evicted[0] == "foo");
+	assert (!lru.contains ("foo"));
+	assert (lru.list().nth_data (1) == "baz");
+}
+
+void test_lru_copy () {
+	var lru = new LRU<string> (str_hash, str_equal);
+	lru.append ("foo");
+	lru.append ("bar");
+
+	var copy = lru.copy ();
+	copy.used ("bar");
+	copy.remove ("foo");
+	assert (copy.head == "bar" && copy.length == 1);
+	// the original is untouched
+	assert (lru.head == "foo" && lru.length == 2);
+
+	lru.clear ();
+	assert (lru.head == null && copy.length == 1);
+}
+
+async void test_shell_helper (MainLoop loop) {
+	var dir = new LocalFileSource (File.new_for_path (Environment.get_tmp_dir ()));
+	try {
+		// a lot of stderr before any stdout must not block
+		uint8[] errors;
+		int status;
+		var output = yield dir.execute_shell ("head -c 200000 /dev/zero >&2; echo out", null, out errors, out status);
+		assert (status == 0);
+		assert (output.length == 4 && Memory.cmp (output, "out\n", 4) == 0);
+		assert (errors.length == 200000);
+
+		// the output is readable before the command exits
+		var proc = yield dir.spawn_shell ("cat; sleep 0.2; echo end", "input\n".data);
+		var stdout = new DataInputStream (proc.stdout);
+		var line = yield stdout.read_line_async ();
+		assert (line == "input");
+		line = yield stdout.read_line_async ();
+		assert (line == "end");
+		status = yield proc.wait ();
+		assert (status == 0);
+
+		// cancelling resumes only that waiter
+		proc = yield dir.spawn_shell ("sleep 0.2", null);
+		var other_status = -1;
+		proc.wait.begin (Priority.DEFAULT, null, (s,r) => {
+				try {
+					other_status = proc.wait.end (r);
+				} catch (Error e) {
+					assert_not_reached ();
+				}
+		});
+		var cancellable = new Cancellable ();
+		Idle.add (() => { cancellable.cancel (); return false; });
+		try {
+			yield proc.wait (Priority.DEFAULT, cancellable);
+			assert_not_reached ();
+		} catch (IOError.CANCELLED e) {
+		}
+		assert (other_status == -1);
+		status = yield proc.wait ();
+		assert (status == 0);
+		Idle.add (test_shell_helper.callback);
+		yield;
+		assert (other_status == 0);
+	} catch (Error e) {
+		assert_not_reached ();
+	}
+	loop.quit ();
+}
+
+void test_shell () {
+	var loop = new MainLoop (MainContext.default ());
+	test_shell_helper.begin (loop);
+	loop.run ();
+}
+
 int main (string[] args) {
 	Test.init (ref args);
 
 	Test.add_func ("/files/abspath", test_abspath);
 	Test.add_func ("/files/short_paths", test_short_paths);
 	Test.add_func ("/files/lru", test_lru);
+	Test.add_func ("/files/lru_bounded", test_lru_bounded);
+	Test.add_func ("/files/lru_copy", test_lru_copy);
+	Test.add_func ("/files/shell", test_shell);
 
 	return Test.run ();
 }
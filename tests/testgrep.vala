@@ -0,0 +1,257 @@
+/**
+ * Test the grep engine.
+ */
+
+using Vanubi;
+
+GenericArray<GrepMatch> grep (string pattern, bool insensitive, string text) {
+	try {
+		var engine = new GrepEngine (pattern, insensitive);
+		var res = new GenericArray<GrepMatch> ();
+		engine.search_data ("file", text.data, res);
+		return res;
+	} catch (Error e) {
+		assert_not_reached ();
+	}
+}
+
+void assert_match (GrepMatch match, int line, string text, int start, int end) {
+	assert (match.line == line);
+	assert (match.text.length == text.length && Memory.cmp (match.text, text, text.length) == 0);
+	assert (match.ranges[0] == start && match.ranges[1] == end);
+}
+
+void test_literal () {
+	var res = grep ("foo", false, "a foo\nbar\nfoo foo\nFOO");
+	assert (res.length == 2);
+	assert_match (res[0], 0, "a foo", 2, 5);
+	assert_match (res[1], 2, "foo foo", 0, 3);
+	assert (res[1].ranges.length == 4);
+	assert (res[1].ranges[2] == 4);
+
+	res = grep ("foo", true, "a foo\nbar\nFOO");
+	assert (res.length == 2);
+	assert_match (res[1], 2, "FOO", 0, 3);
+
+	// no trailing newline
+	res = grep ("bar", false, "foo\nbar");
+	assert (res.length == 1);
+	assert_match (res[0], 1, "bar", 0, 3);
+}
+
+void test_regex () {
+	var res = grep ("fo+ ba[rz]", false, "fo baz\nfoo bar\nfoobar\nfooo baz");
+	assert (res.length == 3);
+	assert_match (res[0], 0, "fo baz", 0, 6);
+	assert_match (res[1], 1, "foo bar", 0, 7);
+	assert_match (res[2], 3, "fooo baz", 0, 8);
+
+	// the optional char is not part of the searched prefix
+	res = grep ("abc?d", false, "abd\nabcd\nacd");
+	assert (res.length == 2);
+
+	res = grep ("^b|c$", false, "abc\nbar\ncab");
+	assert (res.length == 2);
+	assert (res[0].line == 0 && res[1].line == 1);
+
+	// invalid regexes are searched literally
+	res = grep ("foo(", false, "foo(bar)\nfoo");
+	assert (res.length == 1);
+	assert_match (res[0], 0, "foo(bar)", 0, 4);
+	res = grep ("Foo[", true, "a foo[1]\nfoo");
+	assert (res.length == 1);
+	assert_match (res[0], 0, "a foo[1]", 2, 6);
+}
+
+void assert_extended (string pattern, string? expected) {
+	try {
+		var res = GrepEngine.to_extended_regex (pattern);
+		assert (expected != null && res == expected);
+	} catch (RegexError e) {
+		assert (expected == null);
+	}
+}
+
+void test_extended () {
+	assert_extended ("foo", "foo");
+	assert_extended ("fo+ ba[rz]?", "fo+ ba[rz]?");
+	assert_extended ("\\d+\\s\\w", "[0-9]+[[:space:]][[:alnum:]_]");
+	assert_extended ("[\\d.]\\.", "[0-9.]\\.");
+	assert_extended ("[]a][[:alpha:]]", "[]a][[:alpha:]]");
+	assert_extended ("(?:ab)+", "(ab)+");
+	// errors on both paths
+	assert_extended ("foo(", null);
+	assert_extended ("a(?=b)", null);
+	assert_extended ("\\x41", null);
+
+	// the same lines match with git grep -E
+	string dir = null;
+	try {
+		dir = DirUtils.make_tmp ("vanubi-grep-XXXXXX");
+		var text = "foo(bar)\nfoo 12\nfoobar\nx\ty\nFOO.baz\n";
+		FileUtils.set_contents (Path.build_filename (dir, "a"), text);
+		string[] patterns = { "foo\\(", "\\d+$", "o\\w*r", "x\\sy", "foo\\.", "(?:ba)[rz]", "foo(" };
+		foreach (var pattern in patterns) {
+			var insensitive = pattern.down () == pattern;
+			var engine = new GrepEngine (pattern, insensitive);
+			var res = new GenericArray<GrepMatch> ();
+			engine.search_data ("a", text.data, res);
+			var expected = "";
+			foreach (var match in res.data) {
+				expected += "a:%d\n".printf (match.line+1);
+			}
+
+			string[] argv = { "git", "grep", "--no-index", insensitive ? "-inI" : "-nI" };
+			foreach (var arg in GrepEngine.git_grep_args (pattern)) {
+				argv += arg;
+			}
+			string output;
+			int status;
+			try {
+				Process.spawn_sync (dir, argv, null, SpawnFlags.SEARCH_PATH|SpawnFlags.STDERR_TO_DEV_NULL, null, out output, null, out status);
+			} catch (SpawnError e) {
+				Test.message ("git grep not available: %s", e.message);
+				break;
+			}
+			// keep only the file and the line number
+			var lines = "";
+			foreach (var line in output.split ("\n")) {
+				var fields = line.split (":");
+				if (fields.length >= 2) {
+					lines += "%s:%s\n".printf (fields[0], fields[1]);
+				}
+			}
+			assert (lines == expected);
+		}
+		FileUtils.unlink (Path.build_filename (dir, "a"));
+		DirUtils.remove (dir);
+	} catch (Error e) {
+		assert_not_reached ();
+	}
+}
+
+async void test_search_helper (MainLoop loop) {
+	string dir = null;
+	try {
+		dir = DirUtils.make_tmp ("vanubi-grep-XXXXXX");
+		FileUtils.set_contents (Path.build_filename (dir, "a"), "match\nno\n");
+		FileUtils.set_contents (Path.build_filename (dir, "b"), "no\n");
+		FileUtils.set_contents (Path.build_filename (dir, "ignored.o"), "match\n");
+		uint8[] binary = { 'm', 'a', 't', 'c', 'h', 0, '\n' };
+		FileUtils.set_data (Path.build_filename (dir, "binary"), binary);
+		FileUtils.set_contents (Path.build_filename (dir, ".gitignore"), "*.o\nbuild/\n");
+		DirUtils.create (Path.build_filename (dir, "build"), 0755);
+		FileUtils.set_contents (Path.build_filename (dir, "build", "c"), "match\n");
+		DirUtils.create (Path.build_filename (dir, "sub"), 0755);
+		FileUtils.set_contents (Path.build_filename (dir, "sub", "d"), "no\nmatch\n");
+
+		var files = GrepEngine.list_files (dir);
+		assert (files.length == 5);
+		foreach (var file in files) {
+			assert (file != "ignored.o" && !file.has_prefix ("build"));
+		}
+
+		var engine = new GrepEngine ("match", false);
+		// unsaved contents
+		engine.set_contents (Path.build_filename (dir, "b"), new Bytes ("no\nmatch\n".data));
+		var found = new HashTable<string, int> (str_hash, str_equal);
+		yield engine.search (dir, files, (matches) => {
+				foreach (var match in matches) {
+					assert (!(match.path in found));
+					found[match.path] = match.line;
+				}
+		});
+		assert (found.size () == 3);
+		assert (found["a"] == 0);
+		assert (found["b"] == 1);
+		assert (found["sub/d"] == 1);
+
+		foreach (var file in files) {
+			FileUtils.unlink (Path.build_filename (dir, file));
+		}
+		FileUtils.unlink (Path.build_filename (dir, "ignored.o"));
+		FileUtils.unlink (Path.build_filename (dir, "build", "c"));
+		DirUtils.remove (Path.build_filename (dir, "build"));
+		DirUtils.remove (Path.build_filename (dir, "sub"));
+		DirUtils.remove (dir);
+	} catch (Error e) {
+		assert_not_reached ();
+	}
+	loop.quit ();
+}
+
+void test_search () {
+	var loop = new MainLoop (MainContext.default ());
+	test_search_helper.begin (loop);
+	loop.run ();
+}
+
+async void test_perf_helper (MainLoop loop) {
+	string dir = null;
+	try {
+		dir = DirUtils.make_tmp ("vanubi-grep-perf-XXXXXX");
+		var rand = new Rand.with_seed (1);
+		string[] files = {};
+		for (var f=0; f < 200; f++) {
+			var text = new StringBuilder ();
+			for (var i=0; i < 5000; i++) {
+				text.append_printf ("line %d of file %d with Value %u\n", i, f, rand.next_int ());
+			}
+			var name = "file%d.txt".printf (f);
+			FileUtils.set_contents (Path.build_filename (dir, name), text.str);
+			files += name;
+		}
+
+		// literal, regex with a literal prefix, case insensitive
+		string[] patterns = { "Value 12345", "file 1[0-9] with", "value 12345" };
+		foreach (var pattern in patterns) {
+			var count = 0;
+			var insensitive = pattern.down () == pattern;
+			var engine = new GrepEngine (pattern, insensitive);
+			Test.timer_start ();
+			yield engine.search (dir, files, (matches) => { count += matches.length; });
+			Test.message ("grep engine '%s': %.2fms, %d matches", pattern, Test.timer_elapsed ()*1000, count);
+
+			// compare with git grep on the same files
+			string[] argv = { "git", "grep", "--no-index", insensitive ? "-inI" : "-nI", pattern };
+			try {
+				Test.timer_start ();
+				string output;
+				Process.spawn_sync (dir, argv, null, SpawnFlags.SEARCH_PATH|SpawnFlags.STDERR_TO_DEV_NULL, null, out output);
+				Test.message ("git grep '%s': %.2fms", pattern, Test.timer_elapsed ()*1000);
+			} catch (Error e) {
+				Test.message ("git grep not available: %s", e.message);
+			}
+		}
+
+		foreach (var file in files) {
+			FileUtils.unlink (Path.build_filename (dir, file));
+		}
+		DirUtils.remove (dir);
+	} catch (Error e) {
+		assert_not_reached ();
+	}
+	loop.quit ();
+}
+
+void test_perf () {
+	if (!Test.perf ()) {
+		return;
+	}
+
+	var loop = new MainLoop (MainContext.default ());
+	test_perf_helper.begin (loop);
+	loop.run ();
+}
+
+int main (string[] args) {
+	Test.init (ref args);
+
+	Test.add_func ("/grep/literal", test_literal);
+	Test.add_func ("/grep/regex", test_regex);
+	Test.add_func ("/grep/extended", test_extended);
+	Test.add_func ("/grep/search", test_search);
+	Test.add_func ("/grep/perf", test_perf);
+
+	return Test.run ();
+}
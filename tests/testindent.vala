@@ -218,6 +218,152 @@ foo {
 	assert (line.index_of_char ('\t') < 0);
 }
 
+void test_cache () {
+	var buffer = new StringBuffer.from_text ("foo
+bar
+baz
+");
+	var w = buffer.tab_width;
+	var indenter = new Indent_C (buffer);
+	assert_indent (indenter, buffer, 1, 0);
+	assert_indent (indenter, buffer, 2, 0);
+
+	// editing a line invalidates the cached brackets
+	buffer.insert (buffer.line_end (0), " {");
+	assert_indent (indenter, buffer, 1, w);
+	assert_indent (indenter, buffer, 2, w);
+	buffer.insert (buffer.line_start (2), "}");
+	assert_indent (indenter, buffer, 2, 0);
+	assert_indent (indenter, buffer, 3, 0);
+}
+
+void test_reindent_lines () {
+	var code = generate_c_code (500);
+	var n_lines = code.split ("\n").length;
+	// shuffle the indentation
+	var rand = new Rand.with_seed (3);
+	var lines = code.split ("\n");
+	for (var i=0; i < lines.length; i++) {
+		lines[i] = string.nfill (rand.int_range (0, 10), ' ')+lines[i];
+	}
+	code = string.joinv ("\n", lines);
+
+	var expected = new StringBuffer.from_text (code);
+	var indenter = new Indent_C (expected);
+	for (var line=0; line < n_lines; line++) {
+		indenter.indent (expected.line_start (line));
+	}
+
+	var buffer = new StringBuffer.from_text (code);
+	indenter = new Indent_C (buffer);
+	var indents = indenter.compute_indents (0, n_lines-1);
+	// the buffer is not modified
+	assert (buffer.text == code);
+	for (var line=0; line < n_lines; line++) {
+		assert (indents[line] == expected.get_indent (line));
+	}
+	assert (indenter.reindent_lines (0, n_lines-1) > 0);
+	assert (buffer.text == expected.text);
+	assert (indenter.reindent_lines (0, n_lines-1) == 0);
+}
+
+string generate_c_code (int n_lines) {
+	var code = new StringBuilder ();
+	var rand = new Rand.with_seed (1);
+	var depth = 0;
+	for (var i=0; i < n_lines; i++) {
+		var op = rand.int_range (0, 6);
+		if (op == 0 && depth < 8) {
+			code.append ("if (foo (bar, baz)) {\n");
+			depth++;
+		} else if (op == 1 && depth > 0) {
+			code.append ("}\n");
+			depth--;
+		} else if (op == 2) {
+			code.append ("call (arg1,\narg2);\n");
+			i++;
+		} else {
+			code.append ("statement [%d] = '{';\n".printf (i));
+		}
+	}
+	for (; depth > 0; depth--) {
+		code.append ("}\n");
+	}
+	return code.str;
+}
+
+void test_perf () {
+	if (!Test.perf ()) {
+		return;
+	}
+
+	var code = generate_c_code (10000);
+	var n_lines = code.split ("\n").length;
+	var buffer = new StringBuffer.from_text (code);
+	var indenter = new Indent_C (buffer);
+	Test.timer_start ();
+	for (var line=0; line < n_lines; line++) {
+		indenter.indent (buffer.line_start (line));
+	}
+	Test.message ("reindent region of %d lines: %.2fms", n_lines, Test.timer_elapsed ()*1000);
+
+	// reindenting again does not change the buffer
+	var text = buffer.text;
+	Test.timer_start ();
+	for (var line=0; line < n_lines; line++) {
+		indenter.indent (buffer.line_start (line));
+	}
+	Test.message ("reindent already indented region: %.2fms", Test.timer_elapsed ()*1000);
+	assert (buffer.text == text);
+
+	code = generate_c_code (50000);
+	n_lines = code.split ("\n").length;
+	buffer = new StringBuffer.from_text (code);
+	indenter = new Indent_C (buffer);
+	Test.timer_start ();
+	var changed = indenter.reindent_lines (0, n_lines-1);
+	Test.message ("batch reindent of %d lines: %.2fms, %d lines changed", n_lines, Test.timer_elapsed ()*1000, changed);
+}
+
+void test_formatter () {
+	try {
+		var dir = DirUtils.make_tmp ("vanubi-indent-XXXXXX");
+		var c_file = Path.build_filename (dir, "a.c");
+		FileUtils.set_contents (c_file, "foo {\nbar;\n\n\tbaz;\n}\n");
+		var py_file = Path.build_filename (dir, "a.py");
+		FileUtils.set_contents (py_file, "def foo:\nbar\n");
+
+		var formatter = new IndentFormatter ();
+		var result = formatter.format_file (c_file);
+		assert (!result.skipped && result.error == null);
+		// blank lines are left untouched
+		assert (result.lines.length == 1);
+		assert (result.lines[0] == 1 && result.indents[0] == 0 && result.new_indents[0] == 4);
+		assert (formatter.format_file (py_file).skipped);
+
+		formatter.in_place = true;
+		formatter.format_file (c_file);
+		string contents;
+		FileUtils.get_contents (c_file, out contents);
+		assert (contents == "foo {\n\tbar;\n\n\tbaz;\n}\n");
+		assert (formatter.format_file (c_file).lines.length == 0);
+
+		// brackets in comments and strings are not counted
+		FileUtils.set_contents (c_file, "foo {\n// {\nbar (\"(\");\n}\nbaz;\n");
+		formatter.in_place = false;
+		result = formatter.format_file (c_file);
+		assert (result.lines.length == 2);
+		assert (result.lines[0] == 1 && result.new_indents[0] == 4);
+		assert (result.lines[1] == 2 && result.new_indents[1] == 4);
+
+		FileUtils.unlink (c_file);
+		FileUtils.unlink (py_file);
+		DirUtils.remove (dir);
+	} catch (Error e) {
+		assert_not_reached ();
+	}
+}
+
 int main (string[] args) {
 	Test.init (ref args);
 
@@ -226,6 +372,10 @@ int main (string[] args) {
 	Test.add_func ("/indent/lang_shell", test_lang_shell);
 	Test.add_func ("/indent/lang_haskell", test_lang_haskell);
 	Test.add_func ("/indent/spaces", test_spaces);
+	Test.add_func ("/indent/cache", test_cache);
+	Test.add_func ("/indent/reindent_lines", test_reindent_lines);
+	Test.add_func ("/indent/formatter", test_formatter);
+	Test.add_func ("/indent/perf", test_perf);
 
 	return Test.run ();
 }
@@ -70,6 +70,71 @@ void test_real1 () {
 	assert (res[2] == objs[0]);
 }
 
+void test_many_into () {
+	Annotated<string>[] objs = null;
+	objs += annotate ("Makefile.am");
+	objs += annotate ("matching.vala");
+	objs += annotate ("vanubi.deps");
+
+	var res = new GenericArray<Annotated<string>> ();
+	pattern_match_many_into<string> ("MA", objs, res);
+	assert (res.length == 2);
+	assert (res[0] == objs[0]);
+	assert (res[1] == objs[1]);
+
+	// the result is cleared before being reused
+	pattern_match_many_into<string> ("deps", objs, res);
+	assert (res.length == 1);
+	assert (res[0] == objs[2]);
+
+	pattern_match_many_into<string> ("z", objs, res);
+	assert (res.length == 0);
+}
+
+void test_char_mask () {
+	assert (char_mask ("abc") == char_mask ("CBA"));
+	assert ((char_mask ("vala") & ~char_mask ("vanubi.vala")) == 0);
+	assert ((char_mask ("x") & ~char_mask ("vanubi.vala")) != 0);
+}
+
+void test_many_parallel () {
+	Annotated<string>[] objs = null;
+	for (var i=0; i < 20000; i++) {
+		objs += annotate ("file%d.vala".printf (i));
+	}
+
+	var seq = pattern_match_many<string> ("f19v", objs);
+	pattern_match_threads = 4;
+	var par = pattern_match_many_parallel<string> ("f19v", objs);
+	assert (seq.length == par.length);
+	for (var i=0; i < seq.length; i++) {
+		assert (seq[i] == par[i]);
+	}
+
+	par = pattern_match_many_parallel<string> ("f19v", objs, false);
+	assert (seq.length == par.length);
+	pattern_match_threads = 0;
+}
+
+void test_many_perf () {
+	if (!Test.perf ()) {
+		return;
+	}
+
+	Annotated<string>[] objs = new Annotated<string>[1000000];
+	for (var i=0; i < objs.length; i++) {
+		objs[i] = annotate ("src/dir%d/file%d.vala".printf (i%1000, i));
+	}
+
+	for (var threads=1; threads <= 8; threads *= 2) {
+		pattern_match_threads = threads;
+		Test.timer_start ();
+		pattern_match_many_parallel<string> ("d12f34v", objs);
+		Test.message ("%d threads: %gs", threads, Test.timer_elapsed ());
+	}
+	pattern_match_threads = 0;
+}
+
 int main (string[] args) {
 	Test.init (ref args);
 
@@ -82,6 +147,10 @@ int main (string[] args) {
 	Test.add_func ("/match/common-prefix", test_common_prefix);
 	Test.add_func ("/match/many", test_many);
 	Test.add_func ("/match/real1", test_real1);
+	Test.add_func ("/match/many_into", test_many_into);
+	Test.add_func ("/match/char_mask", test_char_mask);
+	Test.add_func ("/match/many_parallel", test_many_parallel);
+	Test.add_func ("/match/many_perf", test_many_perf);
 
 	return Test.run ();
 }
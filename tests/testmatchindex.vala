@@ -0,0 +1,188 @@
+/**
+ * Test the search match index.
+ */
+
+using Vanubi;
+
+MatchIndex index (string pattern, bool is_regex, bool insensitive, string text) {
+	try {
+		var res = new MatchIndex (pattern, is_regex, insensitive);
+		// an empty index, the whole text is a new region
+		res.replace_region (0, 0, text);
+		return res;
+	} catch (Error e) {
+		assert_not_reached ();
+	}
+}
+
+void assert_match (MatchIndex index, int i, int start, int end) {
+	int s, e;
+	assert (index.get_match (i, out s, out e));
+	assert (s == start && e == end);
+}
+
+void test_literal () {
+	var res = index ("foo", false, false, "a foo\nbar\nfoo foo\nFOO");
+	assert (res.length == 3);
+	assert_match (res, 0, 2, 5);
+	assert_match (res, 1, 10, 13);
+	assert_match (res, 2, 14, 17);
+
+	res = index ("foo", false, true, "a foo\nbar\nFOO");
+	assert (res.length == 2);
+	assert_match (res, 1, 10, 13);
+
+	// regex chars in literals
+	res = index ("a.b", false, false, "axb a.b");
+	assert (res.length == 1);
+	assert_match (res, 0, 4, 7);
+
+	// char offsets
+	res = index ("bar", false, false, "città bar");
+	assert_match (res, 0, 6, 9);
+}
+
+void test_regex () {
+	var res = index ("fo+ ba[rz]", true, false, "fo baz\nfoo bar\nfoobar");
+	assert (res.length == 2);
+	assert_match (res, 0, 0, 6);
+	assert_match (res, 1, 7, 14);
+
+	// empty matches are skipped
+	res = index ("x*", true, false, "ab\nxx");
+	assert (res.length == 1);
+	assert_match (res, 0, 3, 5);
+	// matches are limited to a line
+	res = index ("a\\s+b", true, false, "a\nb a b");
+	assert (res.length == 1);
+	assert_match (res, 0, 4, 7);
+	res = index ("foo\\s+", true, false, "foo \n  bar");
+	assert (res.length == 1);
+	assert_match (res, 0, 0, 4);
+	res = index ("\\s+$", true, false, "a  \n\nb \n");
+	assert (res.length == 2);
+	assert_match (res, 0, 1, 3);
+	assert_match (res, 1, 6, 7);
+
+	res = index ("^b", true, false, "abc\nbar\nbab");
+	assert (res.length == 2);
+}
+
+void test_navigate () {
+	var res = index ("ab", false, false, "ab ab\n\nab");
+	int start, end;
+	assert (res.next (0, out start, out end) && start == 0);
+	assert (res.next (1, out start, out end) && start == 3 && end == 5);
+	assert (!res.next (8, out start, out end));
+	assert (res.prev (8, out start, out end) && start == 7);
+	assert (res.prev (3, out start, out end) && start == 3);
+	assert (res.prev (2, out start, out end) && start == 0);
+	assert (res.index_of (3) == 1);
+	assert (res.index_of (4) == -1);
+	assert (res.index_after (4) == 2);
+	assert (res.index_after (8) == 3);
+}
+
+void test_replace_region () {
+	var res = index ("ab", false, false, "ab\nxx\nab ab");
+	assert (res.length == 3);
+
+	// "xx" -> "ab ab"
+	res.replace_region (3, 5, "ab ab");
+	assert (res.length == 5);
+	assert_match (res, 0, 0, 2);
+	assert_match (res, 1, 3, 5);
+	assert_match (res, 2, 6, 8);
+	// moved after the region
+	assert_match (res, 3, 9, 11);
+	assert_match (res, 4, 12, 14);
+
+	// remove the first line
+	res.replace_region (0, 3, "");
+	assert (res.length == 4);
+	assert_match (res, 0, 0, 2);
+	assert_match (res, 3, 9, 11);
+}
+
+async void test_scan_helper (MainLoop loop) {
+	try {
+		var res = new MatchIndex ("b+", true, false);
+		yield res.scan ("abba\nb", Priority.DEFAULT, null);
+		assert (res.length == 2);
+		assert_match (res, 0, 1, 3);
+		assert_match (res, 1, 5, 6);
+
+		var cancellable = new Cancellable ();
+		cancellable.cancel ();
+		try {
+			yield res.scan ("bbb", Priority.DEFAULT, cancellable);
+			assert_not_reached ();
+		} catch (IOError.CANCELLED e) {
+		}
+		// the previous matches are kept
+		assert (res.length == 2);
+	} catch (Error e) {
+		assert_not_reached ();
+	}
+	loop.quit ();
+}
+
+void test_scan () {
+	var loop = new MainLoop (MainContext.default ());
+	test_scan_helper.begin (loop);
+	loop.run ();
+}
+
+async void test_perf_helper (MainLoop loop) {
+	var rand = new Rand.with_seed (1);
+	var text = new StringBuilder ();
+	for (var i=0; i < 200000; i++) {
+		text.append_printf ("line %d with Value %u\n", i, rand.next_int ());
+	}
+
+	try {
+		var res = new MatchIndex ("value 1", false, true);
+		Test.timer_start ();
+		yield res.scan (text.str, Priority.DEFAULT, null);
+		Test.message ("scan of 200k lines: %.2fms, %d matches", Test.timer_elapsed ()*1000, res.length);
+
+		Test.timer_start ();
+		for (var i=0; i < 1000; i++) {
+			res.replace_region (0, 0, "Value 1\n");
+		}
+		Test.message ("update after an edit: %.3fms", Test.timer_elapsed ()*1000/1000);
+
+		Test.timer_start ();
+		int start, end;
+		for (var i=0; i < 100000; i++) {
+			res.next (rand.int_range (0, (int) text.len), out start, out end);
+		}
+		Test.message ("next match: %.3fus", Test.timer_elapsed ()*1000000/100000);
+	} catch (Error e) {
+		assert_not_reached ();
+	}
+	loop.quit ();
+}
+
+void test_perf () {
+	if (!Test.perf ()) {
+		return;
+	}
+
+	var loop = new MainLoop (MainContext.default ());
+	test_perf_helper.begin (loop);
+	loop.run ();
+}
+
+int main (string[] args) {
+	Test.init (ref args);
+
+	Test.add_func ("/matchindex/literal", test_literal);
+	Test.add_func ("/matchindex/regex", test_regex);
+	Test.add_func ("/matchindex/navigate", test_navigate);
+	Test.add_func ("/matchindex/replace_region", test_replace_region);
+	Test.add_func ("/matchindex/scan", test_scan);
+	Test.add_func ("/matchindex/perf", test_perf);
+
+	return Test.run ();
+}
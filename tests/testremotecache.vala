@@ -0,0 +1,145 @@
+/**
+ * Test the cache of remote files.
+ */
+
+using Vanubi;
+
+void test_info () {
+	var cache = new RemoteCache (1024, null);
+	var source = new LocalFileSource (File.new_for_path ("/dir/file"));
+	SourceInfo? info;
+
+	assert (!cache.lookup_info ("/dir/file", out info));
+	cache.cache_info ("/dir/file", new SourceInfo.with_stat (source, false, 10, 1000, 0644));
+	assert (cache.lookup_info ("/dir/file", out info));
+	assert (info != null && info.size == 10 && info.mtime == 1000);
+	// without a fractional part from the agent
+	assert (info.mtime_usec == 1000000000);
+
+	// known to be missing
+	cache.cache_info ("/dir/missing", null);
+	assert (cache.lookup_info ("/dir/missing", out info));
+	assert (info == null);
+
+	// children of a listed directory not in the cache do not exist
+	assert (!cache.lookup_info ("/dir/other", out info));
+	cache.cache_listed ("/dir");
+	assert (cache.lookup_info ("/dir/other", out info));
+	assert (info == null);
+
+	cache.invalidate ("/dir/file");
+	assert (!cache.lookup_info ("/dir/file", out info));
+	assert (!cache.lookup_info ("/dir/other", out info));
+
+	// expiration
+	cache.ttl = 0;
+	cache.cache_info ("/dir/file", new SourceInfo (source, false));
+	assert (!cache.lookup_info ("/dir/file", out info));
+}
+
+async void test_content_helper (MainLoop loop) {
+	var cache = new RemoteCache (10, null);
+
+	yield cache.store_content ("/a", "aaaa".data, 4, 1000);
+	var data = yield cache.lookup_content ("/a", 4, 1000);
+	assert (data != null && data.length == 4 && Memory.cmp (data, "aaaa", 4) == 0);
+	// modified
+	data = yield cache.lookup_content ("/a", 4, 1001);
+	assert (data == null);
+	assert (cache.memory_used == 0);
+
+	yield cache.store_content ("/a", "aaaa".data, 4, 1000);
+	yield cache.store_content ("/b", "bbbb".data, 4, 1000);
+	// use /a so that /b gets evicted
+	data = yield cache.lookup_content ("/a", 4, 1000);
+	assert (data != null);
+	yield cache.store_content ("/c", "cccc".data, 4, 1000);
+	assert (cache.memory_used == 8);
+	assert ((yield cache.lookup_content ("/b", 4, 1000)) == null);
+	assert ((yield cache.lookup_content ("/a", 4, 1000)) != null);
+	assert ((yield cache.lookup_content ("/c", 4, 1000)) != null);
+
+	// over budget
+	yield cache.store_content ("/big", "0123456789abcdef".data, 16, 1000);
+	assert ((yield cache.lookup_content ("/big", 16, 1000)) == null);
+
+	loop.quit ();
+}
+
+void test_content () {
+	var loop = new MainLoop (MainContext.default ());
+	test_content_helper.begin (loop);
+	loop.run ();
+}
+
+async void test_disk_helper (MainLoop loop) {
+	string dir = null;
+	try {
+		dir = DirUtils.make_tmp ("vanubi-cache-XXXXXX");
+	} catch (Error e) {
+		assert_not_reached ();
+	}
+
+	var cache = new RemoteCache (1024, dir);
+	yield cache.store_content ("/a", "content".data, 7, 1000);
+
+	// a new session reads it back from the disk
+	cache = new RemoteCache (1024, dir);
+	var data = yield cache.lookup_content ("/a", 7, 1000);
+	assert (data != null && data.length == 7 && Memory.cmp (data, "content", 7) == 0);
+	assert (cache.memory_used == 7);
+
+	cache = new RemoteCache (1024, dir);
+	data = yield cache.lookup_content ("/a", 7, 1001);
+	assert (data == null);
+
+	cache.invalidate ("/a");
+	cache = new RemoteCache (1024, dir);
+	data = yield cache.lookup_content ("/a", 7, 1000);
+	assert (data == null);
+	assert (cache.disk_used == 0);
+
+	// room for two files on disk, header included
+	var entry_size = "vanubi-cache 1 7 1000 /a\n".length+7;
+	cache = new RemoteCache (1024, dir, entry_size*2+1);
+	yield cache.store_content ("/a", "content".data, 7, 1000);
+	yield cache.store_content ("/b", "content".data, 7, 1000);
+	// /a is now the most recently used
+	data = yield cache.lookup_content ("/a", 7, 1000);
+	assert (data != null);
+	yield cache.store_content ("/c", "content".data, 7, 1000);
+	assert (cache.disk_used == entry_size*2);
+
+	cache = new RemoteCache (1024, dir, entry_size*2+1);
+	data = yield cache.lookup_content ("/b", 7, 1000);
+	assert (data == null);
+	data = yield cache.lookup_content ("/a", 7, 1000);
+	assert (data != null);
+	assert (cache.disk_used == entry_size*2);
+
+	// a stale version in memory is removed from the disk too
+	data = yield cache.lookup_content ("/a", 7, 1001);
+	assert (data == null);
+	assert (cache.disk_used == entry_size);
+	cache.invalidate ("/c");
+	assert (cache.disk_used == 0);
+
+	DirUtils.remove (dir);
+	loop.quit ();
+}
+
+void test_disk () {
+	var loop = new MainLoop (MainContext.default ());
+	test_disk_helper.begin (loop);
+	loop.run ();
+}
+
+int main (string[] args) {
+	Test.init (ref args);
+
+	Test.add_func ("/remotecache/info", test_info);
+	Test.add_func ("/remotecache/content", test_content);
+	Test.add_func ("/remotecache/disk", test_disk);
+
+	return Test.run ();
+}
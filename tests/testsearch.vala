@@ -39,11 +39,30 @@ void test_synonyms () {
 	assert (result.length () == 2);
 }
 
+void test_ranking () {
+	setup ();
+	idx.index_document (new StringSearchDocument ("quux", {"other"}));
+
+	var result = idx.search ("qux", true);
+	assert (result.length () == 2);
+	assert (((StringSearchDocument) result.data.doc).name == "test");
+	assert (((StringSearchDocument) result.next.data.doc).name == "quux");
+
+	result = idx.search ("qux", true, 1);
+	assert (result.length () == 1);
+	assert (((StringSearchDocument) result.data.doc).name == "test");
+
+	// no candidate document
+	result = idx.search ("zzz", true);
+	assert (result.length () == 0);
+}
+
 int main (string[] args) {
 	Test.init (ref args);
 
 	Test.add_func ("/search/simple", test_simple);
 	Test.add_func ("/search/synonyms", test_synonyms);
+	Test.add_func ("/search/ranking", test_ranking);
 
 	return Test.run ();
 }
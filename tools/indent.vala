@@ -0,0 +1,153 @@
+/*
+ *  Copyright © 2014 Luca Bruno
+ *
+ *  This file is part of Vanubi.
+ *
+ *  Vanubi is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Vanubi is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Vanubi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks or fixes the indentation of files with the rules of the editor */
+
+using Vanubi;
+
+static bool arg_check = false;
+static bool arg_in_place = false;
+static bool arg_spaces = false;
+static int arg_tab_width = 4;
+static string[] arg_paths;
+
+const OptionEntry[] options = {
+	{ "check", 'c', 0, OptionArg.NONE, ref arg_check, "Report the lines to reindent and exit with 1 if any (default)", null },
+	{ "in-place", 'i', 0, OptionArg.NONE, ref arg_in_place, "Reindent the files in place", null },
+	{ "tab-width", 't', 0, OptionArg.INT, ref arg_tab_width, "Width of a tab, defaults to 4", "N" },
+	{ "spaces", 's', 0, OptionArg.NONE, ref arg_spaces, "Indent with spaces instead of tabs", null },
+	{ "", 0, 0, OptionArg.FILENAME_ARRAY, ref arg_paths, null, "FILE|DIR..." },
+	{ null }
+};
+
+// max lines reported per file
+const int REPORTED_LINES = 5;
+
+string[] collect_files (string[] paths) throws Error {
+	string[] files = {};
+	foreach (var path in paths) {
+		if (FileUtils.test (path, FileTest.IS_DIR)) {
+			foreach (var file in GrepEngine.list_files (path)) {
+				if (IndentFormatter.language_for_file (file) != null) {
+					files += Path.build_filename (path, file);
+				}
+			}
+		} else {
+			files += path;
+		}
+	}
+	return files;
+}
+
+async int run (string[] files) {
+	var formatter = new IndentFormatter ();
+	formatter.tab_width = arg_tab_width;
+	formatter.indent_mode = arg_spaces ? IndentMode.SPACES : IndentMode.TABS;
+	formatter.in_place = arg_in_place;
+
+	var timer = new Timer ();
+	IndentResult[] results;
+	try {
+		results = yield formatter.format (files);
+	} catch (Error e) {
+		printerr ("%s\n", e.message);
+		return 2;
+	}
+	var elapsed = timer.elapsed ();
+
+	var status = 0;
+	int n_lines = 0, n_changed = 0, n_files = 0, n_skipped = 0;
+	foreach (var result in results) {
+		if (result.error != null) {
+			printerr ("%s: %s\n", result.path, result.error);
+			status = 2;
+			continue;
+		}
+		if (result.skipped) {
+			n_skipped++;
+			continue;
+		}
+
+		n_lines += result.n_lines;
+		if (result.lines.length == 0) {
+			continue;
+		}
+		n_files++;
+		n_changed += result.lines.length;
+		if (arg_in_place) {
+			print ("%s: %d lines reindented\n", result.path, result.lines.length);
+			continue;
+		}
+
+		print ("%s: %d lines to reindent\n", result.path, result.lines.length);
+		for (var i=0; i < int.min (result.lines.length, REPORTED_LINES); i++) {
+			print ("  %d: indent %d, expected %d\n", result.lines[i]+1, result.indents[i], result.new_indents[i]);
+		}
+		if (result.lines.length > REPORTED_LINES) {
+			print ("  ...\n");
+		}
+		if (status == 0) {
+			status = 1;
+		}
+	}
+
+	printerr ("%d files, %d skipped, %d lines %s in %d files; %d lines in %.2fs (%.0f lines/s)\n",
+			  results.length, n_skipped, n_changed, arg_in_place ? "reindented" : "to reindent", n_files,
+			  n_lines, elapsed, n_lines/double.max (elapsed, 0.000001));
+	return status;
+}
+
+int main (string[] args) {
+	try {
+		var opt_context = new OptionContext ("- Vanubi indenter");
+		opt_context.set_help_enabled (true);
+		opt_context.add_main_entries (options, null);
+		unowned string[] tmp = args;
+		opt_context.parse (ref tmp);
+	} catch (OptionError e) {
+		printerr ("%s\n", e.message);
+		printerr ("Run '%s --help' to see a full list of available command line options.\n", args[0]);
+		return 2;
+	}
+	if (arg_check && arg_in_place) {
+		printerr ("--check and --in-place are mutually exclusive\n");
+		return 2;
+	}
+	string[] paths = { "." };
+	if (arg_paths.length > 0) {
+		paths = arg_paths;
+	}
+
+	string[] files;
+	try {
+		files = collect_files (paths);
+	} catch (Error e) {
+		printerr ("%s\n", e.message);
+		return 2;
+	}
+
+	var loop = new MainLoop ();
+	var status = 0;
+	run.begin (files, (obj, res) => {
+			status = run.end (res);
+			loop.quit ();
+	});
+	loop.run ();
+	return status;
+}